@@ -21,6 +21,10 @@ struct _PixelCoords {
 
 typedef struct _PixelCoords PixelCoords;
 
+// Memory accounting category of the STACK and QUEUE buffers
+// (see InstrMemName in instrumentation.h)
+#define PIXELCOORDS_MEM 2
+
 PixelCoords PixelCoordsCreate(int u, int v);
 
 int PixelCoordsGetU(PixelCoords p);
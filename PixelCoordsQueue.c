@@ -18,10 +18,12 @@
 #include <string.h>
 
 #include "PixelCoords.h"
+#include "instrumentation.h"
 
 struct _PixelCoordsQueue {
   uint32_t max_size;  // maximum Queue size
   uint32_t cur_size;  // current Queue size
+  uint32_t peak_size; // largest cur_size so far (instrumented builds)
   uint32_t head;
   uint32_t tail;
   PixelCoords* data;  // the data (PixelCoords instances stored in an array)
@@ -42,6 +44,7 @@ Queue* QueueCreate(uint32_t size) {
 
   q->max_size = size;
   q->cur_size = 0;
+  q->peak_size = 0;
 
   q->head = 1;  // cur_size = tail - head + 1
   q->tail = 0;
@@ -51,12 +54,14 @@ Queue* QueueCreate(uint32_t size) {
     free(q);
     abort();
   }
+  INSTR_MEM_ALLOC(PIXELCOORDS_MEM, size * sizeof(PixelCoords));
   return q;
 }
 
 void QueueDestroy(Queue** p) {
   assert(*p != NULL);
   Queue* q = *p;
+  INSTR_MEM_FREE(PIXELCOORDS_MEM, q->max_size * sizeof(PixelCoords));
   free(q->data);
   free(q);
   *p = NULL;
@@ -66,6 +71,7 @@ void QueueClear(Queue* q) {
   q->cur_size = 0;
   q->head = 1;  // cur_size = tail - head + 1
   q->tail = 0;
+  q->peak_size = 0;
 }
 
 uint32_t QueueSize(const Queue* q) { return q->cur_size; }
@@ -108,6 +114,8 @@ void QueueEnqueue(Queue* q, PixelCoords p) {
 
     // Freeing the old array
     free(old);
+    INSTR_MEM_REALLOC(PIXELCOORDS_MEM, q->cur_size * sizeof(PixelCoords),
+                      q->max_size * sizeof(PixelCoords));
 
     // Resetting the head and tail indices
     q->head = 0;
@@ -117,6 +125,9 @@ void QueueEnqueue(Queue* q, PixelCoords p) {
   q->tail = increment_index(q, q->tail);
   q->data[q->tail] = p;
   q->cur_size++;
+#if IMAGE_INSTR >= 1
+  if (q->cur_size > q->peak_size) q->peak_size = q->cur_size;
+#endif
 }
 
 PixelCoords QueueDequeue(Queue* q) {
@@ -126,3 +137,5 @@ PixelCoords QueueDequeue(Queue* q) {
   q->cur_size--;
   return q->data[old_head];
 }
+
+uint32_t QueuePeakSize(const Queue* q) { return q->peak_size; }
@@ -36,4 +36,8 @@ void QueueEnqueue(Queue* q, PixelCoords p);
 
 PixelCoords QueueDequeue(Queue* q);
 
+// Largest size reached since the queue was created or cleared
+// (always 0 if built without instrumentation)
+uint32_t QueuePeakSize(const Queue* q);
+
 #endif  // _PIXELCOORDS_QUEUE_
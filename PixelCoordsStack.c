@@ -16,10 +16,12 @@
 #include <stdlib.h>
 
 #include "PixelCoords.h"
+#include "instrumentation.h"
 
 struct _PixelCoordsStack {
   uint32_t max_size;  // maximum stack size
   uint32_t cur_size;  // current stack size
+  uint32_t peak_size; // largest cur_size so far (instrumented builds)
   PixelCoords* data;  // the stack data (stored in an array)
 };
 
@@ -30,24 +32,30 @@ Stack* StackCreate(uint32_t size) {
 
   s->max_size = size;
   s->cur_size = 0;
+  s->peak_size = 0;
 
   s->data = malloc(size * sizeof(PixelCoords));
   if (s->data == NULL) {
     free(s);
     abort();
   }
+  INSTR_MEM_ALLOC(PIXELCOORDS_MEM, size * sizeof(PixelCoords));
   return s;
 }
 
 void StackDestroy(Stack** p) {
   assert(*p != NULL);
   Stack* s = *p;
+  INSTR_MEM_FREE(PIXELCOORDS_MEM, s->max_size * sizeof(PixelCoords));
   free(s->data);
   free(s);
   *p = NULL;
 }
 
-void StackClear(Stack* s) { s->cur_size = 0; }
+void StackClear(Stack* s) {
+  s->cur_size = 0;
+  s->peak_size = 0;
+}
 
 uint32_t StackSize(const Stack* s) { return s->cur_size; }
 
@@ -71,12 +79,19 @@ void StackPush(Stack* s, PixelCoords p) {
       free(s);
       abort();
     }
+    INSTR_MEM_REALLOC(PIXELCOORDS_MEM, s->cur_size * sizeof(PixelCoords),
+                      s->max_size * sizeof(PixelCoords));
   }
 
   s->data[s->cur_size++] = p;
+#if IMAGE_INSTR >= 1
+  if (s->cur_size > s->peak_size) s->peak_size = s->cur_size;
+#endif
 }
 
 PixelCoords StackPop(Stack* s) {
   assert(s->cur_size > 0);
   return s->data[--(s->cur_size)];
 }
+
+uint32_t StackPeakSize(const Stack* s) { return s->peak_size; }
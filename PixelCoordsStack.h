@@ -36,4 +36,8 @@ void StackPush(Stack* s, PixelCoords p);
 
 PixelCoords StackPop(Stack* s);
 
+// Largest size reached since the stack was created or cleared
+// (always 0 if built without instrumentation)
+uint32_t StackPeakSize(const Stack* s);
+
 #endif  // _PIXELCOORDS_STACK_
@@ -0,0 +1,362 @@
+/// imageBatch - Process many independent images on a pool of threads.
+///
+/// See imageBatch.h for the interface.
+///
+/// ImageBatchProcess distributes work dynamically: each worker claims the
+/// next unprocessed index with an atomic increment, so the pool stays
+/// busy even when image sizes vary a lot.
+///
+/// ImageBatchPipeline connects a reader thread, the compute workers and
+/// a writer thread with bounded queues, so files are read ahead and
+/// results written back while other images are being processed.
+///
+/// In both, workers only touch their own images, and keep their counters
+/// apart until they are joined.
+
+#include "imageBatch.h"
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "instrumentation.h"
+
+// State shared by all threads of one batch run
+struct batch {
+  const char* const* inputs;
+  const char* const* outputs;
+  size_t count;
+  BatchOperation op;
+  int* regions;
+  atomic_size_t next;  // next index to claim
+};
+
+// Per-thread totals, summed after the threads are joined
+struct worker {
+  struct batch* batch;
+  pthread_t thread;
+  size_t images;
+  uint64_t pixels;
+  long long regions;
+  double readTime, computeTime, writeTime;
+};
+
+// Does filename end in ext?
+static int HasExtension(const char* filename, const char* ext) {
+  size_t n = strlen(filename), m = strlen(ext);
+  return n >= m && strcmp(filename + n - m, ext) == 0;
+}
+
+// The three stages of processing image i
+
+static Image LoadOne(struct batch* b, size_t i, struct worker* w) {
+  double start = wall_time();
+  const char* in = b->inputs[i];
+  Image img;
+  if (HasExtension(in, ".ppm"))
+    img = ImageLoadPPM(in);
+  else if (HasExtension(in, ".lbl"))
+    img = ImageLoadLBL(in);
+  else
+    img = ImageLoadPBM(in);
+  w->readTime += wall_time() - start;
+  return img;
+}
+
+// Transform and segment img (may replace it).  Returns the regions found.
+static int ComputeOne(struct batch* b, size_t i, Image* imgp,
+                      struct worker* w) {
+  double start = wall_time();
+  if (b->op.transform != IMAGE_IDENTITY) {
+    Image t = ImageApplyTransform(*imgp, b->op.transform);
+    ImageDestroy(imgp);
+    *imgp = t;
+  }
+
+  int found = 0;
+  if (b->op.segment != NULL) found = ImageSegmentation(*imgp, b->op.segment);
+  if (b->regions != NULL) b->regions[i] = found;
+
+  w->images++;
+  w->pixels += (uint64_t)ImageWidth(*imgp) * ImageHeight(*imgp);
+  w->regions += found;
+  w->computeTime += wall_time() - start;
+  return found;
+}
+
+// Save img if there is an output for it, and destroy it.
+static void StoreOne(struct batch* b, size_t i, Image* imgp,
+                     struct worker* w) {
+  double start = wall_time();
+  const char* out = b->outputs != NULL ? b->outputs[i] : NULL;
+  if (out != NULL) {
+    int ok;
+    if (HasExtension(out, ".ppm"))
+      ok = ImageSavePPM(*imgp, out);
+    else if (HasExtension(out, ".lbl"))
+      ok = ImageSaveLBL(*imgp, out, 1);
+    else
+      ok = ImageSavePBM(*imgp, out);
+    if (!ok) {
+      fprintf(stderr, "imageBatch: cannot save %s\n", out);
+      exit(EXIT_FAILURE);
+    }
+  }
+  ImageDestroy(imgp);
+  w->writeTime += wall_time() - start;
+}
+
+static void* Worker(void* arg) {
+  struct worker* w = arg;
+  struct batch* b = w->batch;
+
+  InstrThreadTryRegister("batch");
+  ImageScratchEnable();
+  for (;;) {
+    size_t i = atomic_fetch_add(&b->next, 1);
+    if (i >= b->count) break;
+    Image img = LoadOne(b, i, w);
+    ComputeOne(b, i, &img, w);
+    StoreOne(b, i, &img, w);
+  }
+  ImageScratchRelease();
+  InstrThreadUnregister();
+  return NULL;
+}
+
+int ImageBatchDefaultThreads(void) {
+  long n = sysconf(_SC_NPROCESSORS_ONLN);
+  return n > 0 ? (int)n : 1;
+}
+
+// Number of workers to use for count images
+static int WorkerCount(int threads, size_t count) {
+  if (threads == 0) threads = ImageBatchDefaultThreads();
+  if ((size_t)threads > count) threads = count > 0 ? (int)count : 1;
+  return threads;
+}
+
+static void StartThread(pthread_t* thread, void* (*fn)(void*), void* arg) {
+  int err = pthread_create(thread, NULL, fn, arg);
+  if (err != 0) {
+    fprintf(stderr, "imageBatch: pthread_create: %s\n", strerror(err));
+    exit(EXIT_FAILURE);
+  }
+}
+
+// Add the totals of a joined thread to s
+static void AddTotals(BatchStats* s, const struct worker* w) {
+  s->images += w->images;
+  s->pixels += w->pixels;
+  s->regions += w->regions;
+  s->readSeconds += w->readTime;
+  s->computeSeconds += w->computeTime;
+  s->writeSeconds += w->writeTime;
+}
+
+static void FinishStats(BatchStats* s, int threads, double start,
+                        BatchStats* stats) {
+  s->seconds = wall_time() - start;
+  s->threads = threads;
+  if (s->seconds > 0.0) {
+    s->imagesPerSec = s->images / s->seconds;
+    s->mpixPerSec = s->pixels / s->seconds / 1e6;
+  }
+  if (stats != NULL) *stats = *s;
+}
+
+void ImageBatchProcess(const char* const inputs[], const char* const outputs[],
+                       size_t count, BatchOperation op, int threads,
+                       int regions[], BatchStats* stats) {
+  assert(inputs != NULL || count == 0);
+  assert(threads >= 0);
+
+  threads = WorkerCount(threads, count);
+  struct batch b = {inputs, outputs, count, op, regions, 0};
+  struct worker workers[threads];
+  memset(workers, 0, sizeof(workers));
+
+  double start = wall_time();
+  for (int k = 0; k < threads; k++) {
+    workers[k].batch = &b;
+    StartThread(&workers[k].thread, Worker, &workers[k]);
+  }
+
+  BatchStats s = {0};
+  for (int k = 0; k < threads; k++) {
+    pthread_join(workers[k].thread, NULL);
+    AddTotals(&s, &workers[k]);
+  }
+  FinishStats(&s, threads, start, stats);
+}
+
+/// Pipeline
+
+// An image on its way between two stages
+struct pipeItem {
+  size_t index;
+  Image img;
+};
+
+// Bounded FIFO between stages. Put blocks while it is full; Get blocks
+// while it is empty, and fails once it is empty and every producer has
+// called PipeDone.
+struct pipe {
+  pthread_mutex_t lock;
+  pthread_cond_t notEmpty, notFull;
+  struct pipeItem* items;
+  size_t cap, head, size;
+  int producers;  // producers still running
+};
+
+static void PipeInit(struct pipe* p, size_t cap, int producers) {
+  pthread_mutex_init(&p->lock, NULL);
+  pthread_cond_init(&p->notEmpty, NULL);
+  pthread_cond_init(&p->notFull, NULL);
+  p->items = malloc(cap * sizeof(struct pipeItem));
+  if (p->items == NULL) {
+    fprintf(stderr, "imageBatch: out of memory\n");
+    exit(EXIT_FAILURE);
+  }
+  p->cap = cap;
+  p->head = p->size = 0;
+  p->producers = producers;
+}
+
+static void PipeDestroy(struct pipe* p) {
+  free(p->items);
+  pthread_cond_destroy(&p->notFull);
+  pthread_cond_destroy(&p->notEmpty);
+  pthread_mutex_destroy(&p->lock);
+}
+
+static void PipePut(struct pipe* p, struct pipeItem item) {
+  pthread_mutex_lock(&p->lock);
+  while (p->size == p->cap) pthread_cond_wait(&p->notFull, &p->lock);
+  p->items[(p->head + p->size) % p->cap] = item;
+  p->size++;
+  pthread_cond_signal(&p->notEmpty);
+  pthread_mutex_unlock(&p->lock);
+}
+
+static int PipeGet(struct pipe* p, struct pipeItem* item) {
+  pthread_mutex_lock(&p->lock);
+  while (p->size == 0 && p->producers > 0)
+    pthread_cond_wait(&p->notEmpty, &p->lock);
+  int ok = p->size > 0;
+  if (ok) {
+    *item = p->items[p->head];
+    p->head = (p->head + 1) % p->cap;
+    p->size--;
+    pthread_cond_signal(&p->notFull);
+  }
+  pthread_mutex_unlock(&p->lock);
+  return ok;
+}
+
+static void PipeDone(struct pipe* p) {
+  pthread_mutex_lock(&p->lock);
+  if (--p->producers == 0) pthread_cond_broadcast(&p->notEmpty);
+  pthread_mutex_unlock(&p->lock);
+}
+
+// A thread of the pipeline
+struct stage {
+  struct worker w;       // totals (w.batch is the batch)
+  struct pipe* in;       // NULL for the reader
+  struct pipe* out;      // NULL for the writer
+};
+
+static void* Reader(void* arg) {
+  struct stage* s = arg;
+  struct batch* b = s->w.batch;
+  InstrThreadTryRegister("reader");
+  for (size_t i = 0; i < b->count; i++)
+    PipePut(s->out, (struct pipeItem){i, LoadOne(b, i, &s->w)});
+  PipeDone(s->out);
+  InstrThreadUnregister();
+  return NULL;
+}
+
+static void* Computer(void* arg) {
+  struct stage* s = arg;
+  struct batch* b = s->w.batch;
+  InstrThreadTryRegister("compute");
+  ImageScratchEnable();
+  struct pipeItem item;
+  while (PipeGet(s->in, &item)) {
+    ComputeOne(b, item.index, &item.img, &s->w);
+    PipePut(s->out, item);
+  }
+  PipeDone(s->out);
+  ImageScratchRelease();
+  InstrThreadUnregister();
+  return NULL;
+}
+
+static void* Writer(void* arg) {
+  struct stage* s = arg;
+  struct batch* b = s->w.batch;
+  InstrThreadTryRegister("writer");
+  struct pipeItem item;
+  while (PipeGet(s->in, &item)) StoreOne(b, item.index, &item.img, &s->w);
+  InstrThreadUnregister();
+  return NULL;
+}
+
+void ImageBatchPipeline(const char* const inputs[], const char* const outputs[],
+                        size_t count, BatchOperation op, int threads,
+                        int depth, int regions[], BatchStats* stats) {
+  assert(inputs != NULL || count == 0);
+  assert(threads >= 0);
+  assert(depth >= 0);
+
+  threads = WorkerCount(threads, count);
+  if (depth == 0) depth = 2 * threads;
+  struct batch b = {inputs, outputs, count, op, regions, 0};
+
+  struct pipe loaded, computed;
+  PipeInit(&loaded, depth, 1);
+  PipeInit(&computed, depth, threads);
+
+  // Stage 0 reads, 1..threads compute, threads+1 writes
+  struct stage stages[threads + 2];
+  memset(stages, 0, sizeof(stages));
+  for (int k = 0; k < threads + 2; k++) stages[k].w.batch = &b;
+  stages[0].out = &loaded;
+  for (int k = 1; k <= threads; k++) {
+    stages[k].in = &loaded;
+    stages[k].out = &computed;
+  }
+  stages[threads + 1].in = &computed;
+
+  double start = wall_time();
+  StartThread(&stages[0].w.thread, Reader, &stages[0]);
+  for (int k = 1; k <= threads; k++)
+    StartThread(&stages[k].w.thread, Computer, &stages[k]);
+  StartThread(&stages[threads + 1].w.thread, Writer, &stages[threads + 1]);
+
+  BatchStats s = {0};
+  for (int k = 0; k < threads + 2; k++) {
+    pthread_join(stages[k].w.thread, NULL);
+    AddTotals(&s, &stages[k].w);
+  }
+  FinishStats(&s, threads, start, stats);
+
+  PipeDestroy(&computed);
+  PipeDestroy(&loaded);
+}
+
+void ImageBatchPrintStats(const BatchStats* stats) {
+  assert(stats != NULL);
+  printf("batch: %zu images, %.2f Mpix, %lld regions, %d threads\n",
+         stats->images, stats->pixels / 1e6, stats->regions, stats->threads);
+  printf("batch: %.4f s, %.1f images/s, %.2f Mpix/s\n", stats->seconds,
+         stats->imagesPerSec, stats->mpixPerSec);
+  printf("batch: busy read %.4f s, compute %.4f s, write %.4f s\n",
+         stats->readSeconds, stats->computeSeconds, stats->writeSeconds);
+}
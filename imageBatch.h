@@ -0,0 +1,84 @@
+/// imageBatch - Process many independent images on a pool of threads.
+///
+/// Each input image is loaded, optionally transformed and segmented,
+/// and optionally saved. Images are handed to a fixed number of worker
+/// threads as they become free, so a few large images do not hold back
+/// the many small ones. Every worker reuses its own fill buffers
+/// (see ImageScratchEnable) across the images it processes.
+///
+/// ImageBatchPipeline does the same with separate reader, compute and
+/// writer threads connected by bounded queues, so file I/O overlaps
+/// with computation.
+///
+/// Use as follows:
+///
+///   BatchOperation op = {IMAGE_ROTATE_90CW, ImageRegionFillingWithSTACK};
+///   BatchStats stats;
+///   ImageBatchProcess(inputs, outputs, n, op, 0, NULL, &stats);
+///   ImageBatchPrintStats(&stats);
+///
+/// Errors (a missing or malformed file) terminate the program,
+/// as in ImageLoadPBM / ImageLoadPPM.
+
+#ifndef IMAGEBATCH_H
+#define IMAGEBATCH_H
+
+#include <stddef.h>
+
+#include "imageRGB.h"
+
+/// What to do with each image, after loading it.
+typedef struct {
+  ImageTransform transform;  // applied first (IMAGE_IDENTITY: none)
+  FillingFunction segment;   // segment with this function (NULL: don't)
+} BatchOperation;
+
+/// Totals of a batch run.
+typedef struct {
+  size_t images;        // images processed
+  uint64_t pixels;      // total number of pixels processed
+  long long regions;    // total regions found (0 if not segmenting)
+  int threads;          // worker threads used
+  double seconds;       // wall-clock time of the whole batch
+  double imagesPerSec;  // throughput
+  double mpixPerSec;    // throughput, in millions of pixels per second
+  double readSeconds;   // time spent loading, summed over threads
+  double computeSeconds;  // time spent transforming and segmenting
+  double writeSeconds;  // time spent saving (and destroying) results
+} BatchStats;
+
+/// Number of worker threads used when 0 is requested:
+/// the number of online processors.
+int ImageBatchDefaultThreads(void);
+
+/// Process count images with the given number of threads
+/// (0: ImageBatchDefaultThreads(); never more than count).
+/// Workers that find the instrumentation registry full run unregistered
+/// (see InstrThreadTryRegister), so the number of threads is not limited
+/// by INSTR_MAX_THREADS.
+///   inputs[i]: file to load; files ending in ".ppm" are read as PPM,
+///              in ".lbl" as LBL, and all others as PBM.
+///   outputs:   if not NULL, outputs[i] (when not NULL) is where the result
+///              is saved, in the format given by its extension as above
+///              (LBL files are compressed).
+///              (Segmented images have more than 2 colors: use PPM or LBL.)
+///   regions:   if not NULL, regions[i] receives the number of regions
+///              found in image i.
+///   stats:     if not NULL, receives the totals and the throughput.
+void ImageBatchProcess(const char* const inputs[], const char* const outputs[],
+                       size_t count, BatchOperation op, int threads,
+                       int regions[], BatchStats* stats);
+
+/// Same as ImageBatchProcess, as a pipeline: one reader thread loads the
+/// files in order, threads workers transform and segment them, and one
+/// writer thread saves the results. The stages are connected by queues
+/// of depth images (0: 2 * threads), which bound how far the reader runs
+/// ahead and so the number of images in memory.
+void ImageBatchPipeline(const char* const inputs[], const char* const outputs[],
+                        size_t count, BatchOperation op, int threads,
+                        int depth, int regions[], BatchStats* stats);
+
+/// Print the totals and throughput of a batch run.
+void ImageBatchPrintStats(const BatchStats* stats);
+
+#endif
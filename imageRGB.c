@@ -24,21 +24,36 @@
 #include <assert.h>
 #include <ctype.h>
 #include <errno.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 
 #include "PixelCoords.h"
 #include "PixelCoordsQueue.h"
 #include "PixelCoordsStack.h"
 #include "instrumentation.h"
 
+// Vectorized (AVX2) kernels, used only if the processor supports them.
+// Define IMAGE_NO_SIMD to build the portable code alone.
+#if !defined(IMAGE_NO_SIMD) && defined(__GNUC__) && defined(__x86_64__)
+#define IMAGE_AVX2 1
+#include <immintrin.h>
+#else
+#define IMAGE_AVX2 0
+#endif
+
 // The data structure
 //
-// A RGB image is stored in a structure containing 5 fields:
+// A RGB image is stored in a structure containing 7 fields:
 // Two integers store the image width and height.
 // The next field is a pointer to an array that stores the pointers
 // to the image rows.
+// The parent field is NULL for images that own their pixels and LUT;
+// internal sub-images borrow the rows and LUT of that parent image.
+// The last field is NULL when each row is allocated on its own; images
+// loaded from LBL files keep all rows in that single block instead.
 //
 // Clients should use images only through variables of type Image,
 // which are pointers to the image structure, and should not access the
@@ -54,6 +69,27 @@ struct image {
   uint16** image;  // pointer to an array of pointers referencing the image rows
   uint16 num_colors;  // the number of colors (i.e., pixel labels) used
   rgb_t* LUT;         // table storing (R,G,B) triplets
+  Image parent;       // owner of rows and LUT (NULL if this image owns them)
+  uint16* pixels;     // block holding all rows (NULL: rows allocated apart)
+};
+
+// Affine map from destination (or view) pixel (x, y) to source pixel:
+//   u = u0 + x*dux + y*duy
+//   v = v0 + x*dvx + y*dvy
+// Every step is -1, 0 or +1. See the dihedral transforms section.
+typedef struct {
+  int32_t u0, v0;    // source pixel for destination (0, 0)
+  int32_t dux, dvx;  // source step when x advances
+  int32_t duy, dvy;  // source step when y advances
+} PixelMap;
+
+// A lazy view: a source image seen through a PixelMap.
+// Nothing is copied until the view is materialized.
+struct imageView {
+  Image src;      // the viewed image (not owned)
+  uint32 width;   // view dimensions
+  uint32 height;
+  PixelMap map;   // view (x, y) -> src (u, v)
 };
 
 // Design by Contract
@@ -88,19 +124,59 @@ static void check(int condition, const char* failmsg) {
   }
 }
 
+// Instrumentation level IMAGE_INSTR (see instrumentation.h):
+//   0: release build, all counting compiled out
+//   1: count pixel array accesses, memory and fill frontiers (default)
+//   2: also count fill pushes/pops, neighbor tests and LUT probes
+
+// Memory accounting categories (InstrMemName) and high-water marks
+#define MEM_IMAGES 0  // headers, row pointers and pixel rows
+#define MEM_LUTS 1    // look-up tables
+// PIXELCOORDS_MEM: stack and queue buffers (see PixelCoords.h)
+#define HIGH_FRONTIER 0  // largest stack/queue size reached by a fill
+
 /// Init Image library.  (Call once!)
 /// Currently, simply calibrate instrumentation and set names of counters.
 void ImageInit(void) {  ///
   InstrCalibrate();
+#if IMAGE_INSTR >= 1
   InstrName[0] = "pixmem";  // InstrCount[0] will count pixel array acesses
+  InstrMemName[MEM_IMAGES] = "images";
+  InstrMemName[MEM_LUTS] = "luts";
+  InstrMemName[PIXELCOORDS_MEM] = "coords";
+  InstrHighName[HIGH_FRONTIER] = "frontier";
+#endif
+#if IMAGE_INSTR >= 2
+  InstrName[1] = "pushes";     // coordinates pushed/enqueued by fills
+  InstrName[2] = "pops";       // coordinates popped/dequeued by fills
+  InstrName[3] = "neighbors";  // neighbor pixels tested by fills
+  InstrName[4] = "lutprobes";  // LUT entries compared when searching colors
+#endif
   // Name other counters here...
 }
 
-// Macros to simplify accessing instrumentation counters:
-#define PIXMEM InstrCount[0]
+// Macros to increment the instrumentation counters.
+// They expand to nothing below their level, so release code has no
+// counter updates at all.
+#if IMAGE_INSTR >= 1
+#define COUNT_PIXMEM(n) (InstrCount[0] += (n))
+#else
+#define COUNT_PIXMEM(n) ((void)0)
+#endif
+#if IMAGE_INSTR >= 2
+#define COUNT_PUSH(n) (InstrCount[1] += (n))
+#define COUNT_POP(n) (InstrCount[2] += (n))
+#define COUNT_NEIGHBOR(n) (InstrCount[3] += (n))
+#define COUNT_LUTPROBE(n) (InstrCount[4] += (n))
+#else
+#define COUNT_PUSH(n) ((void)0)
+#define COUNT_POP(n) ((void)0)
+#define COUNT_NEIGHBOR(n) ((void)0)
+#define COUNT_LUTPROBE(n) ((void)0)
+#endif
 // Add more macros here...
 
-// TIP: Search for PIXMEM or InstrCount to see where it is incremented!
+// TIP: Search for COUNT_ to see where counters are incremented!
 
 /// Auxiliary (static) functions
 
@@ -115,6 +191,8 @@ static Image AllocateImageHeader(uint32 width, uint32 height) {
 
   newHeader->width = width;
   newHeader->height = height;
+  newHeader->parent = NULL;
+  newHeader->pixels = NULL;
 
   // Allocating the array of pointers to image rows
   newHeader->image = malloc(height * sizeof(uint16*));
@@ -126,6 +204,12 @@ static Image AllocateImageHeader(uint32 width, uint32 height) {
   // Error handling
   check(newHeader->LUT != NULL, "Alloc failed ->LUT array");
 
+  // Account the whole image at once: header, row pointers and the
+  // width*height pixels the caller is about to allocate
+  INSTR_MEM_ALLOC(MEM_IMAGES, sizeof(struct image) + height * sizeof(uint16*) +
+                                  (size_t)width * height * sizeof(uint16));
+  INSTR_MEM_ALLOC(MEM_LUTS, FIXED_LUT_SIZE * sizeof(rgb_t));
+
   // Initialize LUT with 2 fixed colors
   newHeader->num_colors = 2;
   newHeader->LUT[0] = 0xffffff;  // RGB WHITE
@@ -143,32 +227,287 @@ static uint16* AllocateRowArray(uint32 size) {
   return newArray;
 }
 
+// Create the header of a sub-image covering the rectangle
+// [u0, u0+width) x [v0, v0+height) of img.
+// The rows and the LUT are borrowed from img (or from its own parent),
+// so nothing is copied and the parent must outlive the sub-image.
+static Image AllocateSubImage(Image img, uint32 u0, uint32 v0, uint32 width,
+                              uint32 height) {
+  assert(u0 + width <= img->width);
+  assert(v0 + height <= img->height);
+
+  Image sub = malloc(sizeof(struct image));
+  check(sub != NULL, "malloc");
+
+  sub->width = width;
+  sub->height = height;
+  sub->image = malloc(height * sizeof(uint16*));
+  check(sub->image != NULL, "Alloc failed ->image array");
+  INSTR_MEM_ALLOC(MEM_IMAGES, sizeof(struct image) + height * sizeof(uint16*));
+  for (uint32 i = 0; i < height; i++) {
+    sub->image[i] = img->image[v0 + i] + u0;
+  }
+  sub->num_colors = img->num_colors;
+  sub->LUT = img->LUT;
+  sub->parent = img->parent != NULL ? img->parent : img;
+  sub->pixels = NULL;
+
+  return sub;
+}
+
+// The view that shows img as it is.
+static struct imageView IdentityView(const Image img) {
+  struct imageView view;
+  view.src = img;
+  view.width = img->width;
+  view.height = img->height;
+  view.map = (PixelMap){0, 0, 1, 0, 0, 1};
+  return view;
+}
+
+// The image that owns the rows and LUT of img (img itself if not a sub-image).
+static Image OwnerOf(const Image img) {
+  return img->parent != NULL ? img->parent : img;
+}
+
 /// Find color label for given RGB color in img LUT.
 /// Return the label or -1 if not found.
 static int LUTFindColor(Image img, rgb_t color) {
-  for (uint16 index = 0; index < img->num_colors; index++) {
+  const uint16 num_colors =
+      __atomic_load_n(&OwnerOf(img)->num_colors, __ATOMIC_RELAXED);
+  for (uint16 index = 0; index < num_colors; index++) {
+    COUNT_LUTPROBE(1);
     if (img->LUT[index] == color) return index;
   }
   return -1;
 }
 
+/// Reserve the next label of the LUT of img and set it to color.
+/// Return the new label or -1 if the LUT is full.
+/// The labels are taken from the owner of the LUT atomically, so that
+/// sub-images of the same image can get new labels from different threads.
+static int LUTNewLabel(Image img, rgb_t color) {
+  Image owner = OwnerOf(img);
+  uint16 index = __atomic_load_n(&owner->num_colors, __ATOMIC_RELAXED);
+  do {
+    if (index >= FIXED_LUT_SIZE) return -1;
+  } while (!__atomic_compare_exchange_n(&owner->num_colors, &index,
+                                        (uint16)(index + 1), 1,
+                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+  owner->LUT[index] = color;
+  if (img != owner) img->num_colors = index + 1;
+  return index;
+}
+
 /// Return color label for RGB color in img LUT.
 /// Finds existing color or allocs new one!
 static int LUTAllocColor(Image img, rgb_t color) {
   int index = LUTFindColor(img, color);
   if (index < 0) {
-    check(img->num_colors < FIXED_LUT_SIZE, "LUT Overflow");
-    index = img->num_colors++;
-    img->LUT[index] = color;
+    index = LUTNewLabel(img, color);
+    check(index >= 0, "LUT Overflow");
   }
   return index;
 }
 
+/// Append color to img LUT, even if it is already there.
+/// Return the new label or -1 if the LUT is full.
+static int LUTAppendColor(Image img, rgb_t color) {
+  return LUTNewLabel(img, color);
+}
+
 /// Return a pseudo-random successor of the given color.
 static rgb_t GenerateNextColor(rgb_t color) {
   return (color + 7639) & 0xffffff;
 }
 
+/// Image pool
+
+/*------------------------------------------------------------------
+ * Pool de imagens (ver ImagePoolEnable)
+ * Com o pool ativo, ImageDestroy guarda as imagens que são donas das
+ * suas linhas (cabeçalho, linhas e LUT intactos) em listas por
+ * dimensões, e a criação de uma imagem com as mesmas dimensões reutiliza
+ * uma delas em vez de alocar. Só ImageCreate volta a pôr os píxeis a
+ * BRANCO; quem vai escrever todos os píxeis (cópias, transformações,
+ * geradores, leitura de PBM) recebe-os como estão.
+ *
+ * O pool é partilhado por todas as threads e protegido por um mutex.
+ *-----------------------------------------------------------------*/
+struct poolBucket {
+  uint32 width, height;
+  Image* images;
+  size_t count, cap;
+};
+
+static pthread_mutex_t poolLock = PTHREAD_MUTEX_INITIALIZER;
+static struct {
+  size_t maxBytes;            // 0: pool desligado
+  struct poolBucket* buckets;
+  size_t numBuckets, cap;
+  ImagePoolStats stats;
+} pool;
+
+// Memória ocupada por uma imagem dona das suas linhas
+static size_t ImageBytes(uint32 width, uint32 height) {
+  return sizeof(struct image) + (size_t)height * sizeof(uint16*) +
+         (size_t)width * height * sizeof(uint16) +
+         FIXED_LUT_SIZE * sizeof(rgb_t);
+}
+
+// Liberta de facto uma imagem (ImageDestroy sem pool)
+static void FreeImage(Image img) {
+  // Sub-images only own their array of row pointers
+  if (img->parent == NULL) {
+    if (img->pixels != NULL) {
+      free(img->pixels);
+    } else {
+      for (uint32 i = 0; i < img->height; i++) {
+        free(img->image[i]);
+      }
+    }
+    free(img->LUT);
+    INSTR_MEM_FREE(MEM_IMAGES, ImageBytes(img->width, img->height) -
+                                   FIXED_LUT_SIZE * sizeof(rgb_t));
+    INSTR_MEM_FREE(MEM_LUTS, FIXED_LUT_SIZE * sizeof(rgb_t));
+  } else {
+    INSTR_MEM_FREE(MEM_IMAGES,
+                   sizeof(struct image) + img->height * sizeof(uint16*));
+  }
+  free(img->image);
+  free(img);
+}
+
+// Lista das imagens width x height (NULL se não existir)
+static struct poolBucket* PoolBucket(uint32 width, uint32 height) {
+  for (size_t b = 0; b < pool.numBuckets; b++)
+    if (pool.buckets[b].width == width && pool.buckets[b].height == height)
+      return &pool.buckets[b];
+  return NULL;
+}
+
+// Retira do pool uma imagem width x height (NULL se não houver).
+// A LUT volta a ter só BRANCO e PRETO; os píxeis ficam como estavam.
+static Image PoolTake(uint32 width, uint32 height) {
+  // Leitura sem lock: só evita o mutex com o pool desligado
+  if (__atomic_load_n(&pool.maxBytes, __ATOMIC_RELAXED) == 0) return NULL;
+  pthread_mutex_lock(&poolLock);
+  Image img = NULL;
+  struct poolBucket* bucket = PoolBucket(width, height);
+  if (pool.maxBytes > 0) {
+    if (bucket != NULL && bucket->count > 0) {
+      img = bucket->images[--bucket->count];
+      pool.stats.hits++;
+      pool.stats.bytes -= ImageBytes(width, height);
+      pool.stats.images--;
+    } else {
+      pool.stats.misses++;
+    }
+  }
+  pthread_mutex_unlock(&poolLock);
+
+  if (img != NULL) {
+    img->num_colors = 2;
+    img->LUT[WHITE] = 0xffffff;
+    img->LUT[BLACK] = 0x000000;
+  }
+  return img;
+}
+
+// Guarda img no pool, se estiver ativo e houver espaço.
+// Devolve 1 se a imagem ficou no pool.
+static int PoolGive(Image img) {
+  if (img->parent != NULL) return 0;
+  if (__atomic_load_n(&pool.maxBytes, __ATOMIC_RELAXED) == 0) return 0;
+  const size_t bytes = ImageBytes(img->width, img->height);
+  int kept = 0;
+  pthread_mutex_lock(&poolLock);
+  if (pool.maxBytes > 0 && pool.stats.bytes + bytes <= pool.maxBytes) {
+    struct poolBucket* bucket = PoolBucket(img->width, img->height);
+    if (bucket == NULL) {
+      if (pool.numBuckets == pool.cap) {
+        size_t cap = pool.cap > 0 ? 2 * pool.cap : 8;
+        struct poolBucket* buckets =
+            realloc(pool.buckets, cap * sizeof(struct poolBucket));
+        check(buckets != NULL, "realloc");
+        pool.buckets = buckets;
+        pool.cap = cap;
+      }
+      bucket = &pool.buckets[pool.numBuckets++];
+      *bucket = (struct poolBucket){img->width, img->height, NULL, 0, 0};
+    }
+    if (bucket->count == bucket->cap) {
+      size_t cap = bucket->cap > 0 ? 2 * bucket->cap : 4;
+      Image* images = realloc(bucket->images, cap * sizeof(Image));
+      check(images != NULL, "realloc");
+      bucket->images = images;
+      bucket->cap = cap;
+    }
+    bucket->images[bucket->count++] = img;
+    pool.stats.returns++;
+    pool.stats.bytes += bytes;
+    pool.stats.images++;
+    kept = 1;
+  } else if (pool.maxBytes > 0) {
+    pool.stats.rejected++;
+  }
+  pthread_mutex_unlock(&poolLock);
+  return kept;
+}
+
+void ImagePoolTrim(size_t keepBytes) {
+  pthread_mutex_lock(&poolLock);
+  // Liberta primeiro as listas mais recentes (as dimensões mais novas)
+  for (size_t b = pool.numBuckets; b-- > 0 && pool.stats.bytes > keepBytes;) {
+    struct poolBucket* bucket = &pool.buckets[b];
+    const size_t bytes = ImageBytes(bucket->width, bucket->height);
+    while (bucket->count > 0 && pool.stats.bytes > keepBytes) {
+      FreeImage(bucket->images[--bucket->count]);
+      pool.stats.bytes -= bytes;
+      pool.stats.images--;
+      pool.stats.trimmed++;
+    }
+  }
+  // Descartar as listas vazias
+  size_t n = 0;
+  for (size_t b = 0; b < pool.numBuckets; b++) {
+    if (pool.buckets[b].count > 0)
+      pool.buckets[n++] = pool.buckets[b];
+    else
+      free(pool.buckets[b].images);
+  }
+  pool.numBuckets = n;
+  if (n == 0) {
+    free(pool.buckets);
+    pool.buckets = NULL;
+    pool.cap = 0;
+  }
+  pthread_mutex_unlock(&poolLock);
+}
+
+void ImagePoolEnable(size_t maxBytes) {
+  pthread_mutex_lock(&poolLock);
+  __atomic_store_n(&pool.maxBytes, maxBytes, __ATOMIC_RELAXED);
+  pthread_mutex_unlock(&poolLock);
+  ImagePoolTrim(maxBytes);
+}
+
+void ImagePoolGetStats(ImagePoolStats* stats) {
+  assert(stats != NULL);
+  pthread_mutex_lock(&poolLock);
+  *stats = pool.stats;
+  pthread_mutex_unlock(&poolLock);
+  const unsigned long requests = stats->hits + stats->misses;
+  stats->hitRate = requests > 0 ? (double)stats->hits / requests : 0.0;
+}
+
+void ImagePoolResetStats(void) {
+  pthread_mutex_lock(&poolLock);
+  pool.stats.hits = pool.stats.misses = 0;
+  pool.stats.returns = pool.stats.rejected = pool.stats.trimmed = 0;
+  pthread_mutex_unlock(&poolLock);
+}
+
 /// Image management functions
 
 /// Create a new RGB image. All pixels with the background WHITE color.
@@ -181,8 +520,17 @@ Image ImageCreate(uint32 width, uint32 height) {
   assert(width > 0);
   assert(height > 0);
 
+  // Recycled image: only the pixels have to be cleared
+  Image img = PoolTake(width, height);
+  if (img != NULL) {
+    for (uint32 i = 0; i < height; i++) {
+      memset(img->image[i], 0, (size_t)width * sizeof(uint16));  // WHITE
+    }
+    return img;
+  }
+
   // Just two possible pixel colors
-  Image img = AllocateImageHeader(width, height);
+  img = AllocateImageHeader(width, height);
 
   // Creating the image rows
   for (uint32 i = 0; i < height; i++) {
@@ -256,6 +604,122 @@ Image ImageCreatePalete(uint32 width, uint32 height, uint32 edge) {
   return img;
 }
 
+/// Synthetic workloads
+
+// Set n pixels of a row to label
+static void FillRow(uint16* row, uint32 n, uint16 label) {
+  for (uint32 j = 0; j < n; j++) row[j] = label;
+}
+
+// Create an image with uninitialized pixels, for generators that write
+// every pixel (avoids clearing the rows first).
+static Image CreateUninitialized(uint32 width, uint32 height) {
+  assert(width > 0);
+  assert(height > 0);
+  Image img = PoolTake(width, height);
+  if (img != NULL) return img;
+  img = AllocateImageHeader(width, height);
+  for (uint32 i = 0; i < height; i++) {
+    img->image[i] = malloc((size_t)width * sizeof(uint16));
+    check(img->image[i] != NULL, "Alloc failed ->image row");
+  }
+  return img;
+}
+
+/// Create an image filled with a single color.
+Image ImageCreateSolid(uint32 width, uint32 height, rgb_t color) {
+  Image img = CreateUninitialized(width, height);
+  uint16 label = (uint16)LUTAllocColor(img, color);
+  for (uint32 i = 0; i < height; i++) FillRow(img->image[i], width, label);
+  return img;
+}
+
+/// Create a serpentine maze.
+Image ImageCreateMaze(uint32 width, uint32 height) {
+  Image img = ImageCreate(width, height);
+  for (uint32 i = 1; i < height; i += 2) {
+    FillRow(img->image[i], width, BLACK);
+    // The gap alternates: right end on rows 1, 5, 9...; left on 3, 7...
+    uint32 gap = (i / 2) % 2 == 0 ? width - 1 : 0;
+    img->image[i][gap] = WHITE;
+  }
+  return img;
+}
+
+/// Create a square spiral.
+/// A "turtle" carves the corridor out of a BLACK image: it walks straight
+/// ahead while the next pixel is BLACK and the one after it is not part of
+/// the corridor (which keeps a wall between turns), turns clockwise when
+/// it cannot, and stops when it cannot turn either.
+Image ImageCreateSpiral(uint32 width, uint32 height) {
+  Image img = CreateUninitialized(width, height);
+  for (uint32 i = 0; i < height; i++) FillRow(img->image[i], width, BLACK);
+
+  static const int du[4] = {1, 0, -1, 0};  // right, down, left, up
+  static const int dv[4] = {0, 1, 0, -1};
+  const int64_t W = width, H = height;
+  int64_t u = 0, v = 0;
+  int d = 0;
+  img->image[0][0] = WHITE;
+  for (int turns = 0; turns < 2;) {
+    int64_t nu = u + du[d], nv = v + dv[d];
+    int64_t mu = nu + du[d], mv = nv + dv[d];
+    int ahead = 0 <= nu && nu < W && 0 <= nv && nv < H &&
+                img->image[nv][nu] == BLACK &&
+                !(0 <= mu && mu < W && 0 <= mv && mv < H &&
+                  img->image[mv][mu] == WHITE);
+    if (!ahead) {  // turn clockwise and try again
+      d = (d + 1) % 4;
+      turns++;
+      continue;
+    }
+    u = nu;
+    v = nv;
+    img->image[v][u] = WHITE;
+    turns = 0;
+  }
+  return img;
+}
+
+/// Create random noise with the given density of BLACK pixels.
+Image ImageCreateNoise(uint32 width, uint32 height, double density,
+                       uint32 seed) {
+  assert(0.0 <= density && density <= 1.0);
+  Image img = CreateUninitialized(width, height);
+
+  // xorshift64* generator: the top 32 bits are compared to the threshold
+  uint64_t state = 0x9E3779B97F4A7C15ull * ((uint64_t)seed + 1);
+  uint64_t threshold = (uint64_t)(density * 4294967296.0);  // density * 2^32
+  for (uint32 i = 0; i < height; i++) {
+    uint16* row = img->image[i];
+    for (uint32 j = 0; j < width; j++) {
+      state ^= state >> 12;
+      state ^= state << 25;
+      state ^= state >> 27;
+      uint64_t r = (state * 0x2545F4914F6CDD1Dull) >> 32;
+      row[j] = r < threshold ? BLACK : WHITE;
+    }
+  }
+  return img;
+}
+
+/// Create concentric square rings.
+/// The ring of a pixel is its distance to the nearest border / thickness.
+Image ImageCreateRings(uint32 width, uint32 height, uint32 thickness) {
+  assert(thickness > 0);
+  Image img = CreateUninitialized(width, height);
+  for (uint32 i = 0; i < height; i++) {
+    uint16* row = img->image[i];
+    uint32 dv = i < height - 1 - i ? i : height - 1 - i;
+    for (uint32 j = 0; j < width; j++) {
+      uint32 du = j < width - 1 - j ? j : width - 1 - j;
+      uint32 dist = du < dv ? du : dv;
+      row[j] = (dist / thickness) % 2 ? BLACK : WHITE;
+    }
+  }
+  return img;
+}
+
 /// Destroy the image pointed to by (*imgp).
 ///   imgp : address of an Image variable.
 /// If (*imgp)==NULL, no operation is performed.
@@ -265,13 +729,10 @@ void ImageDestroy(Image* imgp) {
   assert(imgp != NULL);
 
   Image img = *imgp;
+  if (img == NULL) return;
 
-  for (uint32 i = 0; i < img->height; i++) {
-    free(img->image[i]);
-  }
-  free(img->image);
-  free(img->LUT);
-  free(img);
+  // With the pool enabled, the image may be kept for reuse
+  if (!PoolGive(img)) FreeImage(img);
 
   *imgp = NULL;
 }
@@ -291,25 +752,123 @@ void ImageDestroy(Image* imgp) {
 Image ImageCopy(const Image img) {
     if (img == NULL) return NULL;
 
-    Image copy = ImageCreate(img->width, img->height);
-    if (copy == NULL) return NULL;
+    // As linhas vão ser todas escritas: não é preciso inicializá-las
+    Image copy = CreateUninitialized(img->width, img->height);
+    ImageCopyInto(copy, img);
+    return copy;
+}
+
+/*------------------------------------------------------------------
+ * ReshapeImage (auxiliar)
+ * Dá ao destino das variantes ...Into as dimensões width x height,
+ * realocando só quando é mesmo preciso:
+ *   - mesmas dimensões: nada a fazer (o caso de um ciclo em regime);
+ *   - bloco contíguo com o mesmo número de píxeis: basta reapontar
+ *     as linhas;
+ *   - caso contrário: libertar as linhas e alocar as novas.
+ * O conteúdo dos píxeis fica indefinido.
+ *-----------------------------------------------------------------*/
+static void ReshapeImage(Image dst, uint32 width, uint32 height) {
+    assert(dst->parent == NULL);  // sub-imagens não são donas das linhas
+    if (dst->width == width && dst->height == height) return;
+
+    const size_t oldPixels = (size_t)dst->width * dst->height;
+    const size_t newPixels = (size_t)width * height;
+    const int keepBlock = dst->pixels != NULL && oldPixels == newPixels;
+
+    if (!keepBlock) {
+        if (dst->pixels != NULL) {
+            free(dst->pixels);
+            dst->pixels = NULL;
+        } else {
+            for (uint32 i = 0; i < dst->height; i++) free(dst->image[i]);
+        }
+        INSTR_MEM_FREE(MEM_IMAGES, oldPixels * sizeof(uint16));
+    }
+
+    if (dst->height != height) {
+        uint16** rows = realloc(dst->image, height * sizeof(uint16*));
+        check(rows != NULL, "realloc");
+        INSTR_MEM_REALLOC(MEM_IMAGES, dst->height * sizeof(uint16*),
+                          height * sizeof(uint16*));
+        dst->image = rows;
+    }
+
+    if (keepBlock) {
+        for (uint32 i = 0; i < height; i++)
+            dst->image[i] = dst->pixels + (size_t)i * width;
+    } else {
+        for (uint32 i = 0; i < height; i++) {
+            dst->image[i] = malloc((size_t)width * sizeof(uint16));
+            check(dst->image[i] != NULL, "Alloc failed ->image row");
+        }
+        INSTR_MEM_ALLOC(MEM_IMAGES, newPixels * sizeof(uint16));
+    }
+    dst->width = width;
+    dst->height = height;
+}
+
+/*------------------------------------------------------------------
+ * ImageCopyInto
+ * Como ImageCopy, mas escreve numa imagem já existente (ver
+ * ReshapeImage): com as mesmas dimensões não há qualquer alocação.
+ *-----------------------------------------------------------------*/
+void ImageCopyInto(Image dst, const Image src) {
+    assert(dst != NULL && src != NULL);
+    assert(OwnerOf(src) != dst);  // a fonte não pode partilhar as linhas
+
+    ReshapeImage(dst, src->width, src->height);
 
     // Copiar LUT
-    copy->num_colors = img->num_colors;
-    if (img->num_colors > 0) {
-        const size_t lutBytes = (size_t)img->num_colors * sizeof(rgb_t);
-        memcpy(copy->LUT, img->LUT, lutBytes);
+    dst->num_colors = ImageColors(src);
+    if (dst->num_colors > 0) {
+        const size_t lutBytes = (size_t)dst->num_colors * sizeof(rgb_t);
+        memcpy(dst->LUT, src->LUT, lutBytes);
     }
 
     // Copiar pixels linha por linha (muito mais rápido)
-    const size_t rowBytes = (size_t)img->width * sizeof(uint16);
-    for (uint32 v = 0; v < img->height; v++) {
-        memcpy(copy->image[v], img->image[v], rowBytes);
-        // Incrementar PIXMEM por linha (aproximação: width acessos)
-        PIXMEM += img->width;
+    const size_t rowBytes = (size_t)src->width * sizeof(uint16);
+    for (uint32 v = 0; v < src->height; v++) {
+        memcpy(dst->image[v], src->image[v], rowBytes);
+        // Incrementar pixmem por linha (aproximação: width acessos)
+        COUNT_PIXMEM(src->width);
     }
+}
 
-    return copy;
+/*------------------------------------------------------------------
+ * ImageSubView
+ * Sub-imagem (região de interesse) sem cópia: o cabeçalho novo aponta
+ * para as linhas da imagem mãe, deslocadas de u colunas, e partilha a
+ * mesma LUT. Escritas na sub-imagem veem-se na mãe e vice-versa.
+ *
+ * Como a largura e a altura são as do retângulo, os Region Filling e a
+ * segmentação ficam confinados a ele sem qualquer alteração. Labels
+ * novos são acrescentados à LUT partilhada.
+ *
+ * A mãe tem de sobreviver à sub-imagem. ImageDestroy da sub-imagem só
+ * liberta o cabeçalho e o array de ponteiros.
+ *-----------------------------------------------------------------*/
+Image ImageSubView(const Image img, uint32 u, uint32 v, uint32 width,
+                   uint32 height) {
+    assert(img != NULL);
+    assert(width > 0 && height > 0);
+    assert(u + width <= img->width && v + height <= img->height);
+
+    return AllocateSubImage(img, u, v, width, height);
+}
+
+/*------------------------------------------------------------------
+ * ImageCrop
+ * Cópia independente só do retângulo pedido (e da LUT): não toca no
+ * resto da imagem. Usa uma vista recortada e materializa-a.
+ *-----------------------------------------------------------------*/
+Image ImageCrop(const Image img, uint32 u, uint32 v, uint32 width,
+                uint32 height) {
+    assert(img != NULL);
+
+    struct imageView view = IdentityView(img);
+    ImageViewCrop(&view, u, v, width, height);
+    return ImageViewMaterialize(&view);
 }
 
 
@@ -321,7 +880,7 @@ Image ImageCopy(const Image img) {
 /// Output the raw RGB image (i.e., print the integer value of pixel).
 void ImageRAWPrint(const Image img) {
   printf("width = %d height = %d\n", (int)img->width, (int)img->height);
-  printf("num_colors = %d\n", (int)img->num_colors);
+  printf("num_colors = %d\n", (int)ImageColors(img));
   printf("RAW image\n");
 
   // Print the pixel labels of each image row
@@ -335,7 +894,7 @@ void ImageRAWPrint(const Image img) {
 
   printf("LUT:\n");
   // Print the LUT (R,G,B) values
-  for (int i = 0; i < (int)img->num_colors; i++) {
+  for (int i = 0; i < (int)ImageColors(img); i++) {
     rgb_t color = img->LUT[i];
     int r = color >> 16 & 0xff;
     int g = color >> 8 & 0xff;
@@ -346,6 +905,30 @@ void ImageRAWPrint(const Image img) {
   printf("\n");
 }
 
+/// Strided view accessor
+
+// Return row y of the view.
+// Rows that are plain source rows are returned in place (no copy);
+// otherwise the row is gathered into buf, which must hold view->width labels.
+static const uint16* ViewRow(const struct imageView* view, uint32 y,
+                             uint16* buf) {
+  const PixelMap m = view->map;
+  const int32_t u = m.u0 + (int32_t)y * m.duy;
+  const int32_t v = m.v0 + (int32_t)y * m.dvy;
+  const uint32 W = view->width;
+
+  COUNT_PIXMEM(W);
+  if (m.dvx == 0) {
+    const uint16* srcRow = view->src->image[v] + u;
+    if (m.dux == 1) return srcRow;
+    for (uint32 x = 0; x < W; x++) buf[x] = *(srcRow - x);
+  } else {
+    uint16** rows = view->src->image + v;
+    for (uint32 x = 0; x < W; x++) buf[x] = rows[(int32_t)x * m.dvx][u];
+  }
+  return buf;
+}
+
 /// PBM file operations --- For BW images
 
 // See PBM format specification: http://netpbm.sourceforge.net/doc/pbm.html
@@ -400,6 +983,8 @@ Image ImageLoadPBM(const char* filename) {  ///
   FILE* f = NULL;
   Image img = NULL;
 
+  InstrRegionBegin("ImageLoadPBM");
+  InstrRegionBegin("header");
   check((f = fopen(filename, "rb")) != NULL, "Open failed");
   // Parse PBM header
   check(fscanf(f, "P%c ", &c) == 1 && c == '4', "Invalid file format");
@@ -408,11 +993,13 @@ Image ImageLoadPBM(const char* filename) {  ///
   skipComments(f);
   check(fscanf(f, "%d", &h) == 1 && h >= 0, "Invalid height");
   check(fscanf(f, "%c", &c) == 1 && isspace(c), "Whitespace expected");
+  InstrRegionEnd();
 
-  // Allocate image
-  img = AllocateImageHeader((uint32)w, (uint32)h);
+  // Allocate image (every pixel is read below, no need to clear it)
+  img = CreateUninitialized((uint32)w, (uint32)h);
 
   // Read pixels
+  InstrRegionBegin("pixels");
   int nbytes = (w + 8 - 1) / 8;  // number of bytes for each row
   // using VLAs...
   uint8 bytes[nbytes];
@@ -421,13 +1008,14 @@ Image ImageLoadPBM(const char* filename) {  ///
     check(fread(bytes, sizeof(uint8), nbytes, f) == (size_t)nbytes,
           "Reading pixels");
     unpackBits(nbytes, bytes, raw_row);
-    img->image[i] = AllocateRowArray((uint32)w);
     for (uint32 j = 0; j < (uint32)w; j++) {
       img->image[i][j] = (uint16)raw_row[j];
     }
   }
+  InstrRegionEnd();
 
   fclose(f);
+  InstrRegionEnd();
   return img;
 }
 
@@ -436,10 +1024,21 @@ Image ImageLoadPBM(const char* filename) {  ///
 /// On failure, a partial and invalid file may be left in the system.
 int ImageSavePBM(const Image img, const char* filename) {  ///
   assert(img != NULL);
-  assert(img->num_colors == 2);
 
-  int w = (int)img->width;
-  int h = (int)img->height;
+  InstrRegionBegin("ImageSavePBM");
+  struct imageView view = IdentityView(img);
+  int result = ImageViewSavePBM(&view, filename);
+  InstrRegionEnd();
+  return result;
+}
+
+/// Save what the view shows to a PBM file.
+int ImageViewSavePBM(const ImageView view, const char* filename) {
+  assert(view != NULL);
+  assert(ImageColors(view->src) == 2);
+
+  int w = (int)view->width;
+  int h = (int)view->height;
   FILE* f = NULL;
 
   check((f = fopen(filename, "wb")) != NULL, "Open failed");
@@ -450,9 +1049,11 @@ int ImageSavePBM(const Image img, const char* filename) {  ///
   // using VLAs...
   uint8 bytes[nbytes];
   uint8 raw_row[nbytes * 8];
-  for (uint32 i = 0; i < img->height; i++) {
-    for (uint32 j = 0; j < img->width; j++) {
-      raw_row[j] = (uint8)img->image[i][j];
+  uint16 buf[w];
+  for (uint32 i = 0; i < view->height; i++) {
+    const uint16* row = ViewRow(view, i, buf);
+    for (uint32 j = 0; j < view->width; j++) {
+      raw_row[j] = (uint8)row[j];
     }
     // Fill padding pixels with WHITE
     memset(raw_row + w, WHITE, nbytes * 8 - w);
@@ -462,24 +1063,119 @@ int ImageSavePBM(const Image img, const char* filename) {  ///
   }
 
   // Cleanup
-  fclose(f);
+  check(fclose(f) == 0, "Closing file failed");
+
+  return 1;
+}
+
+/// RGB expansion of label rows
+
+/*------------------------------------------------------------------
+ * Expansão de labels em RGB
+ * Cada pixel é LUT[label], com o formato 0x00RRGGBB. Em memória
+ * (little-endian) fica B, G, R, 0: os bytes têm de ser trocados para
+ * R, G, B (RGB24) ou R, G, B, A (RGBA32).
+ *
+ * Com AVX2, 8 píxeis de cada vez: os 8 labels são alargados a 32 bits,
+ * as 8 cores lidas da LUT com um gather, e os bytes reordenados com um
+ * shuffle. Em RGB24, cada metade de 128 bits dá 12 bytes, mas é gravada
+ * com 16: o ciclo pára enquanto houver pelo menos 2 píxeis a seguir, para
+ * esses 4 bytes a mais caírem em píxeis que ainda vão ser escritos.
+ *-----------------------------------------------------------------*/
+#if IMAGE_AVX2
+__attribute__((target("avx2")))
+static uint32 ExpandRGB24AVX2(const uint16* row, uint32 n, const rgb_t* LUT,
+                              uint8* out) {
+  const __m256i order = _mm256_setr_epi8(
+      2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1,
+      2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1);
+  uint32 j = 0;
+  for (; j + 10 <= n; j += 8) {
+    __m256i labels = _mm256_cvtepu16_epi32(
+        _mm_loadu_si128((const __m128i*)(row + j)));
+    __m256i colors = _mm256_i32gather_epi32((const int*)LUT, labels, 4);
+    colors = _mm256_shuffle_epi8(colors, order);
+    _mm_storeu_si128((__m128i*)(out + 3 * j), _mm256_castsi256_si128(colors));
+    _mm_storeu_si128((__m128i*)(out + 3 * j + 12),
+                     _mm256_extracti128_si256(colors, 1));
+  }
+  return j;
+}
+
+__attribute__((target("avx2")))
+static uint32 ExpandRGBA32AVX2(const uint16* row, uint32 n, const rgb_t* LUT,
+                               uint8* out) {
+  const __m256i order = _mm256_setr_epi8(
+      2, 1, 0, -1, 6, 5, 4, -1, 10, 9, 8, -1, 14, 13, 12, -1,
+      2, 1, 0, -1, 6, 5, 4, -1, 10, 9, 8, -1, 14, 13, 12, -1);
+  const __m256i alpha = _mm256_set1_epi32((int)0xFF000000u);
+  uint32 j = 0;
+  for (; j + 8 <= n; j += 8) {
+    __m256i labels = _mm256_cvtepu16_epi32(
+        _mm_loadu_si128((const __m128i*)(row + j)));
+    __m256i colors = _mm256_i32gather_epi32((const int*)LUT, labels, 4);
+    colors = _mm256_or_si256(_mm256_shuffle_epi8(colors, order), alpha);
+    _mm256_storeu_si256((__m256i*)(out + 4 * j), colors);
+  }
+  return j;
+}
+#endif
 
+// Whether the AVX2 kernels can be used on this processor
+static int UseAVX2(void) {
+#if IMAGE_AVX2
+  return __builtin_cpu_supports("avx2");
+#else
   return 0;
+#endif
+}
+
+// Expand n labels into n R, G, B byte triples
+static void ExpandRowRGB24(const uint16* row, uint32 n, const rgb_t* LUT,
+                           uint8* out, int simd) {
+  uint32 j = 0;
+#if IMAGE_AVX2
+  if (simd) j = ExpandRGB24AVX2(row, n, LUT, out);
+#else
+  (void)simd;
+#endif
+  for (; j < n; j++) {
+    rgb_t color = LUT[row[j]];
+    out[3 * j] = color >> 16 & 0xff;
+    out[3 * j + 1] = color >> 8 & 0xff;
+    out[3 * j + 2] = color & 0xff;
+  }
+}
+
+// Expand n labels into n R, G, B, A quadruples (opaque)
+static void ExpandRowRGBA32(const uint16* row, uint32 n, const rgb_t* LUT,
+                            uint8* out, int simd) {
+  uint32 j = 0;
+#if IMAGE_AVX2
+  if (simd) j = ExpandRGBA32AVX2(row, n, LUT, out);
+#else
+  (void)simd;
+#endif
+  for (; j < n; j++) {
+    rgb_t color = LUT[row[j]];
+    out[4 * j] = color >> 16 & 0xff;
+    out[4 * j + 1] = color >> 8 & 0xff;
+    out[4 * j + 2] = color & 0xff;
+    out[4 * j + 3] = 0xff;
+  }
 }
 
 /// PPM file operations --- For RGB images
 
-/// Load a raw PPM file.
-/// Only ASCII PPM files are accepted.
-/// On success, a new image is returned.
-/// (The caller is responsible for destroying the returned image!)
-Image ImageLoadPPM(const char* filename) {
-  assert(filename != NULL);
+// Open a PPM file and parse its header.
+// Returns the file, positioned at the first pixel.
+static FILE* OpenPPM(const char* filename, int* wp, int* hp, int* levelsp) {
   int w, h;
   int levels;
   char c;
   FILE* f = NULL;
 
+  InstrRegionBegin("header");
   check((f = fopen(filename, "rb")) != NULL, "Open failed");
   // Parse PPM header
   check(fscanf(f, "P%c ", &c) == 1 && c == '3', "Invalid file format");
@@ -491,18 +1187,43 @@ Image ImageLoadPPM(const char* filename) {
   check(fscanf(f, "%d", &levels) == 1 && 0 <= levels && levels <= 255,
         "Invalid depth");
   check(fscanf(f, "%c", &c) == 1 && isspace(c), "Whitespace expected");
+  InstrRegionEnd();
+
+  *wp = w;
+  *hp = h;
+  *levelsp = levels;
+  return f;
+}
 
-  // Allocate image
-  Image img = ImageCreate((uint32)w, (uint32)h);
+// Read the next pixel of a PPM file
+static rgb_t ReadPPMColor(FILE* f, int levels) {
+  int r, g, b;
+  check(fscanf(f, "%d %d %d", &r, &g, &b) == 3 && 0 <= r && r <= levels &&
+            0 <= g && g <= levels && 0 <= b && b <= levels,
+        "Invalid pixel color");
+  return r << 16 | g << 8 | b;
+}
+
+/// Load a raw PPM file.
+/// Only ASCII PPM files are accepted.
+/// On success, a new image is returned.
+/// (The caller is responsible for destroying the returned image!)
+Image ImageLoadPPM(const char* filename) {
+  assert(filename != NULL);
+  int w, h;
+  int levels;
+
+  InstrRegionBegin("ImageLoadPPM");
+  FILE* f = OpenPPM(filename, &w, &h, &levels);
+
+  // Allocate image (every pixel is read below, no need to clear it)
+  Image img = CreateUninitialized((uint32)w, (uint32)h);
 
   // Read pixels
+  InstrRegionBegin("pixels");
   for (uint32 i = 0; i < img->height; i++) {
     for (uint32 j = 0; j < img->width; j++) {
-      int r, g, b;
-      check(fscanf(f, "%d %d %d", &r, &g, &b) == 3 && 0 <= r && r <= levels &&
-                0 <= g && g <= levels && 0 <= b && b <= levels,
-            "Invalid pixel color");
-      rgb_t color = r << 16 | g << 8 | b;
+      rgb_t color = ReadPPMColor(f, levels);
       uint16 index = LUTAllocColor(img, color);
       img->image[i][j] = index;
       // printf("[%u][%u]: (%d,%d,%d) -> %u (%6x)\n", i, j, r,g,b, index,
@@ -510,8 +1231,233 @@ Image ImageLoadPPM(const char* filename) {
     }
     fprintf(f, "\n");
   }
+  InstrRegionEnd();
+
+  fclose(f);
+  InstrRegionEnd();
+  return img;
+}
+
+/*------------------------------------------------------------------
+ * ImageLoadPPMQuantized
+ * ImageLoadPPM termina o programa ("LUT Overflow") com mais de
+ * FIXED_LUT_SIZE cores, o que acontece com qualquer fotografia.
+ * Aqui os píxeis são lidos primeiro para um buffer, enquanto uma tabela
+ * de hash conta as ocorrências de cada cor distinta:
+ *
+ *   - se as cores cabem na LUT, cada cor recebe o seu label pela ordem
+ *     em que aparece (resultado igual ao de ImageLoadPPM);
+ *   - senão, a paleta é reduzida por median cut: a caixa de cores com
+ *     maior extensão num dos canais é partida pela mediana (pesada pelo
+ *     nº de píxeis) nesse canal, até haver caixas suficientes; cada
+ *     caixa fica representada pela média pesada das suas cores.
+ *
+ * O label de cada cor distinta fica guardado na própria tabela de hash,
+ * por isso os píxeis são convertidos numa só passagem, com uma procura
+ * na tabela por píxel (sem procurar a cor mais próxima na paleta).
+ *-----------------------------------------------------------------*/
+
+// Tabela de hash cor -> (nº de píxeis, label), com endereçamento aberto
+#define COLOR_EMPTY 0xFFFFFFFFu  // nunca é uma cor (só usam 24 bits)
+
+struct colorEntry {
+  rgb_t color;
+  uint32 count;
+  int label;  // -1: ainda sem label
+};
+
+struct colorTable {
+  struct colorEntry* slots;
+  uint32 mask;  // nº de posições - 1 (potência de 2)
+  uint32 size;  // nº de cores distintas
+};
+
+static void ColorTableInit(struct colorTable* t, uint32 capacity) {
+  t->slots = malloc(capacity * sizeof(struct colorEntry));
+  check(t->slots != NULL, "malloc");
+  for (uint32 k = 0; k < capacity; k++) t->slots[k].color = COLOR_EMPTY;
+  t->mask = capacity - 1;
+  t->size = 0;
+}
+
+// Posição de color na tabela (ou a posição vazia onde deve ficar)
+static struct colorEntry* ColorTableFind(const struct colorTable* t,
+                                         rgb_t color) {
+  uint32 k = (color * 0x9E3779B1u) >> 8 & t->mask;
+  while (t->slots[k].color != color && t->slots[k].color != COLOR_EMPTY)
+    k = (k + 1) & t->mask;
+  return &t->slots[k];
+}
+
+// Contar mais n píxeis de color (a tabela cresce até meia ocupação)
+static void ColorTableCount(struct colorTable* t, rgb_t color, uint32 n) {
+  struct colorEntry* e = ColorTableFind(t, color);
+  if (e->color == COLOR_EMPTY) {
+    if (2 * (t->size + 1) > t->mask + 1) {
+      struct colorTable bigger;
+      ColorTableInit(&bigger, 2 * (t->mask + 1));
+      for (uint32 k = 0; k <= t->mask; k++) {
+        if (t->slots[k].color != COLOR_EMPTY)
+          *ColorTableFind(&bigger, t->slots[k].color) = t->slots[k];
+      }
+      bigger.size = t->size;
+      free(t->slots);
+      *t = bigger;
+      e = ColorTableFind(t, color);
+    }
+    *e = (struct colorEntry){color, 0, -1};
+    t->size++;
+  }
+  e->count += n;
+}
+
+// Caixa do median cut: as cores list[lo..hi)
+struct colorBox {
+  uint32 lo, hi;
+  int shift;  // canal mais extenso (16: R, 8: G, 0: B)
+  int span;   // extensão nesse canal
+};
+
+static void ColorBoxMeasure(struct colorBox* box, struct colorEntry** list) {
+  int min[3] = {255, 255, 255}, max[3] = {0, 0, 0};
+  for (uint32 k = box->lo; k < box->hi; k++) {
+    for (int c = 0; c < 3; c++) {
+      int value = list[k]->color >> (8 * c) & 0xff;
+      if (value < min[c]) min[c] = value;
+      if (value > max[c]) max[c] = value;
+    }
+  }
+  box->span = -1;
+  for (int c = 2; c >= 0; c--) {
+    if (max[c] - min[c] > box->span) {
+      box->span = max[c] - min[c];
+      box->shift = 8 * c;
+    }
+  }
+}
+
+static _Thread_local int boxShift;  // canal usado por CompareChannel
+static int CompareChannel(const void* a, const void* b) {
+  int ca = (*(struct colorEntry* const*)a)->color >> boxShift & 0xff;
+  int cb = (*(struct colorEntry* const*)b)->color >> boxShift & 0xff;
+  return ca - cb;
+}
+
+// Atribuir labels a todas as cores da tabela, com no máximo maxColors
+// cores novas na LUT de img
+static void QuantizeColors(Image img, struct colorTable* t, int maxColors) {
+  struct colorEntry** list = malloc(t->size * sizeof(struct colorEntry*));
+  struct colorBox* boxes = malloc(maxColors * sizeof(struct colorBox));
+  check(list != NULL && boxes != NULL, "malloc");
+  uint32 n = 0;
+  for (uint32 k = 0; k <= t->mask; k++) {
+    if (t->slots[k].color != COLOR_EMPTY) list[n++] = &t->slots[k];
+  }
+
+  int numBoxes = 1;
+  boxes[0] = (struct colorBox){0, n, 0, 0};
+  ColorBoxMeasure(&boxes[0], list);
+  while (numBoxes < maxColors) {
+    // Partir a caixa mais extensa (com uma só cor, a extensão é 0)
+    int best = 0;
+    for (int b = 1; b < numBoxes; b++) {
+      if (boxes[b].span > boxes[best].span) best = b;
+    }
+    struct colorBox* box = &boxes[best];
+    if (box->span == 0) break;
+
+    boxShift = box->shift;
+    qsort(list + box->lo, box->hi - box->lo, sizeof(struct colorEntry*),
+          CompareChannel);
+    uint64_t pixels = 0, half = 0;
+    for (uint32 k = box->lo; k < box->hi; k++) pixels += list[k]->count;
+    uint32 mid = box->lo;
+    while (mid < box->hi - 1 && 2 * half < pixels) half += list[mid++]->count;
+    if (mid == box->lo) mid++;  // pelo menos uma cor em cada metade
+
+    boxes[numBoxes] = (struct colorBox){mid, box->hi, 0, 0};
+    box->hi = mid;
+    ColorBoxMeasure(box, list);
+    ColorBoxMeasure(&boxes[numBoxes], list);
+    numBoxes++;
+  }
+
+  // Cada caixa fica com a média das suas cores, pesada pelos píxeis
+  for (int b = 0; b < numBoxes; b++) {
+    uint64_t sum[3] = {0, 0, 0}, pixels = 0;
+    for (uint32 k = boxes[b].lo; k < boxes[b].hi; k++) {
+      for (int c = 0; c < 3; c++)
+        sum[c] += (uint64_t)(list[k]->color >> (8 * c) & 0xff) * list[k]->count;
+      pixels += list[k]->count;
+    }
+    rgb_t mean = 0;
+    for (int c = 0; c < 3; c++)
+      mean |= (rgb_t)((sum[c] + pixels / 2) / pixels) << (8 * c);
+    int label = LUTAllocColor(img, mean);
+    for (uint32 k = boxes[b].lo; k < boxes[b].hi; k++) list[k]->label = label;
+  }
+
+  free(boxes);
+  free(list);
+}
+
+// Quantizar as cores da tabela se não couberem na LUT de img (que já tem
+// BRANCO e PRETO). Se couberem, ficam sem label (atribuído ao converter).
+static void QuantizeIfNeeded(Image img, struct colorTable* t) {
+  const struct colorEntry* white = ColorTableFind(t, 0xffffff);
+  const struct colorEntry* black = ColorTableFind(t, 0x000000);
+  uint32 needed = img->num_colors + t->size -
+                  (white->color != COLOR_EMPTY) - (black->color != COLOR_EMPTY);
+  if (needed > FIXED_LUT_SIZE) {
+    InstrRegionBegin("quantize");
+    QuantizeColors(img, t, FIXED_LUT_SIZE - img->num_colors);
+    InstrRegionEnd();
+  }
+}
+
+Image ImageLoadPPMQuantized(const char* filename) {
+  assert(filename != NULL);
+  int w, h;
+  int levels;
 
+  InstrRegionBegin("ImageLoadPPMQuantized");
+  FILE* f = OpenPPM(filename, &w, &h, &levels);
+  Image img = CreateUninitialized((uint32)w, (uint32)h);
+
+  // Ler os píxeis e contar as cores
+  InstrRegionBegin("pixels");
+  const size_t total = (size_t)w * h;
+  rgb_t* colors = malloc(total * sizeof(rgb_t));
+  check(colors != NULL, "malloc");
+  struct colorTable table;
+  ColorTableInit(&table, 1024);
+  for (size_t k = 0; k < total; k++) {
+    colors[k] = ReadPPMColor(f, levels);
+    ColorTableCount(&table, colors[k], 1);
+  }
   fclose(f);
+  InstrRegionEnd();
+
+  QuantizeIfNeeded(img, &table);
+
+  // Converter os píxeis (sem quantização, os labels são dados pela ordem
+  // em que as cores aparecem)
+  InstrRegionBegin("map");
+  size_t k = 0;
+  for (uint32 i = 0; i < img->height; i++) {
+    uint16* row = img->image[i];
+    for (uint32 j = 0; j < img->width; j++, k++) {
+      struct colorEntry* e = ColorTableFind(&table, colors[k]);
+      if (e->label < 0) e->label = LUTAllocColor(img, colors[k]);
+      row[j] = (uint16)e->label;
+    }
+  }
+  COUNT_PIXMEM(total);
+  InstrRegionEnd();
+
+  free(table.slots);
+  free(colors);
+  InstrRegionEnd();
   return img;
 }
 
@@ -521,30 +1467,345 @@ Image ImageLoadPPM(const char* filename) {
 int ImageSavePPM(const Image img, const char* filename) {
   assert(img != NULL);
 
-  int w = (int)img->width;
-  int h = (int)img->height;
+  InstrRegionBegin("ImageSavePPM");
+  struct imageView view = IdentityView(img);
+  int result = ImageViewSavePPM(&view, filename);
+  InstrRegionEnd();
+  return result;
+}
+
+/// Save what the view shows to a PPM file.
+int ImageViewSavePPM(const ImageView view, const char* filename) {
+  assert(view != NULL);
+
+  int w = (int)view->width;
+  int h = (int)view->height;
+  const rgb_t* LUT = view->src->LUT;
   FILE* f = NULL;
 
   check((f = fopen(filename, "wb")) != NULL, "Open failed");
   check(fprintf(f, "P3\n%d %d\n255\n", w, h) > 0, "Writing header failed");
 
+  // Each row is expanded to RGB bytes, then formatted as "  %3d %3d %3d"
+  // per pixel from a table of the 256 values, and written at once
+  char digits[256][4];
+  for (int value = 0; value < 256; value++)
+    snprintf(digits[value], sizeof(digits[value]), "%3d", value);
+  const int simd = UseAVX2();
+  uint8* rgb = malloc((size_t)w * 3);
+  char* text = malloc((size_t)w * 14 + 1);
+  check(rgb != NULL && text != NULL, "malloc");
+
   // The pixel RGB values
-  for (uint32 i = 0; i < img->height; i++) {
-    for (uint32 j = 0; j < img->width; j++) {
-      uint16 index = img->image[i][j];
-      rgb_t color = img->LUT[index];
-      int r = color >> 16 & 0xff;
-      int g = color >> 8 & 0xff;
-      int b = color & 0xff;
-      fprintf(f, "  %3d %3d %3d", r, g, b);
+  uint16 buf[w];
+  for (uint32 i = 0; i < view->height; i++) {
+    const uint16* row = ViewRow(view, i, buf);
+    ExpandRowRGB24(row, view->width, LUT, rgb, simd);
+    char* p = text;
+    for (uint32 j = 0; j < 3 * view->width; j += 3) {
+      *p++ = ' ';
+      for (int c = 0; c < 3; c++) {
+        *p++ = ' ';
+        memcpy(p, digits[rgb[j + c]], 3);
+        p += 3;
+      }
     }
-    fprintf(f, "\n");
+    *p++ = '\n';
+    check(fwrite(text, 1, p - text, f) == (size_t)(p - text),
+          "Writing pixels failed");
   }
 
   // Cleanup
-  fclose(f);
+  free(text);
+  free(rgb);
+  check(fclose(f) == 0, "Closing file failed");
 
-  return 0;
+  return 1;
+}
+
+/// RGB buffers
+
+// Bytes between rows: stride, or the packed row size if stride is 0
+static size_t RowStride(size_t stride, uint32 width, int bytesPerPixel) {
+  if (stride == 0) return (size_t)width * bytesPerPixel;
+  assert(stride >= (size_t)width * bytesPerPixel);
+  return stride;
+}
+
+void ImageToRGB24(const Image img, uint8 buf[], size_t stride) {
+  assert(img != NULL);
+  assert(buf != NULL);
+  stride = RowStride(stride, img->width, 3);
+  const int simd = UseAVX2();
+  for (uint32 i = 0; i < img->height; i++) {
+    ExpandRowRGB24(img->image[i], img->width, img->LUT, buf + i * stride, simd);
+  }
+  COUNT_PIXMEM((unsigned long)img->width * img->height);
+}
+
+void ImageToRGBA32(const Image img, uint8 buf[], size_t stride) {
+  assert(img != NULL);
+  assert(buf != NULL);
+  stride = RowStride(stride, img->width, 4);
+  const int simd = UseAVX2();
+  for (uint32 i = 0; i < img->height; i++) {
+    ExpandRowRGBA32(img->image[i], img->width, img->LUT, buf + i * stride,
+                    simd);
+  }
+  COUNT_PIXMEM((unsigned long)img->width * img->height);
+}
+
+/*------------------------------------------------------------------
+ * ImageFromRGB24
+ * Como ImageLoadPPMQuantized, mas a partir de um buffer: a primeira
+ * passagem conta as cores na tabela de hash (e quantiza-as se não
+ * couberem na LUT), a segunda converte os píxeis. Píxeis seguidos têm
+ * muitas vezes a mesma cor, por isso a última cor encontrada evita a
+ * procura na tabela.
+ *-----------------------------------------------------------------*/
+static rgb_t RGB24At(const uint8* p) { return p[0] << 16 | p[1] << 8 | p[2]; }
+
+Image ImageFromRGB24(const uint8 buf[], uint32 width, uint32 height,
+                     size_t stride) {
+  assert(buf != NULL);
+  stride = RowStride(stride, width, 3);
+  Image img = CreateUninitialized(width, height);
+
+  // Contar as cores, uma vez por cada sequência de píxeis iguais
+  struct colorTable table;
+  ColorTableInit(&table, 1024);
+  for (uint32 i = 0; i < height; i++) {
+    const uint8* p = buf + i * stride;
+    uint32 j = 0;
+    while (j < width) {
+      const rgb_t color = RGB24At(p + 3 * j);
+      uint32 end = j + 1;
+      while (end < width && RGB24At(p + 3 * end) == color) end++;
+      ColorTableCount(&table, color, end - j);
+      j = end;
+    }
+  }
+  QuantizeIfNeeded(img, &table);
+
+  rgb_t last = COLOR_EMPTY;
+  uint16 lastLabel = 0;
+  for (uint32 i = 0; i < height; i++) {
+    const uint8* p = buf + i * stride;
+    uint16* row = img->image[i];
+    for (uint32 j = 0; j < width; j++) {
+      rgb_t color = RGB24At(p + 3 * j);
+      if (color != last) {
+        struct colorEntry* e = ColorTableFind(&table, color);
+        if (e->label < 0) e->label = LUTAllocColor(img, color);
+        last = color;
+        lastLabel = (uint16)e->label;
+      }
+      row[j] = lastLabel;
+    }
+  }
+  COUNT_PIXMEM((unsigned long)width * height);
+
+  free(table.slots);
+  return img;
+}
+
+/// LBL file operations --- native format for labeled images
+
+/*------------------------------------------------------------------
+ * Formato LBL (little-endian)
+ *   cabeçalho (32 bytes):
+ *     "LBL1"          magic e versão
+ *     uint32 flags    LBL_RLE: píxeis comprimidos em runs
+ *     uint32 width, height
+ *     uint32 colors   número de entradas da LUT
+ *     uint32 reserved (0)
+ *     uint64 payload  bytes de píxeis que se seguem à LUT
+ *   LUT:    colors x uint32 (0x00RRGGBB)
+ *   píxeis: sem compressão, width*height uint16, linha a linha;
+ *           com LBL_RLE, pares (uint16 label, uint16 comprimento) que
+ *           percorrem a imagem como um só array (as runs podem passar
+ *           de uma linha para a seguinte).
+ *
+ * Os píxeis são lidos numa só leitura para um bloco contíguo, que passa
+ * a ser o armazenamento da imagem (ver CreateContiguous).
+ *-----------------------------------------------------------------*/
+#define LBL_MAGIC "LBL1"
+#define LBL_HEADER_SIZE 32
+#define LBL_RLE 1u
+#define LBL_MAX_RUN 0xFFFFu
+
+// O formato é little-endian; noutras máquinas os valores são trocados
+static int HostIsBigEndian(void) {
+  const uint16 one = 1;
+  return *(const uint8*)&one == 0;
+}
+
+static void Swap16(uint16* a, size_t n) {
+  for (size_t i = 0; i < n; i++) a[i] = (uint16)((a[i] >> 8) | (a[i] << 8));
+}
+
+static void PutLE32(uint8* p, uint32 x) {
+  for (int i = 0; i < 4; i++) p[i] = (uint8)(x >> (8 * i));
+}
+
+static uint32 GetLE32(const uint8* p) {
+  return (uint32)p[0] | (uint32)p[1] << 8 | (uint32)p[2] << 16 |
+         (uint32)p[3] << 24;
+}
+
+// Imagem cujas linhas apontam para um único bloco de width*height píxeis
+static Image CreateContiguous(uint32 width, uint32 height) {
+  assert(width > 0);
+  assert(height > 0);
+  Image img = AllocateImageHeader(width, height);
+  const size_t n = (size_t)width * height;
+  img->pixels = malloc(n * sizeof(uint16));
+  check(img->pixels != NULL, "Alloc failed ->pixels");
+  for (uint32 i = 0; i < height; i++)
+    img->image[i] = img->pixels + (size_t)i * width;
+  return img;
+}
+
+// Escreve uma run (dividindo as que excedem LBL_MAX_RUN)
+static void PutRun(FILE* f, uint16 label, size_t length, uint64_t* bytes) {
+  while (length > 0) {
+    const uint16 n = length > LBL_MAX_RUN ? LBL_MAX_RUN : (uint16)length;
+    uint16 pair[2] = {label, n};
+    if (HostIsBigEndian()) Swap16(pair, 2);
+    check(fwrite(pair, sizeof(uint16), 2, f) == 2, "Writing pixels failed");
+    *bytes += sizeof(pair);
+    length -= n;
+  }
+}
+
+/// Save image to LBL file.
+int ImageSaveLBL(const Image img, const char* filename, int compress) {
+  assert(img != NULL);
+
+  InstrRegionBegin("ImageSaveLBL");
+  const uint32 W = img->width, H = img->height;
+  const uint16 colors = ImageColors(img);
+  FILE* f = NULL;
+  check((f = fopen(filename, "wb")) != NULL, "Open failed");
+
+  // Cabeçalho provisório: o tamanho dos píxeis comprimidos só se sabe no fim
+  uint8 header[LBL_HEADER_SIZE] = {0};
+  check(fwrite(header, 1, LBL_HEADER_SIZE, f) == LBL_HEADER_SIZE,
+        "Writing header failed");
+
+  uint8 lut[4 * colors];
+  for (uint16 i = 0; i < colors; i++) PutLE32(lut + 4 * i, img->LUT[i]);
+  check(fwrite(lut, 4, colors, f) == colors, "Writing LUT failed");
+
+  uint64_t payload = 0;
+  if (compress) {
+    uint16 label = img->image[0][0];
+    size_t length = 0;
+    for (uint32 v = 0; v < H; v++) {
+      const uint16* row = img->image[v];
+      for (uint32 u = 0; u < W; u++) {
+        if (row[u] != label) {
+          PutRun(f, label, length, &payload);
+          label = row[u];
+          length = 0;
+        }
+        length++;
+      }
+    }
+    PutRun(f, label, length, &payload);
+  } else {
+    uint16 buf[W];
+    for (uint32 v = 0; v < H; v++) {
+      const uint16* row = img->image[v];
+      if (HostIsBigEndian()) {
+        memcpy(buf, row, sizeof(buf));
+        Swap16(buf, W);
+        row = buf;
+      }
+      check(fwrite(row, sizeof(uint16), W, f) == W, "Writing pixels failed");
+    }
+    payload = (uint64_t)W * H * sizeof(uint16);
+  }
+  COUNT_PIXMEM((unsigned long)W * H);
+
+  memcpy(header, LBL_MAGIC, 4);
+  PutLE32(header + 4, compress ? LBL_RLE : 0);
+  PutLE32(header + 8, W);
+  PutLE32(header + 12, H);
+  PutLE32(header + 16, colors);
+  PutLE32(header + 24, (uint32)payload);
+  PutLE32(header + 28, (uint32)(payload >> 32));
+  check(fseek(f, 0, SEEK_SET) == 0 &&
+            fwrite(header, 1, LBL_HEADER_SIZE, f) == LBL_HEADER_SIZE,
+        "Writing header failed");
+  check(fclose(f) == 0, "Closing file failed");
+  InstrRegionEnd();
+  return 1;
+}
+
+/// Load a LBL file.
+Image ImageLoadLBL(const char* filename) {
+  InstrRegionBegin("ImageLoadLBL");
+  InstrRegionBegin("header");
+  FILE* f = NULL;
+  check((f = fopen(filename, "rb")) != NULL, "Open failed");
+
+  uint8 header[LBL_HEADER_SIZE];
+  check(fread(header, 1, LBL_HEADER_SIZE, f) == LBL_HEADER_SIZE &&
+            memcmp(header, LBL_MAGIC, 4) == 0,
+        "Invalid file format");
+  const uint32 flags = GetLE32(header + 4);
+  const uint32 W = GetLE32(header + 8), H = GetLE32(header + 12);
+  const uint32 colors = GetLE32(header + 16);
+  const uint64_t payload =
+      GetLE32(header + 24) | (uint64_t)GetLE32(header + 28) << 32;
+  const size_t n = (size_t)W * H;
+  check((flags & ~LBL_RLE) == 0, "Invalid file format");
+  check(W > 0 && H > 0, "Invalid size");
+  check(colors >= 2 && colors <= FIXED_LUT_SIZE, "Invalid number of colors");
+  check(flags & LBL_RLE ? payload % 4 == 0 : payload == n * sizeof(uint16),
+        "Invalid pixel data size");
+
+  Image img = CreateContiguous(W, H);
+  img->num_colors = (uint16)colors;
+  uint8 lut[4 * colors];
+  check(fread(lut, 4, colors, f) == colors, "Reading LUT");
+  for (uint32 i = 0; i < colors; i++) img->LUT[i] = GetLE32(lut + 4 * i);
+  InstrRegionEnd();
+
+  InstrRegionBegin("pixels");
+  uint16 maxLabel = 0;
+  if (flags & LBL_RLE) {
+    // Uma leitura para todas as runs, depois expandidas no bloco
+    const size_t runs = payload / 4;
+    uint16* pairs = malloc(runs > 0 ? payload : 1);
+    check(pairs != NULL, "malloc");
+    check(fread(pairs, 4, runs, f) == runs, "Reading pixels");
+    if (HostIsBigEndian()) Swap16(pairs, 2 * runs);
+    size_t pos = 0;
+    for (size_t r = 0; r < runs; r++) {
+      const uint16 label = pairs[2 * r], length = pairs[2 * r + 1];
+      check(length <= n - pos, "Invalid pixel data");
+      FillRow(img->pixels + pos, length, label);
+      if (label > maxLabel) maxLabel = label;
+      pos += length;
+    }
+    free(pairs);
+    check(pos == n, "Invalid pixel data");
+  } else {
+    // Uma leitura diretamente para o armazenamento da imagem
+    check(fread(img->pixels, sizeof(uint16), n, f) == n, "Reading pixels");
+    if (HostIsBigEndian()) Swap16(img->pixels, n);
+    for (size_t i = 0; i < n; i++)
+      if (img->pixels[i] > maxLabel) maxLabel = img->pixels[i];
+  }
+  COUNT_PIXMEM(n);
+  check(maxLabel < colors, "Invalid pixel label");
+  InstrRegionEnd();
+
+  fclose(f);
+  InstrRegionEnd();
+  return img;
 }
 
 /// Information queries
@@ -566,7 +1827,213 @@ uint32 ImageHeight(const Image img) {
 /// Get number of image colors
 uint16 ImageColors(const Image img) {
   assert(img != NULL);
-  return img->num_colors;
+  return OwnerOf(img)->num_colors;
+}
+
+/*------------------------------------------------------------------
+ * ImageCompactLUT
+ * Recolhe os labels que já não aparecem em nenhum pixel e junta os
+ * labels com a mesma cor, para que edições repetidas (preenchimentos
+ * sucessivos, que acrescentam sempre labels) não esgotem a LUT.
+ *
+ *   1) Uma passagem pelos píxeis marca os labels usados. Só escreve 1
+ *      em used[label] (não incrementa contadores), por isso píxeis
+ *      seguidos com o mesmo label não dependem uns dos outros.
+ *   2) A LUT é compactada no próprio array, mantendo a ordem dos labels
+ *      que ficam; cada label usado passa a apontar (remap) para a
+ *      primeira entrada com a mesma cor. WHITE e BLACK ficam sempre.
+ *   3) Se algum label mudou, uma segunda passagem reescreve os píxeis
+ *      através de remap. Se só se libertaram labels do fim da LUT,
+ *      esta passagem não é precisa.
+ *
+ * A LUT é partilhada com as sub-imagens: trata sempre a imagem dona
+ * inteira. Devolve o novo número de cores.
+ *-----------------------------------------------------------------*/
+uint16 ImageCompactLUT(Image img) {
+  assert(img != NULL);
+  Image owner = OwnerOf(img);
+  const uint32 W = owner->width;
+  const uint32 H = owner->height;
+  const uint16 n = owner->num_colors;
+  rgb_t* LUT = owner->LUT;
+
+  InstrRegionBegin("ImageCompactLUT");
+
+  // 1) Labels usados
+  uint8 used[FIXED_LUT_SIZE] = {0};
+  used[WHITE] = used[BLACK] = 1;
+  for (uint32 i = 0; i < H; i++) {
+    const uint16* row = owner->image[i];
+    for (uint32 j = 0; j < W; j++) used[row[j]] = 1;
+  }
+  COUNT_PIXMEM((unsigned long)W * H);
+
+  // 2) Compactar a LUT e construir o remap
+  uint16 remap[FIXED_LUT_SIZE];
+  uint16 count = 0;
+  int identity = 1;
+  for (uint16 label = 0; label < n; label++) {
+    if (!used[label]) continue;
+    uint16 k = 0;
+    while (k < count && LUT[k] != LUT[label]) k++;
+    if (k == count) LUT[count++] = LUT[label];
+    remap[label] = k;
+    identity &= (k == label);
+  }
+
+  // 3) Reescrever os píxeis
+  if (!identity) {
+    for (uint32 i = 0; i < H; i++) {
+      uint16* row = owner->image[i];
+      for (uint32 j = 0; j < W; j++) row[j] = remap[row[j]];
+    }
+    COUNT_PIXMEM((unsigned long)W * H);
+  }
+
+  owner->num_colors = count;
+  img->num_colors = count;
+  InstrRegionEnd();
+  return count;
+}
+
+/*------------------------------------------------------------------
+ * Histograma de labels
+ * Um contador por label (counts[row[j]]++) obriga píxeis seguidos com o
+ * mesmo label, o caso normal, a esperar pelo incremento anterior
+ * (store-to-load forwarding). Por isso os píxeis são repartidos,
+ * alternadamente, por HIST_BANKS bancos de contadores independentes,
+ * somados no fim.
+ *
+ * Os bancos são de 32 bits (cabem mais bancos na cache L1) e são
+ * despejados para os totais antes de poderem transbordar.
+ *
+ * Com várias threads, cada uma conta um bloco de linhas seguidas nos
+ * seus próprios contadores; a thread que chama soma-os no fim.
+ *-----------------------------------------------------------------*/
+#define HIST_BANKS 4
+#define HIST_MIN_PIXELS (1 << 16)  // mínimo de píxeis por thread
+
+// Acrescenta a counts os labels das linhas [row0, row1) de img
+static void HistogramRows(const Image img, uint32 row0, uint32 row1,
+                          size_t counts[]) {
+  const uint32 W = img->width;
+  const uint16 n = ImageColors(img);
+  uint32 bank[HIST_BANKS][FIXED_LUT_SIZE];
+  memset(bank, 0, sizeof(bank));
+
+  size_t pending = 0;  // píxeis contados desde o último despejo
+  for (uint32 i = row0; i < row1; i++) {
+    if (pending + W > UINT32_MAX) {
+      for (uint16 l = 0; l < n; l++) {
+        for (int b = 0; b < HIST_BANKS; b++) counts[l] += bank[b][l];
+      }
+      memset(bank, 0, sizeof(bank));
+      pending = 0;
+    }
+    const uint16* row = img->image[i];
+    uint32 j = 0;
+    for (; j + HIST_BANKS <= W; j += HIST_BANKS) {
+      bank[0][row[j]]++;
+      bank[1][row[j + 1]]++;
+      bank[2][row[j + 2]]++;
+      bank[3][row[j + 3]]++;
+    }
+    for (; j < W; j++) bank[0][row[j]]++;
+    pending += W;
+  }
+  for (uint16 l = 0; l < n; l++) {
+    for (int b = 0; b < HIST_BANKS; b++) counts[l] += bank[b][l];
+  }
+}
+
+struct histJob {
+  Image img;
+  uint32 row0, row1;
+  size_t counts[FIXED_LUT_SIZE];
+  pthread_t thread;
+};
+
+static void* HistogramWorker(void* arg) {
+  struct histJob* job = arg;
+  InstrThreadTryRegister("histogram");  // sem registo se estiver cheio
+  HistogramRows(job->img, job->row0, job->row1, job->counts);
+  InstrThreadUnregister();
+  return NULL;
+}
+
+void ImageHistogram(const Image img, size_t counts[]) {
+  ImageHistogramN(img, counts, 1);
+}
+
+void ImageHistogramN(const Image img, size_t counts[], int threads) {
+  assert(img != NULL);
+  assert(counts != NULL);
+  assert(threads >= 0);
+  const uint32 W = img->width;
+  const uint32 H = img->height;
+  const uint16 n = ImageColors(img);
+
+  InstrRegionBegin("ImageHistogram");
+  if (threads == 0) {
+    long np = sysconf(_SC_NPROCESSORS_ONLN);
+    threads = np > 0 ? (int)np : 1;
+  }
+  // Não vale a pena lançar threads para poucos píxeis
+  const size_t pixels = (size_t)W * H;
+  if ((size_t)threads > pixels / HIST_MIN_PIXELS)
+    threads = (int)(pixels / HIST_MIN_PIXELS);
+  if ((uint32)threads > H) threads = (int)H;
+  if (threads < 1) threads = 1;
+
+  memset(counts, 0, n * sizeof(size_t));
+  if (threads == 1) {
+    HistogramRows(img, 0, H, counts);
+  } else {
+    // Blocos de linhas seguidas; a thread que chama conta o primeiro
+    struct histJob* jobs = calloc(threads, sizeof(struct histJob));
+    check(jobs != NULL, "calloc");
+    for (int t = 0; t < threads; t++) {
+      jobs[t].img = img;
+      jobs[t].row0 = (uint32)((uint64_t)H * t / threads);
+      jobs[t].row1 = (uint32)((uint64_t)H * (t + 1) / threads);
+    }
+    for (int t = 1; t < threads; t++) {
+      int err = pthread_create(&jobs[t].thread, NULL, HistogramWorker, &jobs[t]);
+      check(err == 0, "pthread_create");
+    }
+    HistogramRows(img, jobs[0].row0, jobs[0].row1, counts);
+    for (int t = 1; t < threads; t++) {
+      pthread_join(jobs[t].thread, NULL);
+      for (uint16 l = 0; l < n; l++) counts[l] += jobs[t].counts[l];
+    }
+    free(jobs);
+  }
+  COUNT_PIXMEM((unsigned long)pixels);
+  InstrRegionEnd();
+}
+
+uint16 ImageColorHistogram(const Image img, rgb_t colors[], size_t counts[]) {
+  assert(img != NULL);
+  assert(colors != NULL && counts != NULL);
+  const uint16 n = ImageColors(img);
+  const rgb_t* LUT = img->LUT;
+
+  size_t labelCounts[FIXED_LUT_SIZE];
+  ImageHistogram(img, labelCounts);
+
+  // Juntar os labels com a mesma cor, pela ordem do primeiro label
+  uint16 numColors = 0;
+  for (uint16 label = 0; label < n; label++) {
+    if (labelCounts[label] == 0) continue;
+    uint16 k = 0;
+    while (k < numColors && colors[k] != LUT[label]) k++;
+    if (k == numColors) {
+      colors[numColors] = LUT[label];
+      counts[numColors++] = 0;
+    }
+    counts[k] += labelCounts[label];
+  }
+  return numColors;
 }
 
 /*------------------------------------------------------------------
@@ -578,7 +2045,7 @@ uint16 ImageColors(const Image img) {
  *   - conteúdo pixel a pixel (linha a linha)
  *
  * Usa early-return para acelerar a deteção de diferenças e contabiliza
- * acessos a pixels via PIXMEM. Implementação eficiente e estável.
+ * acessos a pixels via COUNT_PIXMEM. Implementação eficiente e estável.
  *
  * Retorna 1 se forem iguais, 0 caso contrário.
  *-----------------------------------------------------------------*/
@@ -588,11 +2055,12 @@ int ImageIsEqual(const Image img1, const Image img2) {
 
     const uint32 W = img1->width, H = img1->height;
     if (W != img2->width || H != img2->height) return 0;
-    if (img1->num_colors != img2->num_colors) return 0;
+    const uint16 colors = ImageColors(img1);
+    if (colors != ImageColors(img2)) return 0;
 
     // Comparar LUT
-    if (img1->num_colors > 0) {
-        const size_t lutBytes = (size_t)img1->num_colors * sizeof(rgb_t);
+    if (colors > 0) {
+        const size_t lutBytes = (size_t)colors * sizeof(rgb_t);
         if (memcmp(img1->LUT, img2->LUT, lutBytes) != 0) return 0;
     }
 
@@ -600,10 +2068,10 @@ int ImageIsEqual(const Image img1, const Image img2) {
     const size_t rowBytes = (size_t)W * sizeof(uint16);
     for (uint32 v = 0; v < H; v++) {
         if (memcmp(img1->image[v], img2->image[v], rowBytes) != 0) {
-            PIXMEM += W;  // Contabilizar acessos
+            COUNT_PIXMEM(W);  // Contabilizar acessos
             return 0;
         }
-        PIXMEM += W;  // Contabilizar acessos da linha
+        COUNT_PIXMEM(W);  // Contabilizar acessos da linha
     }
     return 1;
 }
@@ -624,46 +2092,172 @@ int ImageIsDifferent(const Image img1, const Image img2) {
 }
 
 /*------------------------------------------------------------------
- * ImageRotate90CW
- * Cria nova imagem rotacionada 90° no sentido horário.
+ * Transformações diedrais (motor comum)
  *
- * Mapeamento geométrico:
- *     (v, u) → (u, height - 1 - v)
+ * As 8 transformações do quadrado (rotações de 0/90/180/270 graus,
+ * espelhos horizontal/vertical e as duas transposições) são todas
+ * mapeamentos afins entre coordenadas inteiras. Para cada píxel (x, y)
+ * do destino, o píxel da fonte é:
+ *
+ *     u = u0 + x*dux + y*duy
+ *     v = v0 + x*dvx + y*dvy
+ *
+ * em que cada passo vale -1, 0 ou +1. Um único kernel percorre o
+ * destino e lê a fonte segundo este mapa, pelo que qualquer cadeia de
+ * transformações (composta com ImageTransformCompose) custa uma só
+ * passagem sobre a imagem.
+ *-----------------------------------------------------------------*/
+
+// Aresta dos blocos usados nas transposições (64x64 labels = 8 KiB)
+#define TRANSFORM_BLOCK 64
+
+// Calcula o mapa da transformação t para uma fonte W x H.
+static PixelMap TransformMap(ImageTransform t, uint32 W, uint32 H) {
+  const int flipH = (t & IMAGE_FLIP_H) != 0;
+  const int flipV = (t & IMAGE_FLIP_V) != 0;
+  PixelMap m;
+
+  if (t & IMAGE_TRANSPOSE) {
+    // Destino H x W: x percorre as linhas da fonte, y as colunas
+    m.u0 = flipV ? (int32_t)W - 1 : 0;
+    m.v0 = flipH ? (int32_t)H - 1 : 0;
+    m.dux = 0;
+    m.dvx = flipH ? -1 : 1;
+    m.duy = flipV ? -1 : 1;
+    m.dvy = 0;
+  } else {
+    m.u0 = flipH ? (int32_t)W - 1 : 0;
+    m.v0 = flipV ? (int32_t)H - 1 : 0;
+    m.dux = flipH ? -1 : 1;
+    m.dvx = 0;
+    m.duy = 0;
+    m.dvy = flipV ? -1 : 1;
+  }
+  return m;
+}
+
+// Preenche todo o destino dst a partir de src segundo o mapa m.
+// Linhas que continuam linhas (sem transposição) são copiadas com memcpy
+// ou invertidas; as transposições são feitas em blocos para que as
+// linhas da fonte tocadas caibam na cache L1.
+static void TransformKernel(Image dst, const Image src, PixelMap m) {
+  const uint32 W = dst->width, H = dst->height;
+
+  if (m.dvx == 0) {
+    // Cada linha do destino vem de uma única linha da fonte
+    for (uint32 y = 0; y < H; y++) {
+      const uint16* srcRow =
+          src->image[m.v0 + (int32_t)y * m.dvy] + m.u0 + (int32_t)y * m.duy;
+      uint16* dstRow = dst->image[y];
+
+      if (m.dux == 1) {
+        memcpy(dstRow, srcRow, (size_t)W * sizeof(uint16));
+      } else {
+        for (uint32 x = 0; x < W; x++) dstRow[x] = *(srcRow - x);
+      }
+      COUNT_PIXMEM(W);
+    }
+    return;
+  }
+
+  // Cada linha do destino é uma coluna da fonte: percorrer em blocos
+  for (uint32 by = 0; by < H; by += TRANSFORM_BLOCK) {
+    const uint32 yEnd = by + TRANSFORM_BLOCK < H ? by + TRANSFORM_BLOCK : H;
+    for (uint32 bx = 0; bx < W; bx += TRANSFORM_BLOCK) {
+      const uint32 xEnd = bx + TRANSFORM_BLOCK < W ? bx + TRANSFORM_BLOCK : W;
+      for (uint32 y = by; y < yEnd; y++) {
+        const int32_t col = m.u0 + (int32_t)y * m.duy;
+        uint16* dstRow = dst->image[y];
+        int32_t row = m.v0 + (int32_t)bx * m.dvx;
+        for (uint32 x = bx; x < xEnd; x++, row += m.dvx) {
+          dstRow[x] = src->image[row][col];
+        }
+      }
+    }
+    COUNT_PIXMEM((unsigned long)W * (yEnd - by));
+  }
+}
+
+/// Compose two transformations: first, and then second.
+ImageTransform ImageTransformCompose(ImageTransform first,
+                                     ImageTransform second) {
+  unsigned flips = first & (IMAGE_FLIP_H | IMAGE_FLIP_V);
+  // Uma transposição aplicada depois troca o papel dos dois espelhos
+  if ((second & IMAGE_TRANSPOSE) && flips != 0 && flips != IMAGE_ROTATE_180)
+    flips ^= IMAGE_ROTATE_180;
+  flips ^= second & (IMAGE_FLIP_H | IMAGE_FLIP_V);
+  return (ImageTransform)(((first ^ second) & IMAGE_TRANSPOSE) | flips);
+}
+
+/// Return the transformation that undoes t.
+ImageTransform ImageTransformInverse(ImageTransform t) {
+  // Só as rotações de 90 e 270 graus não são involuções
+  if (t == IMAGE_ROTATE_90CW) return IMAGE_ROTATE_270CW;
+  if (t == IMAGE_ROTATE_270CW) return IMAGE_ROTATE_90CW;
+  return t;
+}
+
+/*------------------------------------------------------------------
+ * ImageApplyTransform
+ * Aplica qualquer uma das 8 transformações diedrais numa só passagem.
  *
- * A LUT é copiada integralmente com memcpy.
- * A rotação é feita por leitura direta de linhas para maior eficiência.
+ * As dimensões do resultado trocam quando a transformação inclui
+ * transposição. A LUT é copiada em bloco com memcpy.
  *
  * Retorna imagem nova, sem alterar a original.
  *-----------------------------------------------------------------*/
-Image ImageRotate90CW(const Image img) {
+Image ImageApplyTransform(const Image img, ImageTransform t) {
     if (img == NULL) return NULL;
+    assert((unsigned)t <= IMAGE_TRANSVERSE);
 
     const uint32 W = img->width, H = img->height;
+    const int swap = (t & IMAGE_TRANSPOSE) != 0;
 
-    Image rotated = ImageCreate(H, W);
-    if (rotated == NULL) return NULL;
+    // O kernel escreve todos os píxeis: não é preciso inicializá-los
+    Image result = CreateUninitialized(swap ? H : W, swap ? W : H);
+    ImageApplyTransformInto(result, img, t);
+    return result;
+}
 
-    // Copia LUT com memcpy em vez de loop
-    rotated->num_colors = img->num_colors;
-    if (img->num_colors > 0) {
-        const size_t lutBytes = (size_t)img->num_colors * sizeof(rgb_t);
-        memcpy(rotated->LUT, img->LUT, lutBytes);
-    }
+/*------------------------------------------------------------------
+ * ImageApplyTransformInto
+ * Como ImageApplyTransform, mas escreve numa imagem já existente,
+ * realocando só se as dimensões mudarem (ver ReshapeImage).
+ *-----------------------------------------------------------------*/
+void ImageApplyTransformInto(Image dst, const Image src, ImageTransform t) {
+    assert(dst != NULL && src != NULL);
+    assert((unsigned)t <= IMAGE_TRANSVERSE);
+    assert(OwnerOf(src) != dst);  // o kernel não trabalha no próprio sítio
 
-    // Cache de ponteiro de linha fonte
-    for (uint32 v = 0; v < H; v++) {
-        const uint16* srcRow = img->image[v];
-        const uint32 destCol = H - 1 - v;
-        
-        for (uint32 u = 0; u < W; u++) {
-            rotated->image[u][destCol] = srcRow[u];
-        }
+    const uint32 W = src->width, H = src->height;
+    const int swap = (t & IMAGE_TRANSPOSE) != 0;
+    ReshapeImage(dst, swap ? H : W, swap ? W : H);
+
+    // Copia LUT com memcpy em vez de loop
+    dst->num_colors = ImageColors(src);
+    if (dst->num_colors > 0) {
+        const size_t lutBytes = (size_t)dst->num_colors * sizeof(rgb_t);
+        memcpy(dst->LUT, src->LUT, lutBytes);
     }
 
-    return rotated;
+    TransformKernel(dst, src, TransformMap(t, W, H));
 }
 
-
+/*------------------------------------------------------------------
+ * ImageRotate90CW
+ * Cria nova imagem rotacionada 90° no sentido horário.
+ *
+ * Mapeamento geométrico:
+ *     (v, u) → (u, height - 1 - v)
+ *
+ * Equivale a transpor e espelhar horizontalmente; é executada pelo
+ * kernel em blocos de ImageApplyTransform.
+ *
+ * Retorna imagem nova, sem alterar a original.
+ *-----------------------------------------------------------------*/
+Image ImageRotate90CW(const Image img) {
+    return ImageApplyTransform(img, IMAGE_ROTATE_90CW);
+}
 
 /*------------------------------------------------------------------
  * ImageRotate180CW
@@ -672,36 +2266,249 @@ Image ImageRotate90CW(const Image img) {
  * Mapeamento geométrico:
  *     (v, u) → (height - 1 - v, width - 1 - u)
  *
- * Copia a LUT em bloco e percorre a imagem de forma cache-friendly.
+ * Cada linha do destino é uma linha da fonte percorrida ao contrário.
  *
  * Retorna a versão rotacionada sem modificar a original.
  *-----------------------------------------------------------------*/
 Image ImageRotate180CW(const Image img) {
-    if (img == NULL) return NULL;
+    return ImageApplyTransform(img, IMAGE_ROTATE_180);
+}
 
-    const uint32 W = img->width, H = img->height;
+// Variantes que escrevem numa imagem existente
+void ImageRotate90CWInto(Image dst, const Image src) {
+    ImageApplyTransformInto(dst, src, IMAGE_ROTATE_90CW);
+}
+
+void ImageRotate180CWInto(Image dst, const Image src) {
+    ImageApplyTransformInto(dst, src, IMAGE_ROTATE_180);
+}
+
+/*------------------------------------------------------------------
+ * ImageRotate270CW
+ * Rotação de 270° no sentido horário (90° no sentido anti-horário).
+ *
+ * Mapeamento geométrico:
+ *     (v, u) → (width - 1 - u, v)
+ *
+ * Feita numa só passagem, sem as duas imagens intermédias que três
+ * rotações de 90° exigiriam.
+ *-----------------------------------------------------------------*/
+Image ImageRotate270CW(const Image img) {
+    return ImageApplyTransform(img, IMAGE_ROTATE_270CW);
+}
+
+/*------------------------------------------------------------------
+ * ImageFlipHorizontal / ImageFlipVertical / ImageTranspose
+ * Espelhos e transposição, todos sobre o mesmo kernel.
+ *
+ *     FlipHorizontal: (v, u) → (v, width - 1 - u)
+ *     FlipVertical:   (v, u) → (height - 1 - v, u)
+ *     Transpose:      (v, u) → (u, v)
+ *-----------------------------------------------------------------*/
+Image ImageFlipHorizontal(const Image img) {
+    return ImageApplyTransform(img, IMAGE_FLIP_H);
+}
+
+Image ImageFlipVertical(const Image img) {
+    return ImageApplyTransform(img, IMAGE_FLIP_V);
+}
+
+Image ImageTranspose(const Image img) {
+    return ImageApplyTransform(img, IMAGE_TRANSPOSE);
+}
+
+
+
+/*------------------------------------------------------------------
+ * ImageView — vistas preguiçosas
+ *
+ * Uma vista guarda a imagem fonte, uma orientação e um recorte, tudo
+ * resumido num único PixelMap (vista -> fonte). Criar, rodar ou
+ * recortar uma vista custa O(1): nenhum píxel é copiado.
+ *
+ * Gravar, comparar e segmentar leem a fonte linha a linha através de
+ * ViewRow; só ImageViewMaterialize aloca uma imagem nova.
+ *-----------------------------------------------------------------*/
 
-    Image rotated = ImageCreate(W, H);
-    if (rotated == NULL) return NULL;
+/// Create a view of img under transformation t.
+ImageView ImageViewCreate(const Image img, ImageTransform t) {
+    assert(img != NULL);
+    assert((unsigned)t <= IMAGE_TRANSVERSE);
 
-    // Copiar LUT com memcpy em vez de loop
-    rotated->num_colors = img->num_colors;
-    if (img->num_colors > 0) {
-        const size_t lutBytes = (size_t)img->num_colors * sizeof(rgb_t);
-        memcpy(rotated->LUT, img->LUT, lutBytes);
+    ImageView view = malloc(sizeof(struct imageView));
+    check(view != NULL, "malloc");
+
+    const int swap = (t & IMAGE_TRANSPOSE) != 0;
+    view->src = img;
+    view->width = swap ? img->height : img->width;
+    view->height = swap ? img->width : img->height;
+    view->map = TransformMap(t, img->width, img->height);
+
+    return view;
+}
+
+/// Destroy the view pointed to by (*viewp). The source image is kept.
+void ImageViewDestroy(ImageView* viewp) {
+    assert(viewp != NULL);
+    free(*viewp);
+    *viewp = NULL;
+}
+
+/// Further transform what the view shows.
+void ImageViewTransform(ImageView view, ImageTransform t) {
+    assert(view != NULL);
+    assert((unsigned)t <= IMAGE_TRANSVERSE);
+
+    // Compor os dois mapas afins: vista nova -> vista antiga -> fonte
+    const PixelMap m = view->map;
+    const PixelMap tm = TransformMap(t, view->width, view->height);
+    PixelMap r;
+    r.u0 = m.u0 + tm.u0 * m.dux + tm.v0 * m.duy;
+    r.v0 = m.v0 + tm.u0 * m.dvx + tm.v0 * m.dvy;
+    r.dux = tm.dux * m.dux + tm.dvx * m.duy;
+    r.dvx = tm.dux * m.dvx + tm.dvx * m.dvy;
+    r.duy = tm.duy * m.dux + tm.dvy * m.duy;
+    r.dvy = tm.duy * m.dvx + tm.dvy * m.dvy;
+    view->map = r;
+
+    if (t & IMAGE_TRANSPOSE) {
+        const uint32 tmp = view->width;
+        view->width = view->height;
+        view->height = tmp;
     }
+}
+
+/// Restrict the view to a rectangle given in view coordinates.
+void ImageViewCrop(ImageView view, uint32 u, uint32 v, uint32 width,
+                   uint32 height) {
+    assert(view != NULL);
+    assert(width > 0 && height > 0);
+    assert(u + width <= view->width);
+    assert(v + height <= view->height);
+
+    PixelMap* m = &view->map;
+    m->u0 += (int32_t)u * m->dux + (int32_t)v * m->duy;
+    m->v0 += (int32_t)u * m->dvx + (int32_t)v * m->dvy;
+    view->width = width;
+    view->height = height;
+}
+
+/// Get view width
+uint32 ImageViewWidth(const ImageView view) {
+    assert(view != NULL);
+    return view->width;
+}
+
+/// Get view height
+uint32 ImageViewHeight(const ImageView view) {
+    assert(view != NULL);
+    return view->height;
+}
+
+/// Get the label of pixel (u, v) of the view.
+uint16 ImageViewGetPixel(const ImageView view, int u, int v) {
+    assert(view != NULL);
+    assert(0 <= u && u < (int)view->width && 0 <= v && v < (int)view->height);
+
+    const PixelMap m = view->map;
+    return view->src->image[m.v0 + u * m.dvx + v * m.dvy]
+                           [m.u0 + u * m.dux + v * m.duy];
+}
+
+/*------------------------------------------------------------------
+ * ImageViewMaterialize
+ * Cria a imagem que a vista mostra, numa só passagem do kernel das
+ * transformações diedrais (qualquer recorte já está no mapa).
+ *
+ * Retorna imagem nova; a fonte não é alterada.
+ *-----------------------------------------------------------------*/
+Image ImageViewMaterialize(const ImageView view) {
+    assert(view != NULL);
+
+    const Image src = view->src;
+    Image result = ImageCreate(view->width, view->height);
+
+    result->num_colors = ImageColors(src);
+    memcpy(result->LUT, src->LUT, (size_t)result->num_colors * sizeof(rgb_t));
+
+    TransformKernel(result, src, view->map);
+
+    return result;
+}
+
+/*------------------------------------------------------------------
+ * ImageViewIsEqual
+ * Compara o que a vista mostra com uma imagem, tal como ImageIsEqual,
+ * mas lendo a fonte pela vista (sem materializar).
+ *-----------------------------------------------------------------*/
+int ImageViewIsEqual(const ImageView view, const Image img) {
+    if (view == NULL || img == NULL) return 0;
 
-    // Cache de ponteiros de linha
+    const uint32 W = view->width, H = view->height;
+    if (W != img->width || H != img->height) return 0;
+    const uint16 colors = ImageColors(img);
+    if (ImageColors(view->src) != colors) return 0;
+
+    const size_t lutBytes = (size_t)colors * sizeof(rgb_t);
+    if (memcmp(view->src->LUT, img->LUT, lutBytes) != 0) return 0;
+
+    uint16 buf[W];
+    const size_t rowBytes = (size_t)W * sizeof(uint16);
     for (uint32 v = 0; v < H; v++) {
-        const uint16* srcRow = img->image[v];
-        uint16* destRow = rotated->image[H - 1 - v];
-        
-        for (uint32 u = 0; u < W; u++) {
-            destRow[W - 1 - u] = srcRow[u];
-        }
+        if (memcmp(ViewRow(view, v, buf), img->image[v], rowBytes) != 0)
+            return 0;
+    }
+    return 1;
+}
+
+/*------------------------------------------------------------------
+ * ImageViewSegmentation
+ * Segmenta a região da fonte visível na vista, sem a materializar.
+ *
+ * As regiões são descobertas pela ordem da vista, pelo que as cores
+ * coincidem com as de segmentar ImageViewMaterialize(view) (e os labels
+ * também, se a vista mostrar a fonte inteira). Os píxeis da fonte são
+ * rotulados no lugar; com recorte, o preenchimento fica confinado ao
+ * retângulo visível e os labels novos vêm a seguir aos já usados.
+ *
+ * Retorna o número de regiões encontradas.
+ *-----------------------------------------------------------------*/
+static int SegmentView(const struct imageView* view, FillingFunction fillFunct);
+
+int ImageViewSegmentation(ImageView view, FillingFunction fillFunct) {
+    if (view == NULL || fillFunct == NULL)
+        return 0;
+
+    const PixelMap m = view->map;
+    Image src = view->src;
+
+    // Retângulo da fonte coberto pela vista (cantos opostos da vista)
+    const int32_t uA = m.u0;
+    const int32_t vA = m.v0;
+    const int32_t uB = m.u0 + (int32_t)(view->width - 1) * m.dux +
+                       (int32_t)(view->height - 1) * m.duy;
+    const int32_t vB = m.v0 + (int32_t)(view->width - 1) * m.dvx +
+                       (int32_t)(view->height - 1) * m.dvy;
+    const uint32 ru = (uint32)(uA < uB ? uA : uB);
+    const uint32 rv = (uint32)(vA < vB ? vA : vB);
+    const uint32 rw = (uint32)abs(uB - uA) + 1;
+    const uint32 rh = (uint32)abs(vB - vA) + 1;
+
+    // Vista completa: segmentar a própria fonte
+    if (rw == src->width && rh == src->height) {
+        return SegmentView(view, fillFunct);
     }
 
-    return rotated;
+    // Recorte: sub-imagem que partilha as linhas e a LUT da fonte
+    struct imageView local = *view;
+    local.src = AllocateSubImage(src, ru, rv, rw, rh);
+    local.map.u0 -= (int32_t)ru;
+    local.map.v0 -= (int32_t)rv;
+
+    int regions = SegmentView(&local, fillFunct);
+
+    ImageDestroy(&local.src);
+    return regions;
 }
 
 
@@ -758,16 +2565,10 @@ int ImageRegionFillingRecursive(Image img, int u, int v, uint16 label) {
 
     // Se background == label, temos de criar um novo label
     if (background == label) {
-      uint16 newLabel = img->num_colors;
-
-    // Garantir que não excedemos a LUT
-    if (newLabel < FIXED_LUT_SIZE) {
-        // Criar nova cor baseada na cor original
-        img->LUT[newLabel] = GenerateNextColor(img->LUT[background]);
-        img->num_colors++;
-
-        label = newLabel;   // Usar este novo label no flood-fill
-      }
+        // Criar nova cor baseada na cor original (se a LUT não estiver cheia)
+        int newLabel = LUTAppendColor(img, GenerateNextColor(img->LUT[background]));
+        if (newLabel >= 0)
+            label = (uint16)newLabel;   // Usar este novo label no flood-fill
     }
 
 
@@ -789,6 +2590,8 @@ static int floodFillRecursive(Image img, int u, int v, uint16 background, uint16
     if (!ImageIsValidPixel(img, u, v))
         return 0;
 
+    COUNT_NEIGHBOR(1);
+
     // Parar se o pixel não tiver a cor de fundo (background)
     if (img->image[v][u] != background)
         return 0;
@@ -810,10 +2613,56 @@ static int floodFillRecursive(Image img, int u, int v, uint16 background, uint16
 
 
 /*------------------------------------------------------------------
- * ImageRegionFillingWithSTACK
- * Versão iterativa do Flood Fill, substituindo recursion por uma STACK.
- *
- * Vantagens:
+ * Buffers de trabalho por thread (ver ImageScratchEnable)
+ * Com os buffers ativos, as versões com STACK e QUEUE reutilizam a mesma
+ * pilha / fila em todas as chamadas da thread, em vez de alocarem uma
+ * nova por região. Sem eles, cada chamada aloca e liberta a sua.
+ *-----------------------------------------------------------------*/
+static _Thread_local int scratchEnabled = 0;
+static _Thread_local Stack* scratchStack = NULL;
+static _Thread_local Queue* scratchQueue = NULL;
+
+void ImageScratchEnable(void) { scratchEnabled = 1; }
+
+void ImageScratchRelease(void) {
+    if (scratchStack != NULL) StackDestroy(&scratchStack);
+    if (scratchQueue != NULL) QueueDestroy(&scratchQueue);
+    scratchEnabled = 0;
+}
+
+static Stack* AcquireStack(uint32 size) {
+    if (!scratchEnabled) return StackCreate(size);
+    if (scratchStack == NULL)
+        scratchStack = StackCreate(size);
+    else
+        StackClear(scratchStack);
+    return scratchStack;
+}
+
+static void ReleaseStack(Stack** stackp) {
+    if (*stackp == scratchStack) *stackp = NULL;  // fica para a próxima
+    else StackDestroy(stackp);
+}
+
+static Queue* AcquireQueue(uint32 size) {
+    if (!scratchEnabled) return QueueCreate(size);
+    if (scratchQueue == NULL)
+        scratchQueue = QueueCreate(size);
+    else
+        QueueClear(scratchQueue);
+    return scratchQueue;
+}
+
+static void ReleaseQueue(Queue** queuep) {
+    if (*queuep == scratchQueue) *queuep = NULL;
+    else QueueDestroy(queuep);
+}
+
+/*------------------------------------------------------------------
+ * ImageRegionFillingWithSTACK
+ * Versão iterativa do Flood Fill, substituindo recursion por uma STACK.
+ *
+ * Vantagens:
  *   - evita stack overflow
  *   - controla a expansão manualmente
  *   - marca píxeis logo ao empilhar para evitar duplicações
@@ -829,22 +2678,16 @@ int ImageRegionFillingWithSTACK(Image img, int u, int v, uint16 label) {
     const uint16 background = img->image[v][u];
     // Se background == label, temos de criar um novo label
     if (background == label) {
-      uint16 newLabel = img->num_colors;
-
-    // Garantir que não excedemos a LUT
-    if (newLabel < FIXED_LUT_SIZE) {
-        // Criar nova cor baseada na cor original
-        img->LUT[newLabel] = GenerateNextColor(img->LUT[background]);
-        img->num_colors++;
-
-        label = newLabel;   // Usar este novo label no flood-fill
-      }
+        // Criar nova cor baseada na cor original (se a LUT não estiver cheia)
+        int newLabel = LUTAppendColor(img, GenerateNextColor(img->LUT[background]));
+        if (newLabel >= 0)
+            label = (uint16)newLabel;   // Usar este novo label no flood-fill
     }
 
     if (background == label) return 0;
 
     const uint32 initialSize = (img->width * img->height) / 100;
-    Stack* stack = StackCreate(initialSize > 100 ? initialSize : 100);
+    Stack* stack = AcquireStack(initialSize > 100 ? initialSize : 100);
     if (!stack) return 0;
 
     int count = 0;
@@ -853,19 +2696,23 @@ int ImageRegionFillingWithSTACK(Image img, int u, int v, uint16 label) {
 
     img->image[v][u] = label;
     count++;
+    COUNT_PUSH(1);
     StackPush(stack, (PixelCoords){u, v});
 
     while (!StackIsEmpty(stack)) {
         PixelCoords p = StackPop(stack);
+        COUNT_POP(1);
         const int32_t x = p.u, y = p.v;
 
         // Usar ponteiro direto para reduzir indireções
         // Direita
         if (x + 1 < W) {
             uint16* pixel = &img->image[y][x + 1];
+            COUNT_NEIGHBOR(1);
             if (*pixel == background) {
                 *pixel = label;
                 count++;
+                COUNT_PUSH(1);
                 StackPush(stack, (PixelCoords){x + 1, y});
             }
         }
@@ -873,9 +2720,11 @@ int ImageRegionFillingWithSTACK(Image img, int u, int v, uint16 label) {
         // Esquerda
         if (x > 0) {
             uint16* pixel = &img->image[y][x - 1];
+            COUNT_NEIGHBOR(1);
             if (*pixel == background) {
                 *pixel = label;
                 count++;
+                COUNT_PUSH(1);
                 StackPush(stack, (PixelCoords){x - 1, y});
             }
         }
@@ -883,9 +2732,11 @@ int ImageRegionFillingWithSTACK(Image img, int u, int v, uint16 label) {
         // Baixo
         if (y + 1 < H) {
             uint16* pixel = &img->image[y + 1][x];
+            COUNT_NEIGHBOR(1);
             if (*pixel == background) {
                 *pixel = label;
                 count++;
+                COUNT_PUSH(1);
                 StackPush(stack, (PixelCoords){x, y + 1});
             }
         }
@@ -893,15 +2744,18 @@ int ImageRegionFillingWithSTACK(Image img, int u, int v, uint16 label) {
         // Cima
         if (y > 0) {
             uint16* pixel = &img->image[y - 1][x];
+            COUNT_NEIGHBOR(1);
             if (*pixel == background) {
                 *pixel = label;
                 count++;
+                COUNT_PUSH(1);
                 StackPush(stack, (PixelCoords){x, y - 1});
             }
         }
     }
 
-    StackDestroy(&stack);
+    INSTR_HIGH_WATER(HIGH_FRONTIER, StackPeakSize(stack));
+    ReleaseStack(&stack);
     return count;
 }
 
@@ -925,22 +2779,16 @@ int ImageRegionFillingWithQUEUE(Image img, int u, int v, uint16 label) {
     const uint16 background = img->image[v][u];
     // Se background == label, temos de criar um novo label
     if (background == label) {
-    uint16 newLabel = img->num_colors;
-
-    // Garantir que não excedemos a LUT
-    if (newLabel < FIXED_LUT_SIZE) {
-        // Criar nova cor baseada na cor original
-        img->LUT[newLabel] = GenerateNextColor(img->LUT[background]);
-        img->num_colors++;
-
-        label = newLabel;   // Usar este novo label no flood-fill
-      }
+        // Criar nova cor baseada na cor original (se a LUT não estiver cheia)
+        int newLabel = LUTAppendColor(img, GenerateNextColor(img->LUT[background]));
+        if (newLabel >= 0)
+            label = (uint16)newLabel;   // Usar este novo label no flood-fill
     }
 
     if (background == label) return 0;
 
     const uint32 initialSize = (img->width * img->height) / 100;
-    Queue* queue = QueueCreate(initialSize > 100 ? initialSize : 100);
+    Queue* queue = AcquireQueue(initialSize > 100 ? initialSize : 100);
     if (!queue) return 0;
 
     int count = 0;
@@ -949,19 +2797,23 @@ int ImageRegionFillingWithQUEUE(Image img, int u, int v, uint16 label) {
 
     img->image[v][u] = label;
     count++;
+    COUNT_PUSH(1);
     QueueEnqueue(queue, (PixelCoords){u, v});
 
     while (!QueueIsEmpty(queue)) {
         PixelCoords p = QueueDequeue(queue);
+        COUNT_POP(1);
         const int32_t x = p.u, y = p.v;
 
         // Usar ponteiro direto
         // Direita
         if (x + 1 < W) {
             uint16* pixel = &img->image[y][x + 1];
+            COUNT_NEIGHBOR(1);
             if (*pixel == background) {
                 *pixel = label;
                 count++;
+                COUNT_PUSH(1);
                 QueueEnqueue(queue, (PixelCoords){x + 1, y});
             }
         }
@@ -969,9 +2821,11 @@ int ImageRegionFillingWithQUEUE(Image img, int u, int v, uint16 label) {
         // Esquerda
         if (x > 0) {
             uint16* pixel = &img->image[y][x - 1];
+            COUNT_NEIGHBOR(1);
             if (*pixel == background) {
                 *pixel = label;
                 count++;
+                COUNT_PUSH(1);
                 QueueEnqueue(queue, (PixelCoords){x - 1, y});
             }
         }
@@ -979,9 +2833,11 @@ int ImageRegionFillingWithQUEUE(Image img, int u, int v, uint16 label) {
         // Baixo
         if (y + 1 < H) {
             uint16* pixel = &img->image[y + 1][x];
+            COUNT_NEIGHBOR(1);
             if (*pixel == background) {
                 *pixel = label;
                 count++;
+                COUNT_PUSH(1);
                 QueueEnqueue(queue, (PixelCoords){x, y + 1});
             }
         }
@@ -989,44 +2845,392 @@ int ImageRegionFillingWithQUEUE(Image img, int u, int v, uint16 label) {
         // Cima
         if (y > 0) {
             uint16* pixel = &img->image[y - 1][x];
+            COUNT_NEIGHBOR(1);
             if (*pixel == background) {
                 *pixel = label;
                 count++;
+                COUNT_PUSH(1);
                 QueueEnqueue(queue, (PixelCoords){x, y - 1});
             }
         }
     }
 
-    QueueDestroy(&queue);
+    INSTR_HIGH_WATER(HIGH_FRONTIER, QueuePeakSize(queue));
+    ReleaseQueue(&queue);
     return count;
 }
 
 
 
 /*------------------------------------------------------------------
- * ImageSegmentation
- * Percorre toda a imagem e identifica todas as regiões conexas
- * compostas por WHITE ou BLACK.
+ * ImageRegionFillingWithDistances
+ * BFS com QUEUE a partir de várias sementes, que regista ao mesmo tempo
+ * a distância geodésica (em passos de 4-vizinhança) de cada pixel
+ * preenchido à semente mais próxima.
  *
- * Etapas:
- *   1) normaliza LUT e a imagem (0 = branco, 1 = preto)
- *   2) para cada novo pixel branco/preto não visitado:
- *         - gera cor nova
- *         - atribui label novo
- *         - chama função de preenchimento (via ponteiro)
+ * Todas as sementes entram na fila com distância 0; como a BFS expande
+ * por ordem de distância, o primeiro a marcar um pixel é sempre um
+ * caminho mínimo: dist[vizinho] = dist[pixel] + 1.
  *
- * O algoritmo é modular e suporta as 3 variantes de Flood Fill.
+ * O fundo é a cor da primeira semente válida; sementes fora da imagem
+ * ou de outra cor são ignoradas.
+ *-----------------------------------------------------------------*/
+int ImageRegionFillingWithDistances(Image img, int n, const int us[],
+                                    const int vs[], uint16 label,
+                                    uint32* dist) {
+    assert(n >= 0);
+    assert(n == 0 || (us != NULL && vs != NULL));
+
+    const int32_t W = (int32_t)img->width;
+    const int32_t H = (int32_t)img->height;
+
+    // Por omissão, nenhum pixel foi alcançado
+    if (dist != NULL)
+        memset(dist, 0xFF, (size_t)W * H * sizeof(uint32));
+
+    int first = 0;
+    while (first < n && !ImageIsValidPixel(img, us[first], vs[first])) first++;
+    if (first == n) return 0;
+
+    const uint16 background = img->image[vs[first]][us[first]];
+    // Se background == label, temos de criar um novo label
+    if (background == label) {
+        int newLabel = LUTAppendColor(img, GenerateNextColor(img->LUT[background]));
+        if (newLabel >= 0)
+            label = (uint16)newLabel;
+    }
+
+    if (background == label) return 0;
+
+    const uint32 initialSize = (img->width * img->height) / 100;
+    Queue* queue = AcquireQueue(initialSize > 100 ? initialSize : 100);
+    if (!queue) return 0;
+
+    int count = 0;
+
+    // Todas as sementes (distintas) à distância 0
+    for (int i = first; i < n; i++) {
+        const int32_t x = us[i], y = vs[i];
+        if (!ImageIsValidPixel(img, x, y) || img->image[y][x] != background)
+            continue;
+        img->image[y][x] = label;
+        if (dist != NULL) dist[(size_t)y * W + x] = 0;
+        count++;
+        COUNT_PUSH(1);
+        QueueEnqueue(queue, (PixelCoords){x, y});
+    }
+
+    // Vizinhos pela mesma ordem das outras versões
+    static const int dx[4] = {1, -1, 0, 0};
+    static const int dy[4] = {0, 0, 1, -1};
+
+    while (!QueueIsEmpty(queue)) {
+        PixelCoords p = QueueDequeue(queue);
+        COUNT_POP(1);
+        const int32_t x = p.u, y = p.v;
+        const uint32 d = (dist != NULL) ? dist[(size_t)y * W + x] + 1 : 0;
+
+        for (int k = 0; k < 4; k++) {
+            const int32_t nx = x + dx[k], ny = y + dy[k];
+            if (nx < 0 || nx >= W || ny < 0 || ny >= H) continue;
+            uint16* pixel = &img->image[ny][nx];
+            COUNT_NEIGHBOR(1);
+            if (*pixel == background) {
+                *pixel = label;
+                if (dist != NULL) dist[(size_t)ny * W + nx] = d;
+                count++;
+                COUNT_PUSH(1);
+                QueueEnqueue(queue, (PixelCoords){nx, ny});
+            }
+        }
+    }
+
+    INSTR_HIGH_WATER(HIGH_FRONTIER, QueuePeakSize(queue));
+    ReleaseQueue(&queue);
+    return count;
+}
+
+
+/*------------------------------------------------------------------
+ * ImageRegionFillingParallel
+ * BFS por níveis repartida por várias threads.
  *
- * Retorna o número de regiões encontradas.
+ * Cada nível da fronteira é dividido em blocos de PAR_CHUNK píxeis que
+ * as threads vão reclamando (incremento atómico) até se esgotarem, pelo
+ * que nenhuma fica parada enquanto houver trabalho no nível. Um pixel é
+ * reclamado com um compare-and-swap background -> label: só a thread
+ * que ganha o CAS o conta e o põe na sua fronteira seguinte. Entre
+ * níveis as threads esperam numa barreira.
+ *
+ * Enquanto a fronteira tem menos de PAR_MIN_FRONTIER píxeis o nível é
+ * expandido só pela thread que chama (sem CAS nem barreiras), e as
+ * outras threads só são criadas no primeiro nível grande.
+ *
+ * Preenche exatamente os mesmos píxeis que a versão com QUEUE.
  *-----------------------------------------------------------------*/
-int ImageSegmentation(Image img, FillingFunction fillFunct) {
-    if (img == NULL || fillFunct == NULL)
-        return 0;
+#define PAR_MIN_FRONTIER 4096
+#define PAR_CHUNK 256
+
+// Barreira reutilizável (pthread_barrier_t não existe em macOS)
+struct fillBarrier {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    int n, waiting;
+    unsigned long generation;
+};
+
+static void BarrierWait(struct fillBarrier* b) {
+    pthread_mutex_lock(&b->lock);
+    unsigned long generation = b->generation;
+    if (++b->waiting == b->n) {
+        b->waiting = 0;
+        b->generation++;
+        pthread_cond_broadcast(&b->cond);
+    } else {
+        while (generation == b->generation)
+            pthread_cond_wait(&b->cond, &b->lock);
+    }
+    pthread_mutex_unlock(&b->lock);
+}
+
+// Fronteira de uma thread: array de coordenadas que cresce para o dobro
+struct fillBuffer {
+    PixelCoords* data;
+    size_t size, cap;
+};
+
+static void BufferReserve(struct fillBuffer* b, size_t n) {
+    if (n <= b->cap) return;
+    size_t cap = b->cap > 0 ? b->cap : 1024;
+    while (cap < n) cap *= 2;
+    PixelCoords* data = realloc(b->data, cap * sizeof(PixelCoords));
+    check(data != NULL, "realloc");
+    INSTR_MEM_REALLOC(PIXELCOORDS_MEM, b->cap * sizeof(PixelCoords),
+                      cap * sizeof(PixelCoords));
+    b->data = data;
+    b->cap = cap;
+}
+
+static void BufferFree(struct fillBuffer* b) {
+    INSTR_MEM_FREE(PIXELCOORDS_MEM, b->cap * sizeof(PixelCoords));
+    free(b->data);
+}
+
+// Estado partilhado por todas as threads de um preenchimento
+struct parallelFill {
+    Image img;
+    uint16 background, label;
+    int32_t W, H;
+    const PixelCoords* cur;     // nível atual
+    size_t curSize;
+    size_t nextChunk;           // próximo bloco a reclamar (atómico)
+    int done;
+    struct fillBarrier barrier;
+};
+
+// Estado de cada thread. O nível seguinte e a contagem são mantidos em
+// variáveis locais de ParLevel e só escritos aqui no fim do nível, para
+// que as threads não escrevam nas mesmas linhas de cache.
+struct parWorker {
+    struct parallelFill* fill;
+    pthread_t thread;
+    struct fillBuffer next;     // nível seguinte desta thread
+    long count;                 // píxeis preenchidos por esta thread
+};
+
+// Reclama o pixel (x, y) e junta-o à fronteira seguinte b.
+// shared: outras threads estão a expandir o mesmo nível.
+static inline void ParClaim(struct parallelFill* f, struct fillBuffer* b,
+                            long* count, int32_t x, int32_t y, int shared) {
+    uint16* pixel = &f->img->image[y][x];
+    COUNT_NEIGHBOR(1);
+    if (shared) {
+        uint16 expected = f->background;
+        if (__atomic_load_n(pixel, __ATOMIC_RELAXED) != expected) return;
+        if (!__atomic_compare_exchange_n(pixel, &expected, f->label, 0,
+                                         __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+            return;
+    } else {
+        if (*pixel != f->background) return;
+        *pixel = f->label;
+    }
+    (*count)++;
+    COUNT_PUSH(1);
+    if (b->size == b->cap) BufferReserve(b, b->size + 1);
+    b->data[b->size++] = (PixelCoords){x, y};
+}
+
+static void ParExpand(struct parallelFill* f, struct fillBuffer* b,
+                      long* count, size_t begin, size_t end, int shared) {
+    for (size_t i = begin; i < end; i++) {
+        const int32_t x = f->cur[i].u, y = f->cur[i].v;
+        COUNT_POP(1);
+        if (x + 1 < f->W) ParClaim(f, b, count, x + 1, y, shared);  // direita
+        if (x > 0) ParClaim(f, b, count, x - 1, y, shared);         // esquerda
+        if (y + 1 < f->H) ParClaim(f, b, count, x, y + 1, shared);  // baixo
+        if (y > 0) ParClaim(f, b, count, x, y - 1, shared);         // cima
+    }
+}
+
+// Expande blocos do nível atual até não sobrar nenhum
+static void ParLevel(struct parallelFill* f, struct parWorker* w) {
+    struct fillBuffer next = w->next;
+    long count = 0;
+    for (;;) {
+        size_t begin = __atomic_fetch_add(&f->nextChunk, PAR_CHUNK,
+                                          __ATOMIC_RELAXED);
+        if (begin >= f->curSize) break;
+        size_t end = begin + PAR_CHUNK < f->curSize ? begin + PAR_CHUNK
+                                                     : f->curSize;
+        ParExpand(f, &next, &count, begin, end, 1);
+    }
+    // Publicados antes da barreira de fim de nível
+    w->next = next;
+    w->count += count;
+}
+
+static void* ParWorker(void* arg) {
+    struct parWorker* w = arg;
+    struct parallelFill* f = w->fill;
+    // Com o registo cheio (p.ex., dentro de muitas threads de lote) a
+    // thread corre sem registo; as contagens juntam-se no fim
+    InstrThreadTryRegister("fill");
+    for (;;) {
+        BarrierWait(&f->barrier);   // início de um nível (ou fim)
+        if (f->done) break;
+        ParLevel(f, w);
+        BarrierWait(&f->barrier);   // fim do nível
+    }
+    InstrThreadUnregister();
+    return NULL;
+}
+
+int ImageRegionFillingParallel(Image img, int u, int v, uint16 label) {
+    return ImageRegionFillingParallelN(img, u, v, label, 0);
+}
+
+int ImageRegionFillingParallelN(Image img, int u, int v, uint16 label,
+                                int threads) {
+    assert(threads >= 0);
+    if (!ImageIsValidPixel(img, u, v)) return 0;
+
+    const uint16 background = img->image[v][u];
+    // Se background == label, temos de criar um novo label
+    if (background == label) {
+        int newLabel = LUTAppendColor(img, GenerateNextColor(img->LUT[background]));
+        if (newLabel >= 0)
+            label = (uint16)newLabel;
+    }
+
+    if (background == label) return 0;
+
+    if (threads == 0) {
+        long n = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = n > 0 ? (int)n : 1;
+    }
+
+    struct parallelFill f = {
+        .img = img, .background = background, .label = label,
+        .W = (int32_t)img->width, .H = (int32_t)img->height,
+    };
+    struct parWorker* workers = calloc(threads, sizeof(struct parWorker));
+    check(workers != NULL, "calloc");
+    int started = 0;
+
+    struct fillBuffer cur = {NULL, 0, 0};
+    BufferReserve(&cur, 1);
+    img->image[v][u] = label;
+    workers[0].count = 1;
+    COUNT_PUSH(1);
+    cur.data[cur.size++] = (PixelCoords){u, v};
+    size_t peak = 1;
+
+    while (cur.size > 0) {
+        f.cur = cur.data;
+        f.curSize = cur.size;
+        if (threads == 1 || cur.size < PAR_MIN_FRONTIER) {
+            ParExpand(&f, &workers[0].next, &workers[0].count, 0, cur.size,
+                      0);
+        } else {
+            if (!started) {
+                pthread_mutex_init(&f.barrier.lock, NULL);
+                pthread_cond_init(&f.barrier.cond, NULL);
+                f.barrier.n = threads;
+                for (int t = 1; t < threads; t++) {
+                    workers[t].fill = &f;
+                    check(pthread_create(&workers[t].thread, NULL, ParWorker,
+                                         &workers[t]) == 0, "pthread_create");
+                }
+                started = 1;
+            }
+            f.nextChunk = 0;
+            BarrierWait(&f.barrier);
+            ParLevel(&f, &workers[0]);
+            BarrierWait(&f.barrier);
+        }
+
+        // O nível seguinte é a junção das fronteiras de todas as threads
+        size_t size = 0;
+        for (int t = 0; t < threads; t++) size += workers[t].next.size;
+        BufferReserve(&cur, size);
+        cur.size = 0;
+        for (int t = 0; t < threads; t++) {
+            struct fillBuffer* next = &workers[t].next;
+            if (next->size == 0) continue;  // data pode ser NULL
+            memcpy(cur.data + cur.size, next->data,
+                   next->size * sizeof(PixelCoords));
+            cur.size += next->size;
+            next->size = 0;
+        }
+        if (cur.size > peak) peak = cur.size;
+    }
+
+    if (started) {
+        f.done = 1;
+        BarrierWait(&f.barrier);
+        for (int t = 1; t < threads; t++) pthread_join(workers[t].thread, NULL);
+        pthread_cond_destroy(&f.barrier.cond);
+        pthread_mutex_destroy(&f.barrier.lock);
+    }
+
+    long count = 0;
+    for (int t = 0; t < threads; t++) {
+        count += workers[t].count;
+        BufferFree(&workers[t].next);
+    }
+    BufferFree(&cur);
+    free(workers);
+    INSTR_HIGH_WATER(HIGH_FRONTIER, peak);
+    return (int)count;
+}
+
+
+/*------------------------------------------------------------------
+ * SegmentView (auxiliar)
+ * Núcleo da segmentação, partilhado por ImageSegmentation e
+ * ImageViewSegmentation. Os píxeis de view->src são normalizados e
+ * depois percorridos pela ordem da vista (linha a linha da vista);
+ * cada região nova recebe o label seguinte.
+ *
+ * Numa imagem que é dona da LUT esta é reiniciada (só BRANCO e PRETO);
+ * numa sub-imagem os labels existentes são mantidos e os novos são
+ * reservados no dono com LUTNewLabel, para não invalidar os píxeis fora
+ * da região e para que sub-imagens disjuntas possam ser segmentadas em
+ * threads diferentes.
+ *-----------------------------------------------------------------*/
+static int SegmentView(const struct imageView* view, FillingFunction fillFunct) {
+    Image img = view->src;
+
+    InstrRegionBegin("segmentation");
+    InstrRegionBegin("normalize");
 
     // Normalização: garante 0 = branco, 1 = preto)
-    img->LUT[WHITE] = 0xFFFFFF;  // label 0
-    img->LUT[BLACK] = 0x000000;  // label 1
-    img->num_colors = 2;
+    // (a LUT partilhada de uma sub-imagem já os tem desde a criação)
+    if (img->parent == NULL) {
+        img->LUT[WHITE] = 0xFFFFFF;  // label 0
+        img->LUT[BLACK] = 0x000000;  // label 1
+        img->num_colors = 2;
+    }
 
     // Limpar qualquer pixel com labels lixo (>1)
     for (uint32 v = 0; v < img->height; v++) {
@@ -1037,21 +3241,24 @@ int ImageSegmentation(Image img, FillingFunction fillFunct) {
         }
     }
 
+    InstrRegionEnd();
+
     // Começar segmentação
-    uint16 currentLabel = 2;
+    InstrRegionBegin("label");
     rgb_t currentColor = 0x000000;  // GenerateNextColor() vai avançar daqui
     int regionCount = 0;
+    int full = 0;  // LUT cheia
 
-    const uint32 W = img->width;
-    const uint32 H = img->height;
+    const PixelMap m = view->map;
 
-    // segmentação
-    for (uint32 v = 0; v < H; v++) {
-        uint16 *row = img->image[v];
+    // segmentação, pela ordem da vista
+    for (uint32 y = 0; y < view->height && !full; y++) {
+        int32_t u = m.u0 + (int32_t)y * m.duy;
+        int32_t v = m.v0 + (int32_t)y * m.dvy;
 
-        for (uint32 u = 0; u < W; u++) {
+        for (uint32 x = 0; x < view->width; x++, u += m.dux, v += m.dvx) {
 
-            uint16 px = row[u];
+            uint16 px = img->image[v][u];
 
             // Só segmentamos os dois labels originais:
             // WHITE (0) e BLACK (1)
@@ -1059,25 +3266,50 @@ int ImageSegmentation(Image img, FillingFunction fillFunct) {
             if (px != WHITE && px != BLACK)
                 continue;
 
-            if (currentLabel >= FIXED_LUT_SIZE)
-                return regionCount;
-
             // Nova cor única para esta região
             currentColor = GenerateNextColor(currentColor);
-            img->LUT[currentLabel] = currentColor;
-            img->num_colors = currentLabel + 1;
+            const int label = LUTNewLabel(img, currentColor);
+            if (label < 0) {
+                full = 1;
+                break;
+            }
 
             // Flood fill com o novo label
-            fillFunct(img, u, v, currentLabel);
+            fillFunct(img, u, v, (uint16)label);
 
             regionCount++;
-            currentLabel++;
         }
     }
 
+    InstrRegionEnd();
+    InstrRegionEnd();
     return regionCount;
 }
 
+/*------------------------------------------------------------------
+ * ImageSegmentation
+ * Percorre toda a imagem e identifica todas as regiões conexas
+ * compostas por WHITE ou BLACK.
+ *
+ * Etapas:
+ *   1) normaliza LUT e a imagem (0 = branco, 1 = preto)
+ *   2) para cada novo pixel branco/preto não visitado:
+ *         - gera cor nova
+ *         - atribui label novo
+ *         - chama função de preenchimento (via ponteiro)
+ *
+ * O algoritmo é modular e suporta as 3 variantes de Flood Fill.
+ *
+ * Retorna o número de regiões encontradas.
+ *-----------------------------------------------------------------*/
+int ImageSegmentation(Image img, FillingFunction fillFunct) {
+    if (img == NULL || fillFunct == NULL)
+        return 0;
+
+    struct imageView view = IdentityView(img);
+    return SegmentView(&view, fillFunct);
+}
+
 
 
 
@@ -1093,4 +3325,545 @@ void ImageSetPixel(Image img, int u, int v, uint16 label){
   if (ImageIsValidPixel(img, u, v)) {
       img->image[v][u] = label;
   }
-}
\ No newline at end of file
+}
+
+/// Run-length encoded images
+
+/*------------------------------------------------------------------
+ * Representação RLE
+ * Cada linha é uma sequência de runs (label, comprimento) que cobre a
+ * linha inteira; as runs de todas as linhas ficam num único array, e
+ * rowStart[v] indica onde começam as da linha v (rowStart[height] é o
+ * total). Runs vizinhas da mesma linha têm sempre labels diferentes.
+ *-----------------------------------------------------------------*/
+struct imageRun {
+  uint32 length;
+  uint16 label;
+};
+
+struct imageRLE {
+  uint32 width;
+  uint32 height;
+  uint16 num_colors;
+  rgb_t* LUT;              // FIXED_LUT_SIZE entradas, como em struct image
+  uint32* rowStart;        // height + 1 índices em runs
+  struct imageRun* runs;
+  uint32 numRuns;
+};
+
+// Bytes ocupados pelas runs e pelos índices das linhas
+static size_t RLERunBytes(const struct imageRLE* rle) {
+  return (size_t)rle->numRuns * sizeof(struct imageRun) +
+         ((size_t)rle->height + 1) * sizeof(uint32);
+}
+
+ImageRLE ImageRLEFromImage(const Image img) {
+  assert(img != NULL);
+  const uint32 W = img->width, H = img->height;
+
+  // 1.ª passagem: contar as runs, para alocar uma só vez
+  uint32 numRuns = 0;
+  for (uint32 v = 0; v < H; v++) {
+    const uint16* row = img->image[v];
+    numRuns++;
+    for (uint32 u = 1; u < W; u++) numRuns += row[u] != row[u - 1];
+  }
+  COUNT_PIXMEM((unsigned long)W * H);
+
+  ImageRLE rle = malloc(sizeof(struct imageRLE));
+  check(rle != NULL, "malloc");
+  rle->width = W;
+  rle->height = H;
+  rle->num_colors = ImageColors(img);
+  rle->numRuns = numRuns;
+  rle->LUT = malloc(FIXED_LUT_SIZE * sizeof(rgb_t));
+  rle->rowStart = malloc(((size_t)H + 1) * sizeof(uint32));
+  rle->runs = malloc((size_t)numRuns * sizeof(struct imageRun));
+  check(rle->LUT != NULL && rle->rowStart != NULL && rle->runs != NULL,
+        "malloc");
+  INSTR_MEM_ALLOC(MEM_IMAGES, sizeof(struct imageRLE) + RLERunBytes(rle));
+  INSTR_MEM_ALLOC(MEM_LUTS, FIXED_LUT_SIZE * sizeof(rgb_t));
+  memcpy(rle->LUT, img->LUT, rle->num_colors * sizeof(rgb_t));
+
+  // 2.ª passagem: gravar as runs
+  uint32 r = 0;
+  for (uint32 v = 0; v < H; v++) {
+    const uint16* row = img->image[v];
+    rle->rowStart[v] = r;
+    uint32 start = 0;
+    for (uint32 u = 1; u <= W; u++) {
+      if (u == W || row[u] != row[start]) {
+        rle->runs[r++] = (struct imageRun){u - start, row[start]};
+        start = u;
+      }
+    }
+  }
+  rle->rowStart[H] = r;
+  COUNT_PIXMEM((unsigned long)W * H);
+  return rle;
+}
+
+Image ImageRLEToImage(const ImageRLE rle) {
+  assert(rle != NULL);
+  Image img = CreateUninitialized(rle->width, rle->height);
+  img->num_colors = rle->num_colors;
+  memcpy(img->LUT, rle->LUT, rle->num_colors * sizeof(rgb_t));
+
+  for (uint32 v = 0; v < rle->height; v++) {
+    uint16* row = img->image[v];
+    for (uint32 r = rle->rowStart[v]; r < rle->rowStart[v + 1]; r++) {
+      FillRow(row, rle->runs[r].length, rle->runs[r].label);
+      row += rle->runs[r].length;
+    }
+  }
+  return img;
+}
+
+void ImageRLEDestroy(ImageRLE* rlep) {
+  assert(rlep != NULL);
+  ImageRLE rle = *rlep;
+  if (rle == NULL) return;
+  INSTR_MEM_FREE(MEM_IMAGES, sizeof(struct imageRLE) + RLERunBytes(rle));
+  INSTR_MEM_FREE(MEM_LUTS, FIXED_LUT_SIZE * sizeof(rgb_t));
+  free(rle->runs);
+  free(rle->rowStart);
+  free(rle->LUT);
+  free(rle);
+  *rlep = NULL;
+}
+
+uint32 ImageRLEWidth(const ImageRLE rle) { return rle->width; }
+
+uint32 ImageRLEHeight(const ImageRLE rle) { return rle->height; }
+
+uint32 ImageRLERuns(const ImageRLE rle) { return rle->numRuns; }
+
+size_t ImageRLEBytes(const ImageRLE rle) {
+  return sizeof(struct imageRLE) + RLERunBytes(rle) +
+         FIXED_LUT_SIZE * sizeof(rgb_t);
+}
+
+/*------------------------------------------------------------------
+ * Union-find sobre as runs
+ * A raiz de cada componente é sempre a run de menor índice, ou seja, a
+ * primeira run da região pela ordem das linhas.
+ *-----------------------------------------------------------------*/
+static uint32 RunFind(uint32* parent, uint32 r) {
+  while (parent[r] != r) {
+    parent[r] = parent[parent[r]];  // compressão por "halving"
+    r = parent[r];
+  }
+  return r;
+}
+
+static void RunUnion(uint32* parent, uint32 a, uint32 b) {
+  a = RunFind(parent, a);
+  b = RunFind(parent, b);
+  if (a < b) parent[b] = a;
+  else if (b < a) parent[a] = b;
+}
+
+/*------------------------------------------------------------------
+ * ImageRLESegmentation
+ * Segmentação por componentes conexas de runs (4-vizinhança):
+ *   1. normalizar: labels > 1 passam a PRETO, juntando runs vizinhas
+ *      que fiquem iguais;
+ *   2. unir cada run às runs da linha de cima com a mesma cor cujos
+ *      intervalos se sobreponham (duas sequências ordenadas: O(runs));
+ *   3. percorrer as runs por ordem: a raiz de cada componente recebe o
+ *      label seguinte e as outras runs o label da sua raiz.
+ *
+ * Como a raiz é a primeira run da região, os labels e as cores são os
+ * mesmos que ImageSegmentation atribui à imagem densa (incluindo o
+ * limite de FIXED_LUT_SIZE labels).
+ *-----------------------------------------------------------------*/
+int ImageRLESegmentation(ImageRLE rle) {
+  assert(rle != NULL);
+
+  InstrRegionBegin("segmentation");
+  InstrRegionBegin("normalize");
+
+  rle->LUT[WHITE] = 0xFFFFFF;
+  rle->LUT[BLACK] = 0x000000;
+  rle->num_colors = 2;
+
+  // Normalização, compactando as runs no próprio array
+  uint32 w = 0;
+  for (uint32 v = 0; v < rle->height; v++) {
+    const uint32 begin = rle->rowStart[v], end = rle->rowStart[v + 1];
+    rle->rowStart[v] = w;
+    for (uint32 r = begin; r < end; r++) {
+      struct imageRun run = rle->runs[r];
+      if (run.label != WHITE) run.label = BLACK;
+      if (w > rle->rowStart[v] && rle->runs[w - 1].label == run.label)
+        rle->runs[w - 1].length += run.length;
+      else
+        rle->runs[w++] = run;
+    }
+  }
+  rle->rowStart[rle->height] = w;
+  struct imageRun* runs =
+      realloc(rle->runs, (size_t)w * sizeof(struct imageRun));
+  check(runs != NULL, "realloc");
+  INSTR_MEM_FREE(MEM_IMAGES,
+                 (size_t)(rle->numRuns - w) * sizeof(struct imageRun));
+  rle->runs = runs;
+  rle->numRuns = w;
+
+  InstrRegionEnd();
+  InstrRegionBegin("label");
+
+  uint32* parent = malloc((size_t)rle->numRuns * sizeof(uint32));
+  check(parent != NULL || rle->numRuns == 0, "malloc");
+  INSTR_MEM_ALLOC(MEM_IMAGES, (size_t)rle->numRuns * sizeof(uint32));
+  for (uint32 r = 0; r < rle->numRuns; r++) parent[r] = r;
+
+  // Unir com as runs sobrepostas da linha de cima
+  for (uint32 v = 1; v < rle->height; v++) {
+    uint32 a = rle->rowStart[v - 1], aEnd = rle->rowStart[v];
+    uint32 b = rle->rowStart[v], bEnd = rle->rowStart[v + 1];
+    uint32 a0 = 0, b0 = 0;  // coluna onde começam as runs a e b
+    while (a < aEnd && b < bEnd) {
+      const uint32 a1 = a0 + rle->runs[a].length;
+      const uint32 b1 = b0 + rle->runs[b].length;
+      COUNT_NEIGHBOR(1);
+      if (rle->runs[a].label == rle->runs[b].label) RunUnion(parent, a, b);
+      // Avança a que acaba primeiro (ou ambas)
+      if (a1 <= b1) { a0 = a1; a++; }
+      if (b1 <= a1) { b0 = b1; b++; }
+    }
+  }
+
+  // Atribuir labels pela ordem das runs
+  uint16 currentLabel = 2;
+  rgb_t currentColor = 0x000000;
+  int regionCount = 0;
+  for (uint32 r = 0; r < rle->numRuns; r++) {
+    const uint32 root = RunFind(parent, r);
+    if (root != r) {
+      rle->runs[r].label = rle->runs[root].label;
+    } else if (currentLabel < FIXED_LUT_SIZE) {
+      currentColor = GenerateNextColor(currentColor);
+      rle->LUT[currentLabel] = currentColor;
+      rle->runs[r].label = currentLabel++;
+      regionCount++;
+    }
+    // Sem labels livres: a região fica com a cor normalizada
+  }
+  rle->num_colors = currentLabel;
+
+  INSTR_MEM_FREE(MEM_IMAGES, (size_t)rle->numRuns * sizeof(uint32));
+  free(parent);
+
+  InstrRegionEnd();
+  InstrRegionEnd();
+  return regionCount;
+}
+
+/// Tiled images
+
+/*------------------------------------------------------------------
+ * Imagens em ladrilhos (ver ImageTiled em imageRGB.h)
+ * Os píxeis são guardados em ladrilhos de TILE x TILE (8 x 8 labels,
+ * 128 bytes = 2 linhas de cache), com os ladrilhos por linhas e os
+ * píxeis de cada ladrilho também por linhas:
+ *
+ *   offset(x, y) = ((y / 8) * tilesX + x / 8) * 64 + (y % 8) * 8 + x % 8
+ *
+ * Numa imagem por linhas, os vizinhos (x, y ± 1) ficam a uma linha
+ * inteira de distância (outra linha de cache e, em imagens grandes,
+ * outra página). Aqui, 7 em cada 8 ficam no mesmo ladrilho, a 16 bytes.
+ * Os ladrilhos da última coluna/linha podem ter píxeis a mais (padding),
+ * que nunca são lidos.
+ *-----------------------------------------------------------------*/
+#define TILE 8
+#define TILE_SHIFT 3
+#define TILE_PIXELS (TILE * TILE)
+
+struct imageTiled {
+  uint32 width;
+  uint32 height;
+  uint32 tilesX;    // ladrilhos por linha de ladrilhos
+  uint32 tilesY;
+  uint16 num_colors;
+  rgb_t* LUT;       // FIXED_LUT_SIZE entradas, como em struct image
+  uint16* pixels;   // tilesX * tilesY ladrilhos de TILE_PIXELS labels
+};
+
+static inline size_t TiledOffset(const struct imageTiled* t, uint32 x,
+                                 uint32 y) {
+  return ((size_t)(y >> TILE_SHIFT) * t->tilesX + (x >> TILE_SHIFT)) *
+             TILE_PIXELS +
+         (y & (TILE - 1)) * TILE + (x & (TILE - 1));
+}
+
+// Bytes ocupados pelos ladrilhos
+static size_t TiledPixelBytes(const struct imageTiled* t) {
+  return (size_t)t->tilesX * t->tilesY * TILE_PIXELS * sizeof(uint16);
+}
+
+// Nova imagem em ladrilhos com píxeis por inicializar
+static ImageTiled TiledCreate(uint32 width, uint32 height) {
+  ImageTiled t = malloc(sizeof(struct imageTiled));
+  check(t != NULL, "malloc");
+  t->width = width;
+  t->height = height;
+  t->tilesX = (width + TILE - 1) / TILE;
+  t->tilesY = (height + TILE - 1) / TILE;
+  t->num_colors = 2;
+  t->LUT = malloc(FIXED_LUT_SIZE * sizeof(rgb_t));
+  // O padding fica a 0, para a imagem não ter memória por inicializar
+  t->pixels = calloc((size_t)t->tilesX * t->tilesY * TILE_PIXELS,
+                     sizeof(uint16));
+  check(t->LUT != NULL && t->pixels != NULL, "malloc");
+  INSTR_MEM_ALLOC(MEM_IMAGES, sizeof(struct imageTiled) + TiledPixelBytes(t));
+  INSTR_MEM_ALLOC(MEM_LUTS, FIXED_LUT_SIZE * sizeof(rgb_t));
+  return t;
+}
+
+ImageTiled ImageTiledFromImage(const Image img) {
+  assert(img != NULL);
+  ImageTiled t = TiledCreate(img->width, img->height);
+  t->num_colors = ImageColors(img);
+  memcpy(t->LUT, img->LUT, t->num_colors * sizeof(rgb_t));
+
+  // Cada linha da imagem dá uma linha de TILE píxeis em cada ladrilho
+  for (uint32 y = 0; y < img->height; y++) {
+    const uint16* row = img->image[y];
+    for (uint32 x = 0; x < img->width; x += TILE) {
+      uint32 n = img->width - x < TILE ? img->width - x : TILE;
+      memcpy(t->pixels + TiledOffset(t, x, y), row + x, n * sizeof(uint16));
+    }
+  }
+  COUNT_PIXMEM((unsigned long)img->width * img->height);
+  return t;
+}
+
+Image ImageTiledToImage(const ImageTiled t) {
+  assert(t != NULL);
+  Image img = CreateUninitialized(t->width, t->height);
+  img->num_colors = t->num_colors;
+  memcpy(img->LUT, t->LUT, t->num_colors * sizeof(rgb_t));
+
+  for (uint32 y = 0; y < t->height; y++) {
+    uint16* row = img->image[y];
+    for (uint32 x = 0; x < t->width; x += TILE) {
+      uint32 n = t->width - x < TILE ? t->width - x : TILE;
+      memcpy(row + x, t->pixels + TiledOffset(t, x, y), n * sizeof(uint16));
+    }
+  }
+  COUNT_PIXMEM((unsigned long)t->width * t->height);
+  return img;
+}
+
+void ImageTiledDestroy(ImageTiled* tp) {
+  assert(tp != NULL);
+  ImageTiled t = *tp;
+  if (t == NULL) return;
+  INSTR_MEM_FREE(MEM_IMAGES, sizeof(struct imageTiled) + TiledPixelBytes(t));
+  INSTR_MEM_FREE(MEM_LUTS, FIXED_LUT_SIZE * sizeof(rgb_t));
+  free(t->pixels);
+  free(t->LUT);
+  free(t);
+  *tp = NULL;
+}
+
+uint32 ImageTiledWidth(const ImageTiled t) { return t->width; }
+
+uint32 ImageTiledHeight(const ImageTiled t) { return t->height; }
+
+uint16 ImageTiledColors(const ImageTiled t) { return t->num_colors; }
+
+uint16 ImageTiledGetPixel(const ImageTiled t, int u, int v) {
+  assert(t != NULL);
+  assert(0 <= u && (uint32)u < t->width && 0 <= v && (uint32)v < t->height);
+  return t->pixels[TiledOffset(t, (uint32)u, (uint32)v)];
+}
+
+/*------------------------------------------------------------------
+ * Preenchimento com pilha, como ImageRegionFillingWithSTACK, mas com
+ * os píxeis em ladrilhos. A pilha guarda coordenadas; o endereço do
+ * pixel retirado é calculado uma vez, e o de cada vizinho obtém-se
+ * dele com um deslocamento: ±1 ou ±TILE dentro do ladrilho, ou o salto
+ * para o ladrilho ao lado (±TILE_PIXELS) ou de cima/baixo (±rowOfTiles).
+ *-----------------------------------------------------------------*/
+static int TiledFill(ImageTiled t, Stack* stack, int u, int v,
+                     uint16 background, uint16 label) {
+  const int32_t W = (int32_t)t->width;
+  const int32_t H = (int32_t)t->height;
+  const ptrdiff_t rowOfTiles = (ptrdiff_t)t->tilesX * TILE_PIXELS;
+  uint16* pixels = t->pixels;
+  int count = 1;
+
+  pixels[TiledOffset(t, u, v)] = label;
+  COUNT_PUSH(1);
+  StackPush(stack, (PixelCoords){u, v});
+
+  while (!StackIsEmpty(stack)) {
+    PixelCoords p = StackPop(stack);
+    COUNT_POP(1);
+    const int32_t x = p.u, y = p.v;
+    uint16* const pixel = pixels + TiledOffset(t, x, y);
+    const int32_t tx = x & (TILE - 1), ty = y & (TILE - 1);
+
+    // Direita
+    if (x + 1 < W) {
+      uint16* q = tx != TILE - 1 ? pixel + 1 : pixel + TILE_PIXELS - (TILE - 1);
+      COUNT_NEIGHBOR(1);
+      if (*q == background) {
+        *q = label;
+        count++;
+        COUNT_PUSH(1);
+        StackPush(stack, (PixelCoords){x + 1, y});
+      }
+    }
+
+    // Esquerda
+    if (x > 0) {
+      uint16* q = tx != 0 ? pixel - 1 : pixel - TILE_PIXELS + (TILE - 1);
+      COUNT_NEIGHBOR(1);
+      if (*q == background) {
+        *q = label;
+        count++;
+        COUNT_PUSH(1);
+        StackPush(stack, (PixelCoords){x - 1, y});
+      }
+    }
+
+    // Baixo
+    if (y + 1 < H) {
+      uint16* q = ty != TILE - 1 ? pixel + TILE
+                                 : pixel + rowOfTiles - (TILE - 1) * TILE;
+      COUNT_NEIGHBOR(1);
+      if (*q == background) {
+        *q = label;
+        count++;
+        COUNT_PUSH(1);
+        StackPush(stack, (PixelCoords){x, y + 1});
+      }
+    }
+
+    // Cima
+    if (y > 0) {
+      uint16* q = ty != 0 ? pixel - TILE
+                          : pixel - rowOfTiles + (TILE - 1) * TILE;
+      COUNT_NEIGHBOR(1);
+      if (*q == background) {
+        *q = label;
+        count++;
+        COUNT_PUSH(1);
+        StackPush(stack, (PixelCoords){x, y - 1});
+      }
+    }
+  }
+  return count;
+}
+
+int ImageTiledRegionFilling(ImageTiled t, int u, int v, uint16 label) {
+  assert(t != NULL);
+  if (u < 0 || (uint32)u >= t->width || v < 0 || (uint32)v >= t->height)
+    return 0;
+
+  const uint16 background = t->pixels[TiledOffset(t, u, v)];
+  // Se background == label, temos de criar um novo label
+  if (background == label && t->num_colors < FIXED_LUT_SIZE) {
+    t->LUT[t->num_colors] = GenerateNextColor(t->LUT[background]);
+    label = t->num_colors++;
+  }
+  if (background == label) return 0;
+
+  const uint32 initialSize = (t->width * t->height) / 100;
+  Stack* stack = AcquireStack(initialSize > 100 ? initialSize : 100);
+  int count = TiledFill(t, stack, u, v, background, label);
+  INSTR_HIGH_WATER(HIGH_FRONTIER, StackPeakSize(stack));
+  ReleaseStack(&stack);
+  return count;
+}
+
+/*------------------------------------------------------------------
+ * ImageTiledSegmentation
+ * A mesma normalização e a mesma ordem de varrimento (por linhas da
+ * imagem) que ImageSegmentation, por isso os labels e a LUT são os
+ * mesmos; só o preenchimento trabalha sobre os ladrilhos.
+ *-----------------------------------------------------------------*/
+int ImageTiledSegmentation(ImageTiled t) {
+  assert(t != NULL);
+  const uint32 W = t->width, H = t->height;
+
+  InstrRegionBegin("segmentation");
+  InstrRegionBegin("normalize");
+  t->LUT[WHITE] = 0xFFFFFF;
+  t->LUT[BLACK] = 0x000000;
+  t->num_colors = 2;
+  const size_t total = TiledPixelBytes(t) / sizeof(uint16);
+  // Sem ramos (o compilador vetoriza): o padding também fica normalizado
+  uint16* pixels = t->pixels;
+  for (size_t k = 0; k < total; k++) {
+    pixels[k] = pixels[k] != WHITE ? BLACK : WHITE;
+  }
+  InstrRegionEnd();
+
+  InstrRegionBegin("label");
+  const uint32 initialSize = (W * H) / 100;
+  Stack* stack = AcquireStack(initialSize > 100 ? initialSize : 100);
+  uint16 currentLabel = 2;
+  rgb_t currentColor = 0x000000;
+  int regionCount = 0;
+  for (uint32 y = 0; y < H && currentLabel < FIXED_LUT_SIZE; y++) {
+    for (uint32 x = 0; x < W; x++) {
+      const uint16 px = t->pixels[TiledOffset(t, x, y)];
+      if (px != WHITE && px != BLACK) continue;
+      if (currentLabel >= FIXED_LUT_SIZE) break;
+
+      currentColor = GenerateNextColor(currentColor);
+      t->LUT[currentLabel] = currentColor;
+      t->num_colors = currentLabel + 1;
+      TiledFill(t, stack, (int)x, (int)y, px, currentLabel);
+      regionCount++;
+      currentLabel++;
+    }
+  }
+  // A mesma pilha serve todas as regiões: o pico é o maior de todos
+  INSTR_HIGH_WATER(HIGH_FRONTIER, StackPeakSize(stack));
+  ReleaseStack(&stack);
+
+  InstrRegionEnd();
+  InstrRegionEnd();
+  return regionCount;
+}
+
+/*------------------------------------------------------------------
+ * ImageTiledRotate90CW
+ * Percorre os ladrilhos do destino; os TILE x TILE píxeis de cada um vêm
+ * de TILE linhas seguidas da origem, em no máximo dois ladrilhos de cada
+ * uma de duas colunas de ladrilhos, por isso origem e destino ficam
+ * ambos na cache. Destino (x, y) = origem (y, H - 1 - x): a parte do
+ * endereço na origem que depende de x (linha de origem) é calculada uma
+ * vez por ladrilho, e a que depende de y (coluna) uma vez por linha.
+ *-----------------------------------------------------------------*/
+ImageTiled ImageTiledRotate90CW(const ImageTiled t) {
+  assert(t != NULL);
+  const uint32 W = t->width, H = t->height;
+  ImageTiled out = TiledCreate(H, W);
+  out->num_colors = t->num_colors;
+  memcpy(out->LUT, t->LUT, t->num_colors * sizeof(rgb_t));
+
+  const size_t rowOfTiles = (size_t)t->tilesX * TILE_PIXELS;
+  size_t rowPart[TILE];
+  for (uint32 tx = 0; tx < out->tilesX; tx++) {
+    const uint32 n = out->width - tx * TILE < TILE ? out->width - tx * TILE
+                                                   : TILE;
+    for (uint32 xx = 0; xx < n; xx++) {
+      const uint32 sy = H - 1 - (tx * TILE + xx);
+      rowPart[xx] = (sy >> TILE_SHIFT) * rowOfTiles + (sy & (TILE - 1)) * TILE;
+    }
+    for (uint32 y = 0; y < out->height; y++) {
+      const uint16* src = t->pixels + (size_t)(y >> TILE_SHIFT) * TILE_PIXELS +
+                          (y & (TILE - 1));
+      uint16* dst = out->pixels + TiledOffset(out, tx * TILE, y);
+      for (uint32 xx = 0; xx < n; xx++) dst[xx] = src[rowPart[xx]];
+    }
+  }
+  COUNT_PIXMEM((unsigned long)W * H);
+  return out;
+}
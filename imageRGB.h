@@ -14,6 +14,7 @@
 #define IMAGERGB_H
 
 #include <inttypes.h>
+#include <stddef.h>
 
 // Types for non-negative integer values
 typedef uint8_t uint8;
@@ -60,6 +61,40 @@ Image ImageCreateChess(uint32 width, uint32 height, uint32 edge, rgb_t color);
 /// Create an image with a palete of generated colors.
 Image ImageCreatePalete(uint32 width, uint32 height, uint32 edge);
 
+/// Synthetic workloads for region filling and segmentation.
+///
+/// These generators produce BLACK patterns on a WHITE background, writing
+/// the pixel rows directly, so they are fast enough for very large
+/// (gigapixel) images.  They are deterministic: the same arguments (and
+/// seed) always give the same image.
+/// Requires: width and height must be positive.
+/// (The caller is responsible for destroying the returned image!)
+
+/// Create an image filled with a single color (a single huge region).
+Image ImageCreateSolid(uint32 width, uint32 height, rgb_t color);
+
+/// Create a serpentine maze: every odd row is a BLACK wall with a one-pixel
+/// gap, alternately at its right and left end, so the WHITE pixels form
+/// one corridor that zig-zags through the whole image.
+/// Worst case for recursion depth and for the frontier of depth-first fills.
+Image ImageCreateMaze(uint32 width, uint32 height);
+
+/// Create a square spiral: a one-pixel-wide WHITE corridor that winds from
+/// pixel (0, 0) towards the center, between one-pixel-wide BLACK walls.
+/// The image has exactly one WHITE region (and one BLACK one, if any).
+Image ImageCreateSpiral(uint32 width, uint32 height);
+
+/// Create random noise: each pixel is BLACK with probability density
+/// (0.0 to 1.0), independently, using a pseudo-random generator
+/// initialized with seed.
+Image ImageCreateNoise(uint32 width, uint32 height, double density,
+                       uint32 seed);
+
+/// Create concentric square rings, thickness pixels wide, alternately
+/// WHITE (outermost) and BLACK.  Each ring is a separate region, nested
+/// in the previous one.
+Image ImageCreateRings(uint32 width, uint32 height, uint32 thickness);
+
 /// Destroy the image pointed to by (*imgp).
 ///   imgp : address of an Image variable.
 /// If (*imgp)==NULL, no operation is performed.
@@ -67,6 +102,38 @@ Image ImageCreatePalete(uint32 width, uint32 height, uint32 edge);
 /// Ensures: (*imgp)==NULL.
 void ImageDestroy(Image* imgp);
 
+/// Image pool
+/// By default, every image is allocated on creation and freed by
+/// ImageDestroy. After ImagePoolEnable(maxBytes), ImageDestroy keeps images
+/// that own their pixels (not sub-images) in a pool keyed by dimensions, up
+/// to maxBytes in total, and creating an image with the same dimensions
+/// reuses one of them instead of allocating. ImageCreate still returns an
+/// all-WHITE image; functions that overwrite every pixel (copies,
+/// transforms, generators, loaders) skip the clearing.
+/// The pool is shared by all threads.
+typedef struct {
+  unsigned long hits;      // creations served from the pool
+  unsigned long misses;    // creations that had to allocate (pool enabled)
+  unsigned long returns;   // destroyed images kept in the pool
+  unsigned long rejected;  // destroyed images freed because the pool was full
+  unsigned long trimmed;   // pooled images freed by ImagePoolTrim
+  size_t images;           // images currently in the pool
+  size_t bytes;            // memory held by them
+  double hitRate;          // hits / (hits + misses), 0 if no requests
+} ImagePoolStats;
+
+/// Enable the pool with a capacity of maxBytes, or change its capacity
+/// (trimming it if needed). ImagePoolEnable(0) disables it and frees every
+/// pooled image.
+void ImagePoolEnable(size_t maxBytes);
+
+/// Free pooled images until the pool holds at most keepBytes.
+void ImagePoolTrim(size_t keepBytes);
+
+/// Get the pool counters (since the start or the last ImagePoolResetStats).
+void ImagePoolGetStats(ImagePoolStats* stats);
+void ImagePoolResetStats(void);
+
 /// Create a deep copy of the image pointed to by img.
 ///   img : address of an Image variable.
 ///
@@ -74,6 +141,40 @@ void ImageDestroy(Image* imgp);
 /// (The caller is responsible for destroying the returned image!)
 Image ImageCopy(const Image img);
 
+/// Destination-passing variants
+/// The ...Into functions write their result into an existing image dst
+/// instead of creating one. dst takes the dimensions, LUT and pixels of
+/// the result; its pixel storage is only reallocated when the dimensions
+/// change, so calling them in a loop with the same dst does no allocation.
+/// Requires: dst is not a sub-image, and src is neither dst nor one of
+/// its sub-images.
+
+/// Copy src into dst.
+void ImageCopyInto(Image dst, const Image src);
+
+/// Regions of interest
+
+/// Create a sub-image for the rectangle with top-left pixel (u, v)
+/// and the given dimensions. No pixels are copied: the sub-image shares
+/// the pixel rows and the LUT of img, so changes to one are seen in the
+/// other. Filling and segmentation applied to the sub-image stay inside
+/// the rectangle. Sub-images of sub-images are allowed.
+/// Requires: the rectangle lies inside img; img outlives the sub-image.
+/// New labels are taken from the shared LUT atomically, so disjoint
+/// sub-images of the same image may be filled or segmented by different
+/// threads (other concurrent uses of img are not safe).
+///
+/// (The caller is responsible for destroying the returned sub-image,
+/// which does not free the shared pixels!)
+Image ImageSubView(const Image img, uint32 u, uint32 v, uint32 width,
+                   uint32 height);
+
+/// Create an independent copy of the same rectangle (and of the LUT).
+/// Only the pixels inside the rectangle are read.
+/// (The caller is responsible for destroying the returned image!)
+Image ImageCrop(const Image img, uint32 u, uint32 v, uint32 width,
+                uint32 height);
+
 /// Printing on the console
 
 /// These functions do not modify the image and never fail.
@@ -102,11 +203,55 @@ int ImageSavePBM(const Image img, const char* filename);
 /// (The caller is responsible for destroying the returned image!)
 Image ImageLoadPPM(const char* filename);
 
+/// Load a raw PPM file with any number of colors.
+/// Files whose colors fit in the LUT give the same image as ImageLoadPPM.
+/// Otherwise, instead of failing with "LUT Overflow", the colors are
+/// reduced to as many as the LUT can hold (median cut), and each pixel
+/// gets the color that represents its group.
+/// (The caller is responsible for destroying the returned image!)
+Image ImageLoadPPMQuantized(const char* filename);
+
 /// Save image to PPM file.
 /// On success, returns nonzero.
 /// On failure, a partial and invalid file may be left in the system.
 int ImageSavePPM(const Image img, const char* filename);
 
+/// RGB buffers
+
+/// Expand img into buf as interleaved RGB24: 3 bytes (R, G, B) per pixel,
+/// rows stride bytes apart (0: 3 * width, no padding). Padding bytes are
+/// left untouched. Uses AVX2 gathers when the processor supports them.
+void ImageToRGB24(const Image img, uint8 buf[], size_t stride);
+
+/// The same as RGBA32: 4 bytes (R, G, B, 255) per pixel, rows stride bytes
+/// apart (0: 4 * width).
+void ImageToRGBA32(const Image img, uint8 buf[], size_t stride);
+
+/// Create an image from interleaved RGB24 pixels (rows stride bytes apart,
+/// 0: 3 * width). Labels are given in order of first appearance; if there
+/// are more colors than the LUT can hold, they are reduced as in
+/// ImageLoadPPMQuantized.
+/// (The caller is responsible for destroying the returned image!)
+Image ImageFromRGB24(const uint8 buf[], uint32 width, uint32 height,
+                     size_t stride);
+
+/// LBL file operations --- native format for labeled images
+/// Stores the labels and the LUT as they are, so segmented images can
+/// be checkpointed and reloaded without rebuilding the LUT.
+/// The format is binary and little-endian: a 32-byte header, the LUT,
+/// then the labels, raw or as (label, length) runs.
+
+/// Load a LBL file.
+/// The pixels are read at once into a single block of memory.
+/// On success, a new image is returned.
+/// (The caller is responsible for destroying the returned image!)
+Image ImageLoadLBL(const char* filename);
+
+/// Save image to LBL file, with run-length compression if compress != 0.
+/// On success, returns nonzero.
+/// On failure, a partial and invalid file may be left in the system.
+int ImageSaveLBL(const Image img, const char* filename, int compress);
+
 /// Information queries
 
 /// These functions do not modify the image and never fail.
@@ -120,6 +265,38 @@ uint32 ImageHeight(const Image img);
 /// Get number of image colors
 uint16 ImageColors(const Image img);
 
+/// LUT maintenance
+
+/// Compact the LUT of img: drop labels that no pixel uses any longer and
+/// merge labels with the same color, relabeling the pixels accordingly.
+/// WHITE and BLACK are always kept, and the remaining labels keep their
+/// relative order. The LUT is shared with sub-images, so the whole owner
+/// image is compacted (and labels held by the caller may change!).
+/// Returns the new number of colors.
+uint16 ImageCompactLUT(Image img);
+
+/// Histograms
+
+/// These functions do not modify the image and never fail.
+
+/// Count the pixels of img with each label: counts[label] for every label
+/// below ImageColors(img) (counts must have room for that many entries).
+/// For a sub-image, only its own pixels are counted.
+void ImageHistogram(const Image img, size_t counts[]);
+
+/// The same, with the rows split among the given number of threads
+/// (0: one per processor). Small images are counted by the calling thread.
+/// As in ImageRegionFillingParallelN, the number of threads is not limited
+/// by INSTR_MAX_THREADS.
+void ImageHistogramN(const Image img, size_t counts[], int threads);
+
+/// Count the pixels of each RGB color of img, merging labels with the same
+/// color. Only colors present in the image are listed, in the order of
+/// their first label: colors[k] covers counts[k] pixels. Both arrays must
+/// have room for ImageColors(img) entries.
+/// Returns the number of colors listed.
+uint16 ImageColorHistogram(const Image img, rgb_t colors[], size_t counts[]);
+
 /// Image comparison
 
 /// These functions do not modify the images and never fail.
@@ -155,6 +332,66 @@ Image ImageRotate90CW(const Image img);
 /// (The caller is responsible for destroying the returned image!)
 Image ImageRotate180CW(const Image img);
 
+/// Rotate 270 degrees clockwise (CW), i.e., 90 degrees counter-clockwise.
+/// Returns a rotated version of the image.
+/// Ensures: The original img is not modified.
+///
+/// On success, a new image is returned.
+/// (The caller is responsible for destroying the returned image!)
+Image ImageRotate270CW(const Image img);
+
+/// Mirror the image horizontally (left <-> right).
+/// (The caller is responsible for destroying the returned image!)
+Image ImageFlipHorizontal(const Image img);
+
+/// Mirror the image vertically (top <-> bottom).
+/// (The caller is responsible for destroying the returned image!)
+Image ImageFlipVertical(const Image img);
+
+/// Transpose the image (mirror about the main diagonal).
+/// (The caller is responsible for destroying the returned image!)
+Image ImageTranspose(const Image img);
+
+/// The eight transformations of the dihedral group of the square.
+/// Each value is a combination of three bits, applied in this order:
+///   IMAGE_TRANSPOSE: first swap rows and columns,
+///   IMAGE_FLIP_H, IMAGE_FLIP_V: then mirror horizontally / vertically.
+typedef enum {
+  IMAGE_IDENTITY = 0,
+  IMAGE_FLIP_H = 1,
+  IMAGE_FLIP_V = 2,
+  IMAGE_ROTATE_180 = 3,     // FLIP_H | FLIP_V
+  IMAGE_TRANSPOSE = 4,
+  IMAGE_ROTATE_90CW = 5,    // TRANSPOSE | FLIP_H
+  IMAGE_ROTATE_270CW = 6,   // TRANSPOSE | FLIP_V
+  IMAGE_TRANSVERSE = 7      // TRANSPOSE | FLIP_H | FLIP_V (anti-diagonal)
+} ImageTransform;
+
+/// Compose two transformations.
+/// Returns the single transformation equivalent to applying first,
+/// and then second.  (E.g., ROTATE_90CW then FLIP_H gives TRANSPOSE.)
+ImageTransform ImageTransformCompose(ImageTransform first,
+                                     ImageTransform second);
+
+/// Return the transformation that undoes t.
+ImageTransform ImageTransformInverse(ImageTransform t);
+
+/// Apply any of the eight transformations in a single pass.
+/// Chains of transformations should be combined with ImageTransformCompose
+/// and applied once, avoiding intermediate images.
+/// Ensures: The original img is not modified.
+///
+/// On success, a new image is returned.
+/// (The caller is responsible for destroying the returned image!)
+Image ImageApplyTransform(const Image img, ImageTransform t);
+
+/// Apply transformation t to src, writing into dst (see ImageCopyInto).
+void ImageApplyTransformInto(Image dst, const Image src, ImageTransform t);
+
+/// Rotations writing into dst (see ImageCopyInto).
+void ImageRotate90CWInto(Image dst, const Image src);
+void ImageRotate180CWInto(Image dst, const Image src);
+
 /// Check whether pixel coords (u, v) are inside img.
 /// ATTENTION
 ///   u : column index
@@ -188,6 +425,38 @@ int ImageRegionFillingWithSTACK(Image img, int u, int v, uint16 label);
 /// implement the flood-filling algorithm.
 int ImageRegionFillingWithQUEUE(Image img, int u, int v, uint16 label);
 
+/// Region growing from several seeds with a QUEUE, recording the
+/// geodesic distance map in the same traversal.
+///   n, us, vs: the seeds are (us[i], vs[i]), for i = 0..n-1; the region
+///              color is that of the first valid seed, and seeds outside the
+///              image or of another color are ignored. Seeds in separate
+///              regions of that color fill all of those regions.
+///   dist:      if not NULL, an array of width*height values, indexed as
+///              dist[v * width + u]. Each filled pixel receives its distance
+///              (number of 4-neighbor steps inside the region) to the
+///              nearest seed; all other pixels get IMAGE_DIST_UNREACHED.
+/// Returns the number of labeled pixels.
+int ImageRegionFillingWithDistances(Image img, int n, const int us[],
+                                    const int vs[], uint16 label,
+                                    uint32* dist);
+
+/// Distance of the pixels not reached by ImageRegionFillingWithDistances
+#define IMAGE_DIST_UNREACHED UINT32_MAX
+
+/// Region growing using a breadth-first search that expands each level
+/// of the frontier on several threads (one per processor).
+/// Fills the same pixels as ImageRegionFillingWithQUEUE. Levels with a
+/// small frontier are expanded by the calling thread alone, so this only
+/// pays off for very large regions.
+int ImageRegionFillingParallel(Image img, int u, int v, uint16 label);
+
+/// The same, with the given number of threads (0: one per processor).
+/// The number of threads is not limited by INSTR_MAX_THREADS: workers
+/// that find the instrumentation registry full run unregistered (see
+/// InstrThreadTryRegister).
+int ImageRegionFillingParallelN(Image img, int u, int v, uint16 label,
+                                int threads);
+
 /// Type: Pointer to a region filling function:
 typedef int (*FillingFunction)(Image img, int u, int v, uint16 label);
 
@@ -203,6 +472,143 @@ typedef int (*FillingFunction)(Image img, int u, int v, uint16 label);
 /// Returns the number of image regions found.
 int ImageSegmentation(Image img, FillingFunction fillFunct);
 
+/// Scratch buffers
+/// By default, each call of the STACK and QUEUE filling functions
+/// allocates its own stack or queue. After ImageScratchEnable(), the calling
+/// thread keeps one stack and one queue and reuses them in every fill
+/// (they only grow), which avoids an allocation per region when segmenting
+/// many images. ImageScratchRelease() frees them and restores the default.
+/// Both only affect the calling thread.
+void ImageScratchEnable(void);
+void ImageScratchRelease(void);
+
+/// Lazy views
+
+/// A view shows a source image under one of the dihedral transformations
+/// and, optionally, cropped to a rectangle. Creating, transforming or
+/// cropping a view is O(1): no pixels are copied until the view is
+/// materialized. The source image must outlive its views.
+typedef struct imageView* ImageView;
+
+/// Create a view of img under transformation t (IMAGE_IDENTITY for none).
+/// (The caller is responsible for destroying the returned view!)
+ImageView ImageViewCreate(const Image img, ImageTransform t);
+
+/// Destroy the view pointed to by (*viewp). The source image is kept.
+/// Ensures: (*viewp)==NULL.
+void ImageViewDestroy(ImageView* viewp);
+
+/// Apply transformation t on top of what the view currently shows.
+void ImageViewTransform(ImageView view, ImageTransform t);
+
+/// Restrict the view to the rectangle with top-left pixel (u, v) and the
+/// given dimensions, all in view coordinates.
+/// Requires: the rectangle lies inside the view.
+void ImageViewCrop(ImageView view, uint32 u, uint32 v, uint32 width,
+                   uint32 height);
+
+/// Get view width
+uint32 ImageViewWidth(const ImageView view);
+
+/// Get view height
+uint32 ImageViewHeight(const ImageView view);
+
+/// Get the label of pixel (u, v) of the view.
+uint16 ImageViewGetPixel(const ImageView view, int u, int v);
+
+/// Create a new image with what the view shows (a single pass).
+/// (The caller is responsible for destroying the returned image!)
+Image ImageViewMaterialize(const ImageView view);
+
+/// Save what the view shows, without materializing it.
+/// On success, returns nonzero (as ImageSavePBM and ImageSavePPM).
+int ImageViewSavePBM(const ImageView view, const char* filename);
+int ImageViewSavePPM(const ImageView view, const char* filename);
+
+/// Check if the view shows an image equal to img.
+int ImageViewIsEqual(const ImageView view, const Image img);
+
+/// Segment the part of the source image shown by the view, in place.
+/// Regions are found in view order and get the same colors as when
+/// segmenting ImageViewMaterialize(view). If the view shows the whole
+/// source, the labels are the same too. With a crop, filling is confined
+/// to the visible rectangle, labels outside it are kept and the new
+/// labels follow the ImageColors(source) labels already in use.
+/// Returns the number of image regions found.
+int ImageViewSegmentation(ImageView view, FillingFunction fillFunct);
+
+/// Run-length encoded images
+
+/// An image stored as runs (label, length) along each row.
+/// For mostly uniform content, such as scanned text pages, it takes a
+/// small fraction of the memory of the dense form, and segmenting it
+/// works on runs instead of pixels.
+typedef struct imageRLE* ImageRLE;
+
+/// Encode img (it is not modified). The LUT is copied.
+/// (The caller is responsible for destroying the returned image!)
+ImageRLE ImageRLEFromImage(const Image img);
+
+/// Decode to a new dense image, equal to the one that was encoded.
+/// (The caller is responsible for destroying the returned image!)
+Image ImageRLEToImage(const ImageRLE rle);
+
+/// Destroy the RLE image pointed to by (*rlep); sets (*rlep) to NULL.
+void ImageRLEDestroy(ImageRLE* rlep);
+
+uint32 ImageRLEWidth(const ImageRLE rle);
+uint32 ImageRLEHeight(const ImageRLE rle);
+
+/// Number of runs stored.
+uint32 ImageRLERuns(const ImageRLE rle);
+
+/// Memory used by the RLE image, in bytes.
+size_t ImageRLEBytes(const ImageRLE rle);
+
+/// Segment the RLE image with run-based connected components.
+/// The resulting labels and LUT are exactly those ImageSegmentation
+/// produces on the dense image (whatever the filling function).
+/// Returns the number of image regions found.
+int ImageRLESegmentation(ImageRLE rle);
+
+/// Tiled images
+
+/// An image whose pixels are stored in 8x8 tiles instead of rows, so that
+/// the vertical neighbors of most pixels are in the same cache line.
+/// Flood fills, segmentation and rotations, which move vertically as
+/// often as horizontally, touch fewer cache lines and pages on large
+/// images.
+typedef struct imageTiled* ImageTiled;
+
+/// Convert img (it is not modified). The LUT is copied.
+/// (The caller is responsible for destroying the returned image!)
+ImageTiled ImageTiledFromImage(const Image img);
+
+/// Convert back to a new image in rows.
+/// (The caller is responsible for destroying the returned image!)
+Image ImageTiledToImage(const ImageTiled t);
+
+/// Destroy the tiled image pointed to by (*tp); sets (*tp) to NULL.
+void ImageTiledDestroy(ImageTiled* tp);
+
+uint32 ImageTiledWidth(const ImageTiled t);
+uint32 ImageTiledHeight(const ImageTiled t);
+uint16 ImageTiledColors(const ImageTiled t);
+uint16 ImageTiledGetPixel(const ImageTiled t, int u, int v);
+
+/// Region growing on the tiled image, with the same semantics (and
+/// result) as ImageRegionFillingWithSTACK.
+int ImageTiledRegionFilling(ImageTiled t, int u, int v, uint16 label);
+
+/// Segment the tiled image. The resulting labels and LUT are exactly
+/// those ImageSegmentation produces on the image in rows.
+/// Returns the number of image regions found.
+int ImageTiledSegmentation(ImageTiled t);
+
+/// Rotate 90 degrees clockwise, tile by tile.
+/// (The caller is responsible for destroying the returned image!)
+ImageTiled ImageTiledRotate90CW(const ImageTiled t);
+
 //Função auxiliar criada por nós
 void ImageSetPixel(Image img, int u, int v, uint16 label);
 
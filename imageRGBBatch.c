@@ -0,0 +1,175 @@
+// imageRGBBatch - Process many image files on a pool of threads.
+//
+// Loads every FILE, optionally transforms and segments it, optionally
+// saves the result, and reports the throughput.
+//
+// Usage: imageRGBBatch [options] FILE...
+//   --threads N         worker threads (default: 0, one per processor)
+//   --transform NAME    rotate90, rotate180, rotate270, fliph, flipv,
+//                       transpose or transverse (default: none)
+//   --fill NAME         segment with stack, queue or recursive,
+//                       or none to skip segmentation (default: stack)
+//   --outdir DIR        save each result in DIR, with the input's base name
+//   --outformat NAME    pbm, ppm or lbl (default: ppm when segmenting,
+//                       otherwise the input's format)
+//   --pipeline N        use separate reader, compute and writer threads,
+//                       with queues of N images (0: twice the threads)
+//   --pool MB           recycle images of the same size through an image
+//                       pool of up to MB megabytes, report its hit rate
+//   --trace FILE        record timing regions, save as Chrome trace JSON
+//
+// Files ending in .ppm are read as PPM, in .lbl as LBL, all others as PBM.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "error.h"
+#include "imageBatch.h"
+#include "imageRGB.h"
+#include "instrumentation.h"
+
+static const struct {
+  const char* name;
+  ImageTransform t;
+} transforms[] = {
+    {"none", IMAGE_IDENTITY},        {"rotate90", IMAGE_ROTATE_90CW},
+    {"rotate180", IMAGE_ROTATE_180}, {"rotate270", IMAGE_ROTATE_270CW},
+    {"fliph", IMAGE_FLIP_H},         {"flipv", IMAGE_FLIP_V},
+    {"transpose", IMAGE_TRANSPOSE},  {"transverse", IMAGE_TRANSVERSE},
+};
+
+static const struct {
+  const char* name;
+  FillingFunction f;
+} fills[] = {
+    {"stack", ImageRegionFillingWithSTACK},
+    {"queue", ImageRegionFillingWithQUEUE},
+    {"recursive", ImageRegionFillingRecursive},
+    {"none", NULL},
+};
+
+#define COUNT(a) (sizeof(a) / sizeof((a)[0]))
+
+static int hasExtension(const char* name, const char* ext) {
+  size_t n = strlen(name), m = strlen(ext);
+  return n >= m && strcmp(name + n - m, ext) == 0;
+}
+
+// Output path: dir/base, with the extension replaced by ext
+static char* outputName(const char* dir, const char* input, const char* ext) {
+  const char* base = strrchr(input, '/');
+  base = (base != NULL) ? base + 1 : input;
+  const char* dot = strrchr(base, '.');
+  int len = (dot != NULL) ? (int)(dot - base) : (int)strlen(base);
+  size_t size = strlen(dir) + 1 + len + strlen(ext) + 1;
+  char* name = malloc(size);
+  if (name == NULL) {
+    error(1, 0, "Out of memory");
+    exit(EXIT_FAILURE);  // not reached (error exits when status != 0)
+  }
+  snprintf(name, size, "%s/%.*s%s", dir, len, base, ext);
+  return name;
+}
+
+int main(int argc, char* argv[]) {
+  program_name = argv[0];
+
+  BatchOperation op = {IMAGE_IDENTITY, ImageRegionFillingWithSTACK};
+  int threads = 0;
+  const char* outDir = NULL;
+  const char* traceName = NULL;
+  const char* outFormat = NULL;
+  int depth = -1;  // no pipeline
+  long poolMB = 0;  // no image pool
+
+  int i = 1;
+  for (; i < argc && strncmp(argv[i], "--", 2) == 0; i++) {
+    const char* opt = argv[i];
+    const char* val = (i + 1 < argc) ? argv[i + 1] : NULL;
+    if (val == NULL) error(1, 0, "Missing value for %s", opt);
+    if (strcmp(opt, "--threads") == 0) {
+      threads = atoi(val);
+    } else if (strcmp(opt, "--transform") == 0) {
+      size_t k = 0;
+      while (k < COUNT(transforms) && strcmp(val, transforms[k].name) != 0) k++;
+      if (k == COUNT(transforms)) error(1, 0, "Unknown transform: %s", val);
+      op.transform = transforms[k].t;
+    } else if (strcmp(opt, "--fill") == 0) {
+      size_t k = 0;
+      while (k < COUNT(fills) && strcmp(val, fills[k].name) != 0) k++;
+      if (k == COUNT(fills)) error(1, 0, "Unknown filling function: %s", val);
+      op.segment = fills[k].f;
+    } else if (strcmp(opt, "--outdir") == 0) {
+      outDir = val;
+    } else if (strcmp(opt, "--outformat") == 0) {
+      if (strcmp(val, "pbm") != 0 && strcmp(val, "ppm") != 0 &&
+          strcmp(val, "lbl") != 0)
+        error(1, 0, "Unknown format: %s", val);
+      outFormat = val;
+    } else if (strcmp(opt, "--pipeline") == 0) {
+      depth = atoi(val);
+      if (depth < 0) error(1, 0, "--pipeline must be non-negative");
+    } else if (strcmp(opt, "--pool") == 0) {
+      poolMB = atol(val);
+      if (poolMB < 0) error(1, 0, "--pool must be non-negative");
+    } else if (strcmp(opt, "--trace") == 0) {
+      traceName = val;
+    } else {
+      error(1, 0, "Unknown option: %s", opt);
+    }
+    i++;
+  }
+  if (threads < 0) error(1, 0, "--threads must be non-negative");
+  if (i == argc) error(1, 0, "No input files");
+
+  size_t count = (size_t)(argc - i);
+  const char* const* inputs = (const char* const*)&argv[i];
+  char** outputs = NULL;
+  if (outDir != NULL) {
+    if ((outputs = malloc(count * sizeof(char*))) == NULL)
+      error(1, 0, "Out of memory");
+    for (size_t k = 0; k < count; k++) {
+      // Segmented images have more than 2 colors: they need PPM or LBL
+      const char* ext = ".pbm";
+      if (outFormat != NULL)
+        ext = strcmp(outFormat, "ppm") == 0   ? ".ppm"
+              : strcmp(outFormat, "lbl") == 0 ? ".lbl"
+                                              : ".pbm";
+      else if (op.segment != NULL || hasExtension(inputs[k], ".ppm"))
+        ext = ".ppm";
+      else if (hasExtension(inputs[k], ".lbl"))
+        ext = ".lbl";
+      outputs[k] = outputName(outDir, inputs[k], ext);
+    }
+  }
+
+  ImageInit();
+  InstrReset();
+  if (traceName != NULL) InstrTraceEnable(1);
+  if (poolMB > 0) ImagePoolEnable((size_t)poolMB << 20);
+
+  BatchStats stats;
+  if (depth >= 0)
+    ImageBatchPipeline(inputs, (const char* const*)outputs, count, op,
+                       threads, depth, NULL, &stats);
+  else
+    ImageBatchProcess(inputs, (const char* const*)outputs, count, op, threads,
+                      NULL, &stats);
+  ImageBatchPrintStats(&stats);
+  if (poolMB > 0) {
+    ImagePoolStats pool;
+    ImagePoolGetStats(&pool);
+    printf("Pool: %lu hits, %lu misses (%.1f%% hit rate), %zu images kept\n",
+           pool.hits, pool.misses, 100.0 * pool.hitRate, pool.images);
+    ImagePoolEnable(0);
+  }
+
+  if (traceName != NULL && !InstrTraceSave(traceName))
+    error(1, 0, "Cannot write %s", traceName);
+  if (outputs != NULL) {
+    for (size_t k = 0; k < count; k++) free(outputs[k]);
+    free(outputs);
+  }
+  return 0;
+}
@@ -0,0 +1,676 @@
+// imageRGBBench - Benchmark suite for the imageRGB module.
+//
+// Generates images of several sizes and topologies and times every
+// filling function, segmentation, transformation, copy and I/O path,
+// with warm-up runs and repetitions.
+// Results are written as CSV (default) or JSON.
+//
+// Usage: imageRGBBench [options]
+//   --format csv|json   output format (default: csv)
+//   --out FILE          write results to FILE (default: stdout)
+//   --sizes N,N,...     square image sizes (default: 128,512,2048)
+//   --reps N            timed repetitions per case (default: 5)
+//   --warmup N          untimed warm-up runs per case (default: 1)
+//   --rounds N          repeat all cases N times, interleaved (default: 1)
+//   --filter STR        only run kernels whose name contains STR
+//   --trace FILE        record timing regions, save as Chrome trace JSON
+//
+// Regression checking:
+//   --save-baseline FILE  store the median, MAD and confidence interval
+//                         of every case in FILE
+//   --baseline FILE     compare every case with FILE and print a report;
+//                       exit with status 2 if any case regressed
+//   --threshold PCT     slowdown tolerated before a case regresses
+//                       (default: 10)
+//
+// A case regresses when its median time grows by more than the threshold
+// AND its confidence interval lies entirely above the baseline's, so
+// noisy cases do not fail by chance.  Use several --rounds: the interval
+// then reflects how much the machine drifts during a run, which is
+// usually much more than the spread of back-to-back repetitions.
+// With --baseline and no --out, only the report is printed.
+//
+// This program is part of a programming project
+// for the course AED, DETI / UA.PT
+//
+// You may freely use and modify this code, NO WARRANTY, blah blah,
+// as long as you give proper credit to the original and subsequent authors.
+
+#include <assert.h>
+#include <errno.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "error.h"
+#include "imageRGB.h"
+#include "instrumentation.h"
+
+// Recursive filling is limited by the call stack:
+// only run it on images up to this many pixels.
+#define RECURSIVE_MAX_PIXELS (256 * 256)
+
+// Text I/O is slow: only run it on images up to this many pixels.
+#define IO_MAX_PIXELS (1024 * 1024)
+
+#define MAX_SIZES 16
+#define MAX_REPS 1000
+#define MAX_BASELINE 4096
+
+// Temporary files used by the I/O kernels
+#define TMP_PPM "bench_tmp.ppm"
+#define TMP_PBM "bench_tmp.pbm"
+#define TMP_LBL "bench_tmp.lbl"
+
+/// Image generators (topologies)
+
+// All WHITE: a single huge region
+static Image genSolid(uint32 w, uint32 h) {
+  return ImageCreateSolid(w, h, 0xffffff);
+}
+
+// Chess pattern with 8x8 squares: many small regions
+static Image genChess(uint32 w, uint32 h) {
+  return ImageCreateChess(w, h, 8, 0x000000);
+}
+
+// Random BLACK pixels with density 1/2: many tiny irregular regions
+static Image genNoise(uint32 w, uint32 h) {
+  return ImageCreateNoise(w, h, 0.5, 2463534242u);
+}
+
+// Serpentine maze: one long 1-pixel corridor
+static Image genMaze(uint32 w, uint32 h) { return ImageCreateMaze(w, h); }
+
+// Square spiral with 1-pixel-wide WHITE corridor
+static Image genSpiral(uint32 w, uint32 h) { return ImageCreateSpiral(w, h); }
+
+// Concentric rings 4 pixels wide: nested regions
+static Image genRings(uint32 w, uint32 h) { return ImageCreateRings(w, h, 4); }
+
+typedef struct {
+  const char* name;
+  Image (*generate)(uint32 w, uint32 h);
+} Topology;
+
+static const Topology topologies[] = {
+    {"solid", genSolid}, {"chess", genChess}, {"noise", genNoise},
+    {"maze", genMaze},   {"spiral", genSpiral}, {"rings", genRings},
+};
+#define NUM_TOPOLOGIES (int)(sizeof(topologies) / sizeof(topologies[0]))
+
+/// Kernels
+
+// State shared by setup, run and teardown of one case
+typedef struct {
+  Image src;   // generated input (never modified)
+  Image work;  // per-run working copy, for kernels that modify images
+  Image out;   // per-run result, destroyed by the teardown
+  ImageRLE rle;  // per-run run-length encoded copy
+  uint8* rgb;    // per-run RGBA32 buffer
+  ImageTiled tiled;     // per-run copy in 8x8 tiles
+  ImageTiled tiledOut;  // per-run tiled result
+} Case;
+
+// Helpers for setup and teardown (not timed)
+static void setupCopy(Case* c) { c->work = ImageCopy(c->src); }
+static void setupSaved(Case* c) { ImageSavePPM(c->src, TMP_PPM); }
+static void setupSavedPBM(Case* c) { ImageSavePBM(c->src, TMP_PBM); }
+static void setupSavedLBL(Case* c) { ImageSaveLBL(c->src, TMP_LBL, 0); }
+static void setupRotated(Case* c) { c->work = ImageRotate90CW(c->src); }
+static void setupRLE(Case* c) { c->rle = ImageRLEFromImage(c->src); }
+static void setupTiled(Case* c) { c->tiled = ImageTiledFromImage(c->src); }
+static void setupRGB(Case* c) {
+  c->rgb = malloc((size_t)ImageWidth(c->src) * ImageHeight(c->src) * 4);
+}
+static void teardown(Case* c) {
+  if (c->work != NULL) ImageDestroy(&c->work);
+  if (c->out != NULL) ImageDestroy(&c->out);
+  if (c->rle != NULL) ImageRLEDestroy(&c->rle);
+  free(c->rgb);
+  c->rgb = NULL;
+  if (c->tiled != NULL) ImageTiledDestroy(&c->tiled);
+  if (c->tiledOut != NULL) ImageTiledDestroy(&c->tiledOut);
+}
+
+// Seed for single fills: pixel (0, 0), whatever region it belongs to
+static void runFillRecursive(Case* c) {
+  ImageRegionFillingRecursive(c->work, 0, 0, 2);
+}
+static void runFillStack(Case* c) {
+  ImageRegionFillingWithSTACK(c->work, 0, 0, 2);
+}
+static void runFillQueue(Case* c) {
+  ImageRegionFillingWithQUEUE(c->work, 0, 0, 2);
+}
+static void runSegRecursive(Case* c) {
+  ImageSegmentation(c->work, ImageRegionFillingRecursive);
+}
+static void runSegStack(Case* c) {
+  ImageSegmentation(c->work, ImageRegionFillingWithSTACK);
+}
+static void runSegQueue(Case* c) {
+  ImageSegmentation(c->work, ImageRegionFillingWithQUEUE);
+}
+static void runSegRLE(Case* c) { ImageRLESegmentation(c->rle); }
+static void runFillTiled(Case* c) { ImageTiledRegionFilling(c->tiled, 0, 0, 2); }
+static void runSegTiled(Case* c) { ImageTiledSegmentation(c->tiled); }
+static void runRotate90Tiled(Case* c) {
+  c->tiledOut = ImageTiledRotate90CW(c->tiled);
+}
+static void runToRLE(Case* c) { c->rle = ImageRLEFromImage(c->src); }
+static void runRotate90(Case* c) { c->out = ImageRotate90CW(c->src); }
+static void runRotate180(Case* c) { c->out = ImageRotate180CW(c->src); }
+static void runRotate270(Case* c) { c->out = ImageRotate270CW(c->src); }
+static void runFlipH(Case* c) { c->out = ImageFlipHorizontal(c->src); }
+static void runTranspose(Case* c) { c->out = ImageTranspose(c->src); }
+static void runCopy(Case* c) { c->out = ImageCopy(c->src); }
+static void runRotate90Into(Case* c) { ImageRotate90CWInto(c->work, c->src); }
+static void runCopyInto(Case* c) { ImageCopyInto(c->work, c->src); }
+static void runIsEqual(Case* c) { ImageIsEqual(c->src, c->work); }
+static void runToRGB24(Case* c) { ImageToRGB24(c->src, c->rgb, 0); }
+static void runToRGBA32(Case* c) { ImageToRGBA32(c->src, c->rgb, 0); }
+static void runFromRGB24(Case* c) {
+  c->out = ImageFromRGB24(c->rgb, ImageWidth(c->src), ImageHeight(c->src), 0);
+}
+static void setupRGB24(Case* c) {
+  setupRGB(c);
+  ImageToRGB24(c->src, c->rgb, 0);
+}
+static void runHistogram(Case* c) {
+  size_t counts[ImageColors(c->src)];
+  ImageHistogram(c->src, counts);
+}
+static void runSavePPM(Case* c) { ImageSavePPM(c->src, TMP_PPM); }
+static void runLoadPPM(Case* c) { c->out = ImageLoadPPM(TMP_PPM); }
+static void runSavePBM(Case* c) { ImageSavePBM(c->src, TMP_PBM); }
+static void runLoadPBM(Case* c) { c->out = ImageLoadPBM(TMP_PBM); }
+static void runSaveLBL(Case* c) { ImageSaveLBL(c->src, TMP_LBL, 0); }
+static void runLoadLBL(Case* c) { c->out = ImageLoadLBL(TMP_LBL); }
+
+typedef struct {
+  const char* name;
+  void (*setup)(Case* c);  // not timed (may be NULL)
+  void (*run)(Case* c);    // timed
+  uint32 maxPixels;        // skip larger images (0: no limit)
+} Kernel;
+
+static const Kernel kernels[] = {
+    {"fill_recursive", setupCopy, runFillRecursive, RECURSIVE_MAX_PIXELS},
+    {"fill_stack", setupCopy, runFillStack, 0},
+    {"fill_queue", setupCopy, runFillQueue, 0},
+    {"seg_recursive", setupCopy, runSegRecursive, RECURSIVE_MAX_PIXELS},
+    {"seg_stack", setupCopy, runSegStack, 0},
+    {"seg_queue", setupCopy, runSegQueue, 0},
+    {"seg_rle", setupRLE, runSegRLE, 0},
+    {"fill_tiled", setupTiled, runFillTiled, 0},
+    {"seg_tiled", setupTiled, runSegTiled, 0},
+    {"to_rle", NULL, runToRLE, 0},
+    {"rotate90", NULL, runRotate90, 0},
+    {"rotate180", NULL, runRotate180, 0},
+    {"rotate270", NULL, runRotate270, 0},
+    {"rotate90_tiled", setupTiled, runRotate90Tiled, 0},
+    {"flip_h", NULL, runFlipH, 0},
+    {"transpose", NULL, runTranspose, 0},
+    {"copy", NULL, runCopy, 0},
+    {"rotate90_into", setupRotated, runRotate90Into, 0},
+    {"copy_into", setupCopy, runCopyInto, 0},
+    {"is_equal", setupCopy, runIsEqual, 0},
+    {"histogram", NULL, runHistogram, 0},
+    {"to_rgb24", setupRGB, runToRGB24, 0},
+    {"to_rgba32", setupRGB, runToRGBA32, 0},
+    {"from_rgb24", setupRGB24, runFromRGB24, 0},
+    {"save_ppm", NULL, runSavePPM, IO_MAX_PIXELS},
+    {"load_ppm", setupSaved, runLoadPPM, IO_MAX_PIXELS},
+    {"save_pbm", NULL, runSavePBM, IO_MAX_PIXELS},
+    {"load_pbm", setupSavedPBM, runLoadPBM, IO_MAX_PIXELS},
+    {"save_lbl", NULL, runSaveLBL, IO_MAX_PIXELS},
+    {"load_lbl", setupSavedLBL, runLoadLBL, IO_MAX_PIXELS},
+};
+#define NUM_KERNELS (int)(sizeof(kernels) / sizeof(kernels[0]))
+
+/// Measurement
+
+// One measured repetition
+typedef struct {
+  double time;                        // cpu seconds
+  unsigned long count[NUMCOUNTERS];   // instrumentation counters
+  unsigned long high[INSTR_NUMHIGH];  // high-water marks (e.g., frontier)
+  long long memPeak;                  // peak bytes allocated by the run
+  long long perf[INSTR_NUMPERF];      // hardware counters (-1: n/a)
+} Sample;
+
+// Summary of one (kernel, topology, size) case
+typedef struct {
+  const char* kernel;
+  const char* topology;
+  uint32 width, height;
+  int reps;
+  double time;      // median time
+  double timeMin;   // fastest repetition
+  double mad;       // median absolute deviation of the times
+  double ciLow;     // ~95% confidence interval of the median time
+  double ciHigh;
+  Sample median;    // counters of the median repetition
+} Result;
+
+static void runOnce(const Kernel* k, Case* c, Sample* s) {
+  InstrSnap before, after;
+  long long perf0[INSTR_NUMPERF], perf1[INSTR_NUMPERF];
+
+  c->work = c->out = NULL;
+  if (k->setup != NULL) k->setup(c);
+
+  long long mem0 = InstrMemCurrentTotal();
+  InstrMemResetPeaks();
+  InstrPerfRead(perf0);
+  InstrSnapshot(&before);
+  k->run(c);
+  InstrSnapshot(&after);
+  InstrPerfRead(perf1);
+  s->memPeak = InstrMemPeakTotal() - mem0;
+  for (int i = 0; i < INSTR_NUMHIGH; i++) s->high[i] = InstrHighRead(i);
+
+  s->time = after.time - before.time;
+  for (int i = 0; i < NUMCOUNTERS; i++)
+    s->count[i] = after.count[i] - before.count[i];
+  for (int e = 0; e < INSTR_NUMPERF; e++)
+    s->perf[e] = (perf0[e] < 0 || perf1[e] < 0) ? -1 : perf1[e] - perf0[e];
+
+  teardown(c);
+}
+
+static int cmpSampleTime(const void* a, const void* b) {
+  double ta = ((const Sample*)a)->time, tb = ((const Sample*)b)->time;
+  return (ta > tb) - (ta < tb);
+}
+
+static int cmpDouble(const void* a, const void* b) {
+  double x = *(const double*)a, y = *(const double*)b;
+  return (x > y) - (x < y);
+}
+
+// Robust statistics of n sorted sample times:
+// the median absolute deviation (MAD) and a distribution-free ~95%
+// confidence interval for the median, given by the order statistics
+// of ranks n/2 -+ 0.98 sqrt(n) (the whole range for small n).
+static void robustStats(const double sorted[], int n, double* mad,
+                        double* ciLow, double* ciHigh) {
+  double* dev = malloc(n * sizeof(double));
+  if (dev == NULL) error(1, errno, "malloc");
+  double median = sorted[n / 2];
+  for (int i = 0; i < n; i++) dev[i] = fabs(sorted[i] - median);
+  qsort(dev, n, sizeof(double), cmpDouble);
+  *mad = dev[n / 2];
+  free(dev);
+
+  int lo = (int)floor(n / 2.0 - 0.98 * sqrt(n));
+  int hi = (int)ceil(n / 2.0 + 0.98 * sqrt(n));
+  if (lo < 0) lo = 0;
+  if (hi > n - 1) hi = n - 1;
+  *ciLow = sorted[lo];
+  *ciHigh = sorted[hi];
+}
+
+// One (kernel, topology, size) case and the samples collected so far
+typedef struct {
+  const Kernel* kernel;
+  const Topology* topology;
+  Image src;
+  Sample* samples;  // rounds x reps
+  int numSamples;
+} Job;
+
+// Run the warm-up and reps repetitions of a job once more (one round).
+static void measure(Job* job, int warmup, int reps) {
+  Case c = {job->src, NULL, NULL, NULL, NULL, NULL, NULL};
+  Sample discard;
+
+  for (int i = 0; i < warmup; i++) runOnce(job->kernel, &c, &discard);
+  for (int i = 0; i < reps; i++)
+    runOnce(job->kernel, &c, &job->samples[job->numSamples++]);
+}
+
+// Summarize the samples of a job, taken in rounds of reps repetitions.
+// With one round, the confidence interval comes from the repetitions.
+// With several rounds, it comes from the median of each round, so slow
+// drifts of machine speed during the run widen the interval.
+static void summarize(Job* job, int reps, Result* r) {
+  int n = job->numSamples;
+  int rounds = n / reps;
+  double* times = malloc(n * sizeof(double));
+  if (times == NULL) error(1, errno, "malloc");
+
+  double unused;
+  if (rounds > 1) {
+    for (int k = 0; k < rounds; k++) {
+      Sample* round = &job->samples[k * reps];
+      qsort(round, reps, sizeof(Sample), cmpSampleTime);
+      times[k] = round[reps / 2].time;
+    }
+    qsort(times, rounds, sizeof(double), cmpDouble);
+    robustStats(times, rounds, &unused, &r->ciLow, &r->ciHigh);
+  }
+  qsort(job->samples, n, sizeof(Sample), cmpSampleTime);
+  for (int i = 0; i < n; i++) times[i] = job->samples[i].time;
+  if (rounds > 1)
+    robustStats(times, n, &r->mad, &unused, &unused);
+  else
+    robustStats(times, n, &r->mad, &r->ciLow, &r->ciHigh);
+  free(times);
+
+  r->kernel = job->kernel->name;
+  r->topology = job->topology->name;
+  r->width = ImageWidth(job->src);
+  r->height = ImageHeight(job->src);
+  r->reps = n;
+  r->median = job->samples[n / 2];
+  r->time = r->median.time;
+  r->timeMin = job->samples[0].time;
+}
+
+/// Output
+
+// Is memory accounted (i.e., built with instrumentation)?
+static int memTracked(void) {
+  for (int c = 0; c < INSTR_NUMMEM; c++)
+    if (InstrMemName[c] != NULL) return 1;
+  return 0;
+}
+
+static void printHeader(FILE* f, int json) {
+  if (json) {
+    fprintf(f, "[\n");
+    return;
+  }
+  fprintf(f, "kernel,topology,width,height,reps,time_s,time_min_s,mad_s,"
+             "ci_low_s,ci_high_s,caltime,mpix_s");
+  for (int i = 0; i < NUMCOUNTERS; i++)
+    if (InstrName[i] != NULL) fprintf(f, ",%s", InstrName[i]);
+  if (memTracked()) fprintf(f, ",mem_peak");
+  for (int i = 0; i < INSTR_NUMHIGH; i++)
+    if (InstrHighName[i] != NULL) fprintf(f, ",%s", InstrHighName[i]);
+  for (int e = 0; e < INSTR_NUMPERF; e++) fprintf(f, ",%s", InstrPerfName[e]);
+  fprintf(f, "\n");
+}
+
+static void printResult(FILE* f, int json, const Result* r, int first) {
+  double pixels = (double)r->width * r->height;
+  double mpix = r->time > 0.0 ? pixels / r->time / 1e6 : 0.0;
+
+  if (json) {
+    fprintf(f,
+            "%s  {\"kernel\": \"%s\", \"topology\": \"%s\", \"width\": %u, "
+            "\"height\": %u, \"reps\": %d, \"time_s\": %.9f, "
+            "\"time_min_s\": %.9f, \"mad_s\": %.9f, \"ci_low_s\": %.9f, "
+            "\"ci_high_s\": %.9f, \"caltime\": %.9f, \"mpix_s\": %.3f",
+            first ? "" : ",\n", r->kernel, r->topology, r->width, r->height,
+            r->reps, r->time, r->timeMin, r->mad, r->ciLow, r->ciHigh,
+            r->time / InstrCTU, mpix);
+    for (int i = 0; i < NUMCOUNTERS; i++)
+      if (InstrName[i] != NULL)
+        fprintf(f, ", \"%s\": %lu", InstrName[i], r->median.count[i]);
+    if (memTracked()) fprintf(f, ", \"mem_peak\": %lld", r->median.memPeak);
+    for (int i = 0; i < INSTR_NUMHIGH; i++)
+      if (InstrHighName[i] != NULL)
+        fprintf(f, ", \"%s\": %lu", InstrHighName[i], r->median.high[i]);
+    for (int e = 0; e < INSTR_NUMPERF; e++) {
+      if (r->median.perf[e] >= 0)
+        fprintf(f, ", \"%s\": %lld", InstrPerfName[e], r->median.perf[e]);
+      else
+        fprintf(f, ", \"%s\": null", InstrPerfName[e]);
+    }
+    fprintf(f, "}");
+    return;
+  }
+  fprintf(f, "%s,%s,%u,%u,%d,%.9f,%.9f,%.9f,%.9f,%.9f,%.9f,%.3f", r->kernel,
+          r->topology, r->width, r->height, r->reps, r->time, r->timeMin,
+          r->mad, r->ciLow, r->ciHigh, r->time / InstrCTU, mpix);
+  for (int i = 0; i < NUMCOUNTERS; i++)
+    if (InstrName[i] != NULL) fprintf(f, ",%lu", r->median.count[i]);
+  if (memTracked()) fprintf(f, ",%lld", r->median.memPeak);
+  for (int i = 0; i < INSTR_NUMHIGH; i++)
+    if (InstrHighName[i] != NULL) fprintf(f, ",%lu", r->median.high[i]);
+  for (int e = 0; e < INSTR_NUMPERF; e++) {
+    if (r->median.perf[e] >= 0)
+      fprintf(f, ",%lld", r->median.perf[e]);
+    else
+      fprintf(f, ",");
+  }
+  fprintf(f, "\n");
+}
+
+static void printFooter(FILE* f, int json) {
+  if (json) fprintf(f, "\n]\n");
+}
+
+/// Baseline and regression report
+
+// One case of a baseline file
+typedef struct {
+  char kernel[32];
+  char topology[32];
+  uint32 width, height;
+  double time, mad, ciLow, ciHigh;
+} BaselineEntry;
+
+static BaselineEntry baseline[MAX_BASELINE];
+static int baselineSize;
+
+// Baseline file: a comment line, then one case per line
+static void saveBaselineEntry(FILE* f, const Result* r) {
+  fprintf(f, "%s %s %u %u %.9f %.9f %.9f %.9f\n", r->kernel, r->topology,
+          r->width, r->height, r->time, r->mad, r->ciLow, r->ciHigh);
+}
+
+static void loadBaseline(const char* filename) {
+  FILE* f = fopen(filename, "r");
+  if (f == NULL) error(1, 0, "Cannot open baseline %s", filename);
+  char line[256];
+  while (fgets(line, sizeof(line), f) != NULL) {
+    if (line[0] == '#') continue;
+    if (baselineSize == MAX_BASELINE) error(1, 0, "Baseline too large");
+    BaselineEntry* e = &baseline[baselineSize];
+    if (sscanf(line, "%31s %31s %u %u %lf %lf %lf %lf", e->kernel,
+               e->topology, &e->width, &e->height, &e->time, &e->mad,
+               &e->ciLow, &e->ciHigh) != 8)
+      error(1, 0, "Invalid baseline line: %s", line);
+    baselineSize++;
+  }
+  fclose(f);
+}
+
+static const BaselineEntry* findBaseline(const Result* r) {
+  for (int i = 0; i < baselineSize; i++) {
+    const BaselineEntry* e = &baseline[i];
+    if (strcmp(e->kernel, r->kernel) == 0 &&
+        strcmp(e->topology, r->topology) == 0 && e->width == r->width &&
+        e->height == r->height)
+      return e;
+  }
+  return NULL;
+}
+
+// Print one line of the report and return nonzero if the case regressed.
+static int compareBaseline(FILE* f, const Result* r, double threshold) {
+  const BaselineEntry* e = findBaseline(r);
+  double time = r->time;
+  if (e == NULL) {
+    fprintf(f, "%-16s %-8s %5ux%-5u %12s %12.6f %9s  new\n", r->kernel,
+            r->topology, r->width, r->height, "-", time * 1e3, "-");
+    return 0;
+  }
+  double ciLow = r->ciLow, ciHigh = r->ciHigh;
+  double change = e->time > 0.0 ? (time - e->time) / e->time : 0.0;
+  const char* verdict = "ok";
+  int regressed = 0;
+  if (change > threshold && ciLow > e->ciHigh) {
+    verdict = "REGRESSED";
+    regressed = 1;
+  } else if (change < -threshold && ciHigh < e->ciLow) {
+    verdict = "faster";
+  }
+  fprintf(f, "%-16s %-8s %5ux%-5u %12.6f %12.6f %+8.1f%%  %s\n", r->kernel,
+          r->topology, r->width, r->height, e->time * 1e3, time * 1e3,
+          100.0 * change, verdict);
+  return regressed;
+}
+
+/// Command line
+
+static int parseSizes(const char* arg, uint32 sizes[]) {
+  int n = 0;
+  char* end;
+  while (*arg != '\0' && n < MAX_SIZES) {
+    long size = strtol(arg, &end, 10);
+    if (end == arg || size <= 0) error(1, 0, "Invalid size list: %s", arg);
+    sizes[n++] = (uint32)size;
+    arg = (*end == ',') ? end + 1 : end;
+  }
+  return n;
+}
+
+int main(int argc, char* argv[]) {
+  program_name = argv[0];
+
+  int json = 0;
+  const char* outName = NULL;
+  const char* filter = NULL;
+  const char* traceName = NULL;
+  const char* baselineName = NULL;
+  const char* saveBaselineName = NULL;
+  double threshold = 10.0;
+  uint32 sizes[MAX_SIZES] = {128, 512, 2048};
+  int numSizes = 3;
+  int reps = 5;
+  int warmup = 1;
+  int rounds = 1;
+
+  for (int i = 1; i < argc; i++) {
+    const char* opt = argv[i];
+    const char* val = (i + 1 < argc) ? argv[i + 1] : NULL;
+    if (val == NULL) error(1, 0, "Missing value for %s", opt);
+    if (strcmp(opt, "--format") == 0) {
+      if (strcmp(val, "json") == 0) json = 1;
+      else if (strcmp(val, "csv") == 0) json = 0;
+      else error(1, 0, "Unknown format: %s", val);
+    } else if (strcmp(opt, "--out") == 0) {
+      outName = val;
+    } else if (strcmp(opt, "--sizes") == 0) {
+      numSizes = parseSizes(val, sizes);
+    } else if (strcmp(opt, "--reps") == 0) {
+      reps = atoi(val);
+    } else if (strcmp(opt, "--rounds") == 0) {
+      rounds = atoi(val);
+    } else if (strcmp(opt, "--warmup") == 0) {
+      warmup = atoi(val);
+    } else if (strcmp(opt, "--filter") == 0) {
+      filter = val;
+    } else if (strcmp(opt, "--trace") == 0) {
+      traceName = val;
+    } else if (strcmp(opt, "--baseline") == 0) {
+      baselineName = val;
+    } else if (strcmp(opt, "--save-baseline") == 0) {
+      saveBaselineName = val;
+    } else if (strcmp(opt, "--threshold") == 0) {
+      threshold = atof(val);
+    } else {
+      error(1, 0, "Unknown option: %s", opt);
+    }
+    i++;
+  }
+  if (reps < 1 || reps > MAX_REPS) error(1, 0, "--reps must be 1..%d", MAX_REPS);
+  if (warmup < 0) error(1, 0, "--warmup must be non-negative");
+  if (rounds < 1) error(1, 0, "--rounds must be positive");
+  if (threshold < 0.0) error(1, 0, "--threshold must be non-negative");
+  if (baselineName != NULL) loadBaseline(baselineName);
+
+  ImageInit();
+  InstrPerfOpen();
+  InstrReset();
+  if (traceName != NULL) InstrTraceEnable(1);
+
+  // With --baseline and no --out, only the report goes to stdout
+  FILE* out = stdout;
+  if (outName != NULL) {
+    if ((out = fopen(outName, "w")) == NULL)
+      error(1, 0, "Cannot open %s", outName);
+  } else if (baselineName != NULL) {
+    out = NULL;
+  }
+  FILE* saved = NULL;
+  if (saveBaselineName != NULL) {
+    if ((saved = fopen(saveBaselineName, "w")) == NULL)
+      error(1, 0, "Cannot open %s", saveBaselineName);
+    fprintf(saved, "# kernel topology width height median mad ci_low ci_high "
+                   "(seconds)\n");
+  }
+  if (baselineName != NULL)
+    printf("%-16s %-8s %11s %12s %12s %9s  verdict (threshold %.1f%%)\n",
+           "# kernel", "topology", "size", "base(ms)", "now(ms)", "change",
+           threshold);
+
+  // Plan all jobs, with one generated image per size and topology
+  Image srcs[MAX_SIZES][NUM_TOPOLOGIES];
+  static Job jobs[MAX_SIZES * NUM_TOPOLOGIES * NUM_KERNELS];
+  int numJobs = 0;
+  for (int s = 0; s < numSizes; s++) {
+    for (int t = 0; t < NUM_TOPOLOGIES; t++) {
+      srcs[s][t] = topologies[t].generate(sizes[s], sizes[s]);
+      for (int k = 0; k < NUM_KERNELS; k++) {
+        const Kernel* kernel = &kernels[k];
+        if (filter != NULL && strstr(kernel->name, filter) == NULL) continue;
+        if (kernel->maxPixels != 0 &&
+            (double)sizes[s] * sizes[s] > kernel->maxPixels)
+          continue;
+        Job* job = &jobs[numJobs++];
+        job->kernel = kernel;
+        job->topology = &topologies[t];
+        job->src = srcs[s][t];
+        job->samples = malloc((size_t)rounds * reps * sizeof(Sample));
+        if (job->samples == NULL) error(1, errno, "malloc");
+        job->numSamples = 0;
+      }
+    }
+  }
+
+  // Rounds go over all jobs, so each job is spread over the whole run
+  for (int round = 0; round < rounds; round++) {
+    for (int j = 0; j < numJobs; j++) {
+      InstrRegionBegin(jobs[j].kernel->name);
+      measure(&jobs[j], warmup, reps);
+      InstrRegionEnd();
+    }
+  }
+
+  if (out != NULL) printHeader(out, json);
+  int regressions = 0;
+  for (int j = 0; j < numJobs; j++) {
+    Result r;
+    summarize(&jobs[j], reps, &r);
+    if (out != NULL) printResult(out, json, &r, j == 0);
+    if (saved != NULL) saveBaselineEntry(saved, &r);
+    if (baselineName != NULL)
+      regressions += compareBaseline(stdout, &r, threshold / 100.0);
+    free(jobs[j].samples);
+  }
+  for (int s = 0; s < numSizes; s++)
+    for (int t = 0; t < NUM_TOPOLOGIES; t++) ImageDestroy(&srcs[s][t]);
+  if (out != NULL) printFooter(out, json);
+
+  if (out != NULL && out != stdout) fclose(out);
+  if (saved != NULL) fclose(saved);
+  if (traceName != NULL && !InstrTraceSave(traceName))
+    error(1, 0, "Cannot write %s", traceName);
+  remove(TMP_PPM);
+  remove(TMP_PBM);
+  remove(TMP_LBL);
+  InstrPerfClose();
+
+  if (baselineName != NULL) {
+    printf("# %d case(s) regressed\n", regressions);
+    if (regressions > 0) return 2;
+  }
+  return 0;
+}
@@ -20,8 +20,11 @@
 /// InstrPrint();  // to show time and counters
 
 #include "instrumentation.h"
+#include <assert.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 /// Cpu time in seconds
 double cpu_time(void) ; ///
@@ -42,6 +45,46 @@ double cpu_time(void) {
   return (double)current_time.tv_sec + 1.0e-9 * (double)current_time.tv_nsec;
 }
 
+double thread_cpu_time(void) {
+  struct timespec current_time;
+
+  if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &current_time) != 0)
+    return -1.0; // clock_gettime() failed!!!
+  return (double)current_time.tv_sec + 1.0e-9 * (double)current_time.tv_nsec;
+}
+
+double wall_time(void) {
+  struct timespec current_time;
+
+  if (clock_gettime(CLOCK_MONOTONIC, &current_time) != 0)
+    return -1.0; // clock_gettime() failed!!!
+  return (double)current_time.tv_sec + 1.0e-9 * (double)current_time.tv_nsec;
+}
+
+//
+// Lock protecting the registry of thread counters
+//
+
+#include <pthread.h>
+
+static pthread_mutex_t registry_lock = PTHREAD_MUTEX_INITIALIZER;
+#define REGISTRY_LOCK() pthread_mutex_lock(&registry_lock)
+#define REGISTRY_UNLOCK() pthread_mutex_unlock(&registry_lock)
+
+//
+// Relaxed atomics for the memory accounting (no ordering is needed:
+// each value is a statistic on its own)
+//
+
+#define ATOMIC_LOAD(p) __atomic_load_n((p), __ATOMIC_RELAXED)
+#define ATOMIC_STORE(p, v) __atomic_store_n((p), (v), __ATOMIC_RELAXED)
+// Add d to *p and return the new value
+#define ATOMIC_ADD(p, d) __atomic_add_fetch((p), (d), __ATOMIC_RELAXED)
+// If *p == *expected store desired and return 1, else load *expected
+#define ATOMIC_CAS(p, expected, desired)                     \
+  __atomic_compare_exchange_n((p), (expected), (desired), 1, \
+                              __ATOMIC_RELAXED, __ATOMIC_RELAXED)
+
 #endif
 
 
@@ -66,10 +109,59 @@ double cpu_time(void) {
   return (double)current_time.QuadPart / (double)frequency.QuadPart;
 }
 
+double thread_cpu_time(void) {
+  FILETIME creation, exit, kernel, user;
+  ULARGE_INTEGER t;
+
+  if (!GetThreadTimes(GetCurrentThread(), &creation, &exit, &kernel, &user))
+    return -1.0;
+  t.LowPart = user.dwLowDateTime;
+  t.HighPart = user.dwHighDateTime;
+  return 1.0e-7 * (double)t.QuadPart;  // 100ns units
+}
+
+double wall_time(void) {
+  static LARGE_INTEGER frequency;
+  static int first_time = 1;
+  LARGE_INTEGER current_time;
+
+  if (first_time != 0) {
+    QueryPerformanceFrequency(&frequency);
+    first_time = 0;
+  }
+  QueryPerformanceCounter(&current_time);
+  return (double)current_time.QuadPart / (double)frequency.QuadPart;
+}
+
+//
+// Lock protecting the registry of thread counters
+//
+
+static SRWLOCK registry_lock = SRWLOCK_INIT;
+#define REGISTRY_LOCK() AcquireSRWLockExclusive(&registry_lock)
+#define REGISTRY_UNLOCK() ReleaseSRWLockExclusive(&registry_lock)
+
+//
+// Atomics for the memory accounting
+//
+
+#define ATOMIC_LOAD(p) InterlockedCompareExchange64((p), 0, 0)
+#define ATOMIC_STORE(p, v) InterlockedExchange64((p), (v))
+// Add d to *p and return the new value
+#define ATOMIC_ADD(p, d) (InterlockedExchangeAdd64((p), (d)) + (d))
+
+// If *p == *expected store desired and return 1, else load *expected
+static int ATOMIC_CAS(long long* p, long long* expected, long long desired) {
+  long long old = InterlockedCompareExchange64(p, desired, *expected);
+  if (old == *expected) return 1;
+  *expected = old;
+  return 0;
+}
+
 #endif
 
-/// Array of operation counters:
-unsigned long InstrCount[NUMCOUNTERS];  ///extern
+/// Array of operation counters (one copy per thread):
+INSTR_THREAD_LOCAL unsigned long InstrCount[NUMCOUNTERS];  ///extern
 
 /// Array of names for the counters:
 char* InstrName[NUMCOUNTERS] = {NULL};  ///extern
@@ -82,29 +174,305 @@ double InstrTime;  ///extern
 /// Calibrated Time Unit (in seconds, initially 1s)
 double InstrCTU = 1.0;  ///extern
 
+/// Array of names for the memory categories:
+char* InstrMemName[INSTR_NUMMEM] = {NULL};  ///extern
+
+/// Array of names for the high-water marks:
+char* InstrHighName[INSTR_NUMHIGH] = {NULL};  ///extern
+
+// Memory categories and high-water marks (see InstrMemStat).
+// Updated with atomics, so that allocating threads never wait for the
+// registry lock.
+static struct {
+  long long current, peak, allocs, reallocs;
+} mem[INSTR_NUMMEM];
+static long long mem_total;       // current bytes over all categories
+static long long mem_total_peak;  // peak of mem_total
+static long long high[INSTR_NUMHIGH];
+
+// Registry of the counter arrays of registered threads.
+// Free slots have count == NULL.
+static struct {
+  const char* name;
+  unsigned long* count;  // the thread's own InstrCount
+} registry[INSTR_MAX_THREADS];
+
+// Counts of threads that have already unregistered
+static unsigned long retired_count[NUMCOUNTERS];
+
+// Registry slot of the calling thread (-1 if not registered)
+static INSTR_THREAD_LOCAL int thread_slot = -1;
+
+// Set if InstrThreadTryRegister found the registry full
+static INSTR_THREAD_LOCAL int thread_unlisted = 0;
+
+// Register the calling thread, if there is a free slot.
+// Returns nonzero on success. Requires the registry lock.
+static int try_register_locked(const char* name) {
+  if (thread_slot >= 0) {
+    registry[thread_slot].name = name;
+    return 1;
+  }
+  for (int t = 0; t < INSTR_MAX_THREADS; t++) {
+    if (registry[t].count == NULL) {
+      registry[t].name = name;
+      registry[t].count = InstrCount;
+      thread_slot = t;
+      return 1;
+    }
+  }
+  return 0;
+}
+
+// Register the calling thread. Requires the registry lock.
+static void register_locked(const char* name) {
+  if (try_register_locked(name)) return;
+  fprintf(stderr, "instrumentation: more than %d threads registered\n",
+          INSTR_MAX_THREADS);
+  abort();
+}
+
+// Add up counters of all registered threads (and of finished ones).
+// The calling thread is included even if it is not registered.
+// Requires the registry lock.
+static void sum_locked(unsigned long total[NUMCOUNTERS]) {
+  for (int i = 0; i < NUMCOUNTERS; i++)
+    total[i] = retired_count[i];
+  for (int t = 0; t < INSTR_MAX_THREADS; t++) {
+    if (registry[t].count == NULL) continue;
+    for (int i = 0; i < NUMCOUNTERS; i++)
+      total[i] += registry[t].count[i];
+  }
+  if (thread_slot < 0) {
+    for (int i = 0; i < NUMCOUNTERS; i++)
+      total[i] += InstrCount[i];
+  }
+}
+
+/// Names of the hardware events:
+const char* InstrPerfName[INSTR_NUMPERF] = {
+    "cycles", "instructions", "cache-misses", "branch-misses", "dTLB-misses"};
+
+// File descriptors of the open hardware events (-1 if not available)
+static int perf_fd[INSTR_NUMPERF] = {-1, -1, -1, -1, -1};
+
+#if defined(__linux__)
+
+//
+// GNU/Linux hardware performance counters
+//
+
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+// Open one counting event for this thread and its future children.
+static int perf_open(uint32_t type, uint64_t config) {
+  struct perf_event_attr attr;
+  memset(&attr, 0, sizeof(attr));
+  attr.size = sizeof(attr);
+  attr.type = type;
+  attr.config = config;
+  attr.disabled = 1;
+  attr.inherit = 1;         // count threads created later, too
+  attr.exclude_kernel = 1;  // allowed with perf_event_paranoid <= 2
+  attr.exclude_hv = 1;
+  attr.read_format =
+      PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+  return (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+int InstrPerfOpen(void) { ///
+  static const uint32_t type[INSTR_NUMPERF] = {
+      PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE,
+      PERF_TYPE_HARDWARE, PERF_TYPE_HW_CACHE};
+  static const uint64_t config[INSTR_NUMPERF] = {
+      PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS,
+      PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES,
+      PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+          (PERF_COUNT_HW_CACHE_RESULT_MISS << 16)};
+  int opened = 0;
+
+  InstrPerfClose();
+  for (int e = 0; e < INSTR_NUMPERF; e++) {
+    perf_fd[e] = perf_open(type[e], config[e]);
+    if (perf_fd[e] < 0) {
+      perf_fd[e] = -1;
+      continue;
+    }
+    ioctl(perf_fd[e], PERF_EVENT_IOC_RESET, 0);
+    ioctl(perf_fd[e], PERF_EVENT_IOC_ENABLE, 0);
+    opened++;
+  }
+  return opened;
+}
+
+void InstrPerfClose(void) { ///
+  for (int e = 0; e < INSTR_NUMPERF; e++) {
+    if (perf_fd[e] >= 0) close(perf_fd[e]);
+    perf_fd[e] = -1;
+  }
+}
+
+// Restart the open hardware counters from zero.
+static void perf_reset(void) {
+  for (int e = 0; e < INSTR_NUMPERF; e++)
+    if (perf_fd[e] >= 0) ioctl(perf_fd[e], PERF_EVENT_IOC_RESET, 0);
+}
+
+void InstrPerfRead(long long values[INSTR_NUMPERF]) { ///
+  for (int e = 0; e < INSTR_NUMPERF; e++) {
+    uint64_t data[3];  // value, time enabled, time running
+    values[e] = -1;
+    if (perf_fd[e] < 0 || read(perf_fd[e], data, sizeof(data)) != sizeof(data))
+      continue;
+    if (data[2] == 0) {
+      values[e] = 0;  // never scheduled on the PMU
+    } else if (data[2] < data[1]) {
+      values[e] = (long long)((double)data[0] * data[1] / data[2]);
+    } else {
+      values[e] = (long long)data[0];
+    }
+  }
+}
+
+#else
+
+//
+// No hardware counters on other systems
+//
+
+int InstrPerfOpen(void) { return 0; } ///
+
+void InstrPerfClose(void) {} ///
+
+static void perf_reset(void) {}
+
+void InstrPerfRead(long long values[INSTR_NUMPERF]) { ///
+  for (int e = 0; e < INSTR_NUMPERF; e++) values[e] = -1;
+}
+
+#endif
+
+// Iterations of the calibration loop that make up one CTU
+#define CALIBRATION_ITERATIONS 40000000
+// Iterations in each short calibration trial, and number of trials
+#define CALIBRATION_TRIAL 262144
+#define CALIBRATION_TRIALS 7
+
+// Sink for the calibration result, so the loop is not optimized away
+static volatile int calibration_sink;
+
+// Run one calibration trial and return the cpu time it took.
+// A xorshift generator replaces rand(), whose cost used to dominate.
+static double calibration_trial(uint32_t seed) {
+  enum { size = 4*1024, mask = size - 1 };  // 2^12!
+  static unsigned array[size];  // unsigned: wrap-around is well defined
+  uint32_t x = seed | 1u;
+  double time = cpu_time();
+  for (int n = 0; n < CALIBRATION_TRIAL; n++) {
+    x ^= x << 13; x ^= x >> 17; x ^= x << 5;
+    int i = (int)(x & mask);
+    int j = (int)((x >> 12) & mask);
+    int k = (int)((x >> 20) & mask);
+    array[k] ^= array[i] + array[j] + (unsigned)(i * j);
+  }
+  time = cpu_time() - time;
+  calibration_sink = (int)array[x & mask];
+  return time;
+}
+
+// Estimate the CTU from the fastest of a few short trials
+// (the fastest one is the least disturbed by the rest of the system).
+static double calibration_measure(void) {
+  double best = calibration_trial(2463534242u);  // warm-up
+  for (int t = 0; t < CALIBRATION_TRIALS; t++) {
+    double time = calibration_trial(2463534242u + (uint32_t)t);
+    if (time > 0.0 && time < best) best = time;
+  }
+  return best * ((double)CALIBRATION_ITERATIONS / CALIBRATION_TRIAL);
+}
+
 /// Find the Calibrated Time Unit (CTU).
 /// Run and time a loop of basic memory and arithmetic operations to set
 /// a reasonably cpu-independent time unit.
 void InstrCalibrate(void) { ///
-  const int size = 4*1024;     // 2^12!
-  const int mask = size - 1;
-  int array[size];  // alloc array in stack, not initialized on purpose
-  double time = cpu_time();
-  srand((unsigned int)(time*1e9));
-  for (int n = 0; n < 40000000; n++) {
-    int i = rand() & mask;
-    int j = rand() & mask;
-    int k = rand() & mask;
-    array[k] ^= array[i] + array[j] + i*j;
-    //printf("%d %d %d\n", i, j, k);  // debug
+  const char* cache = getenv("INSTR_CTU_CACHE");
+  if (cache != NULL && cache[0] != '\0') {
+    InstrCalibrateCached(cache);
+    return;
+  }
+  InstrCTU = calibration_measure();
+}
+
+// Copy a name for this cpu model into buf (no tabs or newlines).
+static void cpu_model(char* buf, size_t size) {
+  snprintf(buf, size, "unknown");
+#if defined(__linux__)
+  FILE* f = fopen("/proc/cpuinfo", "r");
+  if (f == NULL) return;
+  char line[256];
+  while (fgets(line, sizeof(line), f) != NULL) {
+    char* colon = strchr(line, ':');
+    if (strncmp(line, "model name", 10) != 0 || colon == NULL) continue;
+    colon += strspn(colon + 1, " ") + 1;
+    snprintf(buf, size, "%s", colon);
+    break;
+  }
+  fclose(f);
+#endif
+  for (char* c = buf; *c != '\0'; c++)
+    if (*c == '\t' || *c == '\n') *c = (c[1] == '\0') ? '\0' : ' ';
+}
+
+/// Find the CTU using a cache file with one "cpu-model<TAB>ctu" per line.
+int InstrCalibrateCached(const char* filename) { ///
+  char model[200];
+  char line[256];
+  cpu_model(model, sizeof(model));
+
+  FILE* f = fopen(filename, "r");
+  if (f != NULL) {
+    size_t len = strlen(model);
+    while (fgets(line, sizeof(line), f) != NULL) {
+      double ctu;
+      if (strncmp(line, model, len) == 0 && line[len] == '\t' &&
+          sscanf(line + len + 1, "%lf", &ctu) == 1 && ctu > 0.0) {
+        fclose(f);
+        InstrCTU = ctu;
+        return 1;
+      }
+    }
+    fclose(f);
+  }
+
+  // Not cached: measure and store
+  InstrCTU = calibration_measure();
+  f = fopen(filename, "a");
+  if (f != NULL) {
+    fprintf(f, "%s\t%.9g\n", model, InstrCTU);
+    fclose(f);
   }
-  InstrCTU = cpu_time() - time;
+  return 0;
 }
 
 /// Reset counters to zero and store cpu_time.
+/// Counters of all registered threads are reset, and the calling thread
+/// is registered (as "main") if it was not yet.
 void InstrReset(void) { ///
+  REGISTRY_LOCK();
+  if (thread_slot < 0) register_locked("main");
+  for (int t = 0; t < INSTR_MAX_THREADS; t++) {
+    if (registry[t].count == NULL) continue;
+    for (int i = 0; i < NUMCOUNTERS; i++)
+      registry[t].count[i] = 0ul;
+  }
   for (int i = 0; i < NUMCOUNTERS; i++)
-    InstrCount[i] = 0ul;
+    retired_count[i] = 0ul;
+  REGISTRY_UNLOCK();
+  InstrMemResetPeaks();
+  perf_reset();
   InstrTime = cpu_time();
 }
 
@@ -114,16 +482,418 @@ void InstrPrint(void) { ///
   double time = cpu_time() - InstrTime;
   // compute time in calibrated time units:
   double caltime = time / InstrCTU;
+  // counters of all threads:
+  unsigned long total[NUMCOUNTERS];
+  REGISTRY_LOCK();
+  sum_locked(total);
+  REGISTRY_UNLOCK();
+  // hardware counters (if open):
+  long long perf[INSTR_NUMPERF];
+  InstrPerfRead(perf);
 
   printf("#%14.15s\t%15.15s", "time", "caltime");
   for (int i = 0; i < NUMCOUNTERS; i++)
     if (InstrName[i] != NULL)
       printf("\t%15.15s", InstrName[i]);
+  for (int e = 0; e < INSTR_NUMPERF; e++)
+    if (perf[e] >= 0)
+      printf("\t%15.15s", InstrPerfName[e]);
   puts("");
   printf("%15.6f\t%15.6f", time, caltime);
   for (int i = 0; i < NUMCOUNTERS; i++)
     if (InstrName[i] != NULL)
-      printf("\t%15lu", InstrCount[i]);  
+      printf("\t%15lu", total[i]);  
+  for (int e = 0; e < INSTR_NUMPERF; e++)
+    if (perf[e] >= 0)
+      printf("\t%15lld", perf[e]);
   puts("");
+
+  // memory categories and high-water marks (if named):
+  int named = 0;
+  for (int c = 0; c < INSTR_NUMMEM; c++) named |= InstrMemName[c] != NULL;
+  for (int i = 0; i < INSTR_NUMHIGH; i++) named |= InstrHighName[i] != NULL;
+  if (!named) return;
+  printf("#%14.15s\t%15.15s\t%15.15s\t%15.15s\t%15.15s\n", "memory",
+         "current(B)", "peak(B)", "allocs", "reallocs");
+  for (int c = 0; c < INSTR_NUMMEM; c++)
+    if (InstrMemName[c] != NULL) {
+      InstrMemStat m;
+      InstrMemRead(c, &m);
+      printf("%15.15s\t%15lld\t%15lld\t%15lu\t%15lu\n", InstrMemName[c],
+             m.current, m.peak, m.allocs, m.reallocs);
+    }
+  printf("%15.15s\t%15lld\t%15lld\n", "(total)", InstrMemCurrentTotal(),
+         InstrMemPeakTotal());
+  for (int i = 0; i < INSTR_NUMHIGH; i++)
+    if (InstrHighName[i] != NULL)
+      printf("%15.15s\t%15s\t%15lu\n", InstrHighName[i], "",
+             InstrHighRead(i));
+}
+
+/// Register the calling thread's counters under the given name.
+void InstrThreadRegister(const char* name) { ///
+  REGISTRY_LOCK();
+  register_locked(name);
+  REGISTRY_UNLOCK();
+}
+
+/// Like InstrThreadRegister, but if the registry is full the thread
+/// runs unregistered instead of aborting.
+int InstrThreadTryRegister(const char* name) { ///
+  REGISTRY_LOCK();
+  int ok = try_register_locked(name);
+  thread_unlisted = !ok;
+  REGISTRY_UNLOCK();
+  return ok;
+}
+
+/// Add the calling thread's counters to the totals of finished threads
+/// and unregister it.
+void InstrThreadUnregister(void) { ///
+  REGISTRY_LOCK();
+  if (thread_slot >= 0) {
+    for (int i = 0; i < NUMCOUNTERS; i++)
+      retired_count[i] += InstrCount[i];
+    registry[thread_slot].count = NULL;
+    registry[thread_slot].name = NULL;
+    thread_slot = -1;
+  } else if (thread_unlisted) {
+    for (int i = 0; i < NUMCOUNTERS; i++)
+      retired_count[i] += InstrCount[i];
+    thread_unlisted = 0;
+  }
+  REGISTRY_UNLOCK();
+}
+
+// Print one line of counters per registered thread
+void InstrPrintThreads(void) { ///
+  printf("#%14.15s", "thread");
+  for (int i = 0; i < NUMCOUNTERS; i++)
+    if (InstrName[i] != NULL)
+      printf("\t%15.15s", InstrName[i]);
+  puts("");
+  REGISTRY_LOCK();
+  for (int t = 0; t < INSTR_MAX_THREADS; t++) {
+    if (registry[t].count == NULL) continue;
+    printf("%12.12s#%02d", registry[t].name ? registry[t].name : "?", t);
+    for (int i = 0; i < NUMCOUNTERS; i++)
+      if (InstrName[i] != NULL)
+        printf("\t%15lu", registry[t].count[i]);
+    puts("");
+  }
+  printf("%15.15s", "(finished)");
+  for (int i = 0; i < NUMCOUNTERS; i++)
+    if (InstrName[i] != NULL)
+      printf("\t%15lu", retired_count[i]);
+  puts("");
+  REGISTRY_UNLOCK();
+}
+
+/// Snapshot the calling thread's counters and thread cpu time.
+void InstrSnapshotThread(InstrSnap* snap) { ///
+  snap->time = thread_cpu_time();
+  for (int i = 0; i < NUMCOUNTERS; i++)
+    snap->count[i] = InstrCount[i];
+}
+
+/// Snapshot the counters added up over all threads and process cpu time.
+void InstrSnapshot(InstrSnap* snap) { ///
+  REGISTRY_LOCK();
+  sum_locked(snap->count);
+  REGISTRY_UNLOCK();
+  snap->time = cpu_time();
+}
+
+/// Compute diff = after - before.
+void InstrSnapDiff(const InstrSnap* before, const InstrSnap* after,
+                   InstrSnap* diff) { ///
+  diff->time = after->time - before->time;
+  for (int i = 0; i < NUMCOUNTERS; i++)
+    diff->count[i] = after->count[i] - before->count[i];
+}
+
+
+
+//
+// Timing regions
+//
+
+// A finished region, as stored in the trace
+typedef struct {
+  const char* name;
+  const char* parent;                 // enclosing region (NULL if none)
+  int tid;                            // registry slot + 1 (0: unregistered)
+  int depth;                          // nesting level (0: outermost)
+  double start;                       // wall time (seconds)
+  double dur;                         // wall time (seconds)
+  unsigned long count[NUMCOUNTERS];   // counter increments inside the region
+} TraceEvent;
+
+// Ring buffer with the most recent INSTR_TRACE_CAPACITY regions.
+// trace_total counts all regions ever recorded (since the last clear).
+static TraceEvent trace[INSTR_TRACE_CAPACITY];
+static unsigned long trace_total;
+static double trace_epoch;
+static volatile int trace_on;
+
+// Stack of the calling thread's open regions
+static INSTR_THREAD_LOCAL struct {
+  const char* name;
+  double start;
+  unsigned long count[NUMCOUNTERS];
+} open_region[INSTR_MAX_DEPTH];
+static INSTR_THREAD_LOCAL int open_depth;
+
+/// Turn recording of timing regions on (nonzero) or off.
+void InstrTraceEnable(int on) { ///
+  REGISTRY_LOCK();
+  if (on && trace_total == 0) trace_epoch = wall_time();
+  trace_on = on;
+  REGISTRY_UNLOCK();
+}
+
+/// Discard all recorded regions and restart the trace clock.
+void InstrTraceClear(void) { ///
+  REGISTRY_LOCK();
+  trace_total = 0;
+  trace_epoch = wall_time();
+  REGISTRY_UNLOCK();
+}
+
+/// Open a region named name (a string that outlives the trace).
+void InstrRegionBegin(const char* name) { ///
+  if (!trace_on) return;
+  int d = open_depth++;
+  if (d >= INSTR_MAX_DEPTH) return;  // too deep: not recorded
+  open_region[d].name = name;
+  for (int i = 0; i < NUMCOUNTERS; i++)
+    open_region[d].count[i] = InstrCount[i];
+  open_region[d].start = wall_time();
 }
 
+/// Close the innermost open region and record it.
+void InstrRegionEnd(void) { ///
+  if (!trace_on || open_depth == 0) return;
+  double end = wall_time();
+  int d = --open_depth;
+  if (d >= INSTR_MAX_DEPTH) return;
+
+  REGISTRY_LOCK();
+  TraceEvent* e = &trace[trace_total % INSTR_TRACE_CAPACITY];
+  e->name = open_region[d].name;
+  e->parent = d > 0 ? open_region[d - 1].name : NULL;
+  e->tid = thread_slot + 1;
+  e->depth = d;
+  e->start = open_region[d].start;
+  e->dur = end - open_region[d].start;
+  for (int i = 0; i < NUMCOUNTERS; i++)
+    e->count[i] = InstrCount[i] - open_region[d].count[i];
+  trace_total++;
+  REGISTRY_UNLOCK();
+}
+
+// Index range [first, trace_total) of the regions still in the buffer
+static unsigned long trace_first(void) {
+  return trace_total > INSTR_TRACE_CAPACITY
+             ? trace_total - INSTR_TRACE_CAPACITY
+             : 0;
+}
+
+// Write s as a JSON string
+static void json_string(FILE* f, const char* s) {
+  fputc('"', f);
+  for (; *s != '\0'; s++) {
+    if (*s == '"' || *s == '\\') fputc('\\', f);
+    if ((unsigned char)*s >= 0x20) fputc(*s, f);
+  }
+  fputc('"', f);
+}
+
+/// Save the recorded regions in Chrome trace-event format.
+int InstrTraceSave(const char* filename) { ///
+  FILE* f = fopen(filename, "w");
+  if (f == NULL) return 0;
+
+  REGISTRY_LOCK();
+  fprintf(f, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n");
+  // Thread names, for the registered threads
+  fprintf(f, "  {\"ph\": \"M\", \"pid\": 1, \"tid\": 0, "
+             "\"name\": \"thread_name\", \"args\": {\"name\": \"(unregistered)\"}}");
+  for (int t = 0; t < INSTR_MAX_THREADS; t++) {
+    if (registry[t].count == NULL) continue;
+    fprintf(f, ",\n  {\"ph\": \"M\", \"pid\": 1, \"tid\": %d, "
+               "\"name\": \"thread_name\", \"args\": {\"name\": ", t + 1);
+    json_string(f, registry[t].name ? registry[t].name : "?");
+    fprintf(f, "}}");
+  }
+  // One complete ("X") event per region, with its counters as arguments
+  for (unsigned long k = trace_first(); k < trace_total; k++) {
+    const TraceEvent* e = &trace[k % INSTR_TRACE_CAPACITY];
+    fprintf(f, ",\n  {\"ph\": \"X\", \"pid\": 1, \"tid\": %d, \"name\": ",
+            e->tid);
+    json_string(f, e->name);
+    fprintf(f, ", \"ts\": %.3f, \"dur\": %.3f, \"args\": {",
+            1e6 * (e->start - trace_epoch), 1e6 * e->dur);
+    const char* sep = "";
+    for (int i = 0; i < NUMCOUNTERS; i++) {
+      if (InstrName[i] == NULL) continue;
+      fprintf(f, "%s", sep);
+      json_string(f, InstrName[i]);
+      fprintf(f, ": %lu", e->count[i]);
+      sep = ", ";
+    }
+    fprintf(f, "}}");
+  }
+  fprintf(f, "\n]}\n");
+  REGISTRY_UNLOCK();
+
+  return fclose(f) == 0;
+}
+
+// Compare region names (NULL is the top level)
+static int same_name(const char* a, const char* b) {
+  if (a == NULL || b == NULL) return a == b;
+  return strcmp(a, b) == 0;
+}
+
+/// Print, per region, the number of calls and the total time.
+/// Regions are told apart by name and enclosing region name, and listed
+/// in order of first start, indented by depth.
+void InstrTracePrint(void) { ///
+  enum { MAXROWS = 64 };
+  struct {
+    const char* name;
+    const char* parent;
+    int depth;
+    double start;
+    unsigned long calls;
+    double total;
+  } row[MAXROWS], tmp;
+  int nrows = 0;
+
+  REGISTRY_LOCK();
+  unsigned long first = trace_first();
+  for (unsigned long k = first; k < trace_total; k++) {
+    const TraceEvent* e = &trace[k % INSTR_TRACE_CAPACITY];
+    int r = 0;
+    while (r < nrows && !(same_name(row[r].name, e->name) &&
+                          same_name(row[r].parent, e->parent)))
+      r++;
+    if (r == nrows) {
+      if (nrows == MAXROWS) continue;
+      row[r].name = e->name;
+      row[r].parent = e->parent;
+      row[r].depth = e->depth;
+      row[r].start = e->start;
+      row[r].calls = 0;
+      row[r].total = 0.0;
+      nrows++;
+    }
+    if (e->start < row[r].start) row[r].start = e->start;
+    row[r].calls++;
+    row[r].total += e->dur;
+  }
+  REGISTRY_UNLOCK();
+
+  // Insertion sort by first start (parents start before their children)
+  for (int i = 1; i < nrows; i++) {
+    tmp = row[i];
+    int j = i;
+    for (; j > 0 && row[j - 1].start > tmp.start; j--) row[j] = row[j - 1];
+    row[j] = tmp;
+  }
+
+  printf("#%-29.29s\t%10s\t%15s\t%15s\n", "region", "calls", "total(s)",
+         "mean(s)");
+  for (int r = 0; r < nrows; r++) {
+    int indent = 2 * (row[r].depth < 8 ? row[r].depth : 8);
+    printf("%*s%-*.*s\t%10lu\t%15.6f\t%15.6f\n", indent + 1, "",
+           29 - indent, 29 - indent, row[r].name, row[r].calls, row[r].total,
+           row[r].total / (double)row[r].calls);
+  }
+  if (first > 0)
+    printf("# (%lu older regions were overwritten)\n", first);
+}
+
+
+//
+// Memory accounting
+//
+
+// Raise *max to value, if value is larger.
+static void atomic_max(long long* max, long long value) {
+  long long old = ATOMIC_LOAD(max);
+  while (value > old && !ATOMIC_CAS(max, &old, value)) {
+  }
+}
+
+// Add delta bytes to category cat.
+static void mem_add(int cat, long long delta) {
+  atomic_max(&mem[cat].peak, ATOMIC_ADD(&mem[cat].current, delta));
+  atomic_max(&mem_total_peak, ATOMIC_ADD(&mem_total, delta));
+}
+
+/// Record an allocation of bytes in category cat.
+void InstrMemAlloc(int cat, size_t bytes) { ///
+  assert(0 <= cat && cat < INSTR_NUMMEM);
+  ATOMIC_ADD(&mem[cat].allocs, 1);
+  mem_add(cat, (long long)bytes);
+}
+
+/// Record that bytes of category cat were freed.
+void InstrMemFree(int cat, size_t bytes) { ///
+  assert(0 <= cat && cat < INSTR_NUMMEM);
+  mem_add(cat, -(long long)bytes);
+}
+
+/// Record that a buffer of category cat grew from oldBytes to newBytes.
+void InstrMemRealloc(int cat, size_t oldBytes, size_t newBytes) { ///
+  assert(0 <= cat && cat < INSTR_NUMMEM);
+  ATOMIC_ADD(&mem[cat].reallocs, 1);
+  // Both buffers exist while the contents are copied
+  mem_add(cat, (long long)newBytes);
+  mem_add(cat, -(long long)oldBytes);
+}
+
+/// Read the state of category cat.
+void InstrMemRead(int cat, InstrMemStat* stat) { ///
+  assert(0 <= cat && cat < INSTR_NUMMEM);
+  stat->current = ATOMIC_LOAD(&mem[cat].current);
+  stat->peak = ATOMIC_LOAD(&mem[cat].peak);
+  stat->allocs = (unsigned long)ATOMIC_LOAD(&mem[cat].allocs);
+  stat->reallocs = (unsigned long)ATOMIC_LOAD(&mem[cat].reallocs);
+}
+
+/// Bytes allocated now over all categories.
+long long InstrMemCurrentTotal(void) { ///
+  return ATOMIC_LOAD(&mem_total);
+}
+
+/// Peak of the bytes allocated over all categories since reset.
+long long InstrMemPeakTotal(void) { ///
+  return ATOMIC_LOAD(&mem_total_peak);
+}
+
+/// Raise high-water mark i to value, if value is larger.
+void InstrHighWater(int i, unsigned long value) { ///
+  assert(0 <= i && i < INSTR_NUMHIGH);
+  atomic_max(&high[i], (long long)value);
+}
+
+/// Read high-water mark i.
+unsigned long InstrHighRead(int i) { ///
+  assert(0 <= i && i < INSTR_NUMHIGH);
+  return (unsigned long)ATOMIC_LOAD(&high[i]);
+}
+
+/// Restart memory peaks and high-water marks.
+/// Updates made by other threads meanwhile may land on either side.
+void InstrMemResetPeaks(void) { ///
+  for (int c = 0; c < INSTR_NUMMEM; c++) {
+    ATOMIC_STORE(&mem[c].peak, ATOMIC_LOAD(&mem[c].current));
+    ATOMIC_STORE(&mem[c].allocs, 0);
+    ATOMIC_STORE(&mem[c].reallocs, 0);
+  }
+  ATOMIC_STORE(&mem_total_peak, ATOMIC_LOAD(&mem_total));
+  for (int i = 0; i < INSTR_NUMHIGH; i++) ATOMIC_STORE(&high[i], 0);
+}
@@ -22,14 +22,41 @@
 #ifndef INSTRUMENTATION_H
 #define INSTRUMENTATION_H
 
+#include <stddef.h>
+
+/// Instrumentation level compiled into the image modules
+/// (set with -DIMAGE_INSTR=n, see the Makefile):
+///   0: release build, counting and memory accounting compiled out
+///   1: pixel accesses, memory and high-water marks (default)
+///   2: also detailed counters (see imageRGB.c)
+#ifndef IMAGE_INSTR
+#define IMAGE_INSTR 1
+#endif
+
 /// Cpu time in seconds
 double cpu_time(void) ; ///
 
+/// Cpu time of the calling thread in seconds
+double thread_cpu_time(void) ; ///
+
+/// Wall-clock (monotonic) time in seconds
+double wall_time(void) ; ///
+
 /// Ten counters should be more than enough
 #define NUMCOUNTERS 10
 
-/// Array of operation counters:
-extern unsigned long InstrCount[NUMCOUNTERS];  ///extern
+/// Storage class for per-thread data
+#if defined(_MSC_VER)
+#define INSTR_THREAD_LOCAL __declspec(thread)
+#else
+#define INSTR_THREAD_LOCAL _Thread_local
+#endif
+
+/// Array of operation counters.
+/// Each thread increments its own copy, so counting is race-free and
+/// never bounces cache lines between cores.
+/// InstrPrint and InstrSnapshot add up the copies of registered threads.
+extern INSTR_THREAD_LOCAL unsigned long InstrCount[NUMCOUNTERS];  ///extern
 
 /// Array of names for the counters:
 extern char* InstrName[NUMCOUNTERS];  ///extern
@@ -43,12 +70,222 @@ extern double InstrCTU;  ///extern
 /// Find the Calibrated Time Unit (CTU).
 /// Run and time a loop of basic memory and arithmetic operations to set
 /// a reasonably cpu-independent time unit.
+/// The CTU is the time of 40 million loop iterations, estimated from a
+/// few short trials (a few milliseconds in total).
+/// If the environment variable INSTR_CTU_CACHE names a file, the CTU is
+/// taken from (or stored in) that file, as in InstrCalibrateCached.
 void InstrCalibrate(void) ;
 
+/// Find the CTU using a cache file with one "cpu-model<TAB>ctu" per line.
+/// If the file has an entry for this cpu model, it is reused without
+/// measuring; otherwise the CTU is measured and appended to the file.
+/// Returns nonzero if the CTU came from the cache.
+int InstrCalibrateCached(const char* filename) ;
+
 /// Reset counters to zero and store cpu_time.
 void InstrReset(void) ;
 
+/// Print time and counters, added up over all registered threads.
 void InstrPrint(void) ;
 
+/// Multithreaded use:
+///
+/// void* worker(void* arg) {
+///   InstrThreadRegister("worker");  // make counts visible to InstrPrint
+///   ...  // InstrCount[i] += ... as usual
+///   InstrThreadUnregister();  // keep the counts after the thread ends
+///   return NULL;
+/// }
+///
+/// The thread that calls InstrReset is registered automatically.
+/// InstrReset and InstrPrint should be called while workers are idle.
+
+/// Maximum number of simultaneously registered threads
+#define INSTR_MAX_THREADS 64
+
+/// Register the calling thread's counters under the given name.
+/// Aborts if INSTR_MAX_THREADS threads are already registered.
+void InstrThreadRegister(const char* name) ;
+
+/// Like InstrThreadRegister, but if the registry is full the thread runs
+/// unregistered: its counts are not seen by InstrPrint until it calls
+/// InstrThreadUnregister, which adds them to the totals as usual.
+/// For short-lived helper threads, whose number need not be bounded by
+/// the registry.  Returns nonzero if the thread was registered.
+int InstrThreadTryRegister(const char* name) ;
+
+/// Add the calling thread's counters to the totals of finished threads
+/// and unregister it.  Call before the thread exits.
+void InstrThreadUnregister(void) ;
+
+/// Print one line of counters per registered thread.
+void InstrPrintThreads(void) ;
+
+/// Hardware performance counters
+///
+/// On Linux, InstrPerfOpen uses perf_event_open(2) to count the events
+/// below for the calling thread and the threads it creates afterwards.
+/// While open, InstrReset restarts them and InstrPrint shows them as
+/// extra columns.  Events the kernel refuses (no PMU, containers,
+/// perf_event_paranoid) are silently left out.
+
+/// Number of hardware events
+#define INSTR_NUMPERF 5
+
+/// Names of the hardware events:
+/// cycles, instructions, cache-misses, branch-misses, dTLB-misses
+extern const char* InstrPerfName[INSTR_NUMPERF];  ///extern
+
+/// Open the hardware counters.
+/// Returns the number of events available (0 if none or not on Linux).
+int InstrPerfOpen(void) ;
+
+/// Close the hardware counters.
+void InstrPerfClose(void) ;
+
+/// Read the hardware counters since the last InstrReset.
+/// Unavailable events read as -1.
+/// Values are scaled up if the kernel had to multiplex the counters.
+void InstrPerfRead(long long values[INSTR_NUMPERF]) ;
+
+/// A snapshot of the counters
+typedef struct {
+  double time;                        // cpu time when taken (~seconds)
+  unsigned long count[NUMCOUNTERS];   // counter values
+} InstrSnap;
+
+/// Snapshot the calling thread's counters and thread cpu time.
+/// Takes no lock: cheap enough to use inside parallel code.
+void InstrSnapshotThread(InstrSnap* snap) ;
+
+/// Snapshot the counters added up over all threads and process cpu time.
+void InstrSnapshot(InstrSnap* snap) ;
+
+/// Compute diff = after - before.
+void InstrSnapDiff(const InstrSnap* before, const InstrSnap* after,
+                   InstrSnap* diff) ;
+
+/// Memory accounting
+///
+/// Modules report their allocations in up to INSTR_NUMMEM categories,
+/// named in InstrMemName (like the counters).  For each category, the
+/// current and peak bytes and the numbers of allocations and of
+/// reallocations (buffers that had to grow) are kept for all threads.
+/// InstrReset restarts the peaks from the current values and zeroes the
+/// numbers of (re)allocations.  InstrPrint shows the named categories.
+///
+/// Use the INSTR_MEM_* macros, which compile to nothing in release builds.
+
+/// Number of memory categories
+#define INSTR_NUMMEM 4
+
+/// Array of names for the memory categories:
+extern char* InstrMemName[INSTR_NUMMEM];  ///extern
+
+/// Record an allocation of bytes in category cat.
+void InstrMemAlloc(int cat, size_t bytes) ;
+
+/// Record that bytes of category cat were freed.
+void InstrMemFree(int cat, size_t bytes) ;
+
+/// Record that a buffer of category cat grew from oldBytes to newBytes.
+void InstrMemRealloc(int cat, size_t oldBytes, size_t newBytes) ;
+
+/// State of a memory category
+typedef struct {
+  long long current;        // bytes allocated now
+  long long peak;           // largest value of current since InstrReset
+  unsigned long allocs;     // allocations since InstrReset
+  unsigned long reallocs;   // reallocations since InstrReset
+} InstrMemStat;
+
+/// Read the state of category cat.
+void InstrMemRead(int cat, InstrMemStat* stat) ;
+
+/// Bytes allocated now, and peak since reset, over all categories.
+long long InstrMemCurrentTotal(void) ;
+long long InstrMemPeakTotal(void) ;
+
+/// High-water marks of other quantities, such as the largest frontier
+/// (stack or queue size) reached by a flood fill.
+/// Named in InstrHighName; InstrReset sets them to zero.
+
+/// Number of high-water marks
+#define INSTR_NUMHIGH 4
+
+/// Array of names for the high-water marks:
+extern char* InstrHighName[INSTR_NUMHIGH];  ///extern
+
+/// Raise high-water mark i to value, if value is larger.
+void InstrHighWater(int i, unsigned long value) ;
+
+/// Read high-water mark i.
+unsigned long InstrHighRead(int i) ;
+
+/// Restart memory peaks, (re)allocation numbers and high-water marks,
+/// leaving the counters alone (InstrReset does this too), e.g., to
+/// measure each run of a benchmark separately.
+void InstrMemResetPeaks(void) ;
+
+#if IMAGE_INSTR >= 1
+#define INSTR_MEM_ALLOC(cat, bytes) InstrMemAlloc((cat), (bytes))
+#define INSTR_MEM_FREE(cat, bytes) InstrMemFree((cat), (bytes))
+#define INSTR_MEM_REALLOC(cat, oldBytes, newBytes) \
+  InstrMemRealloc((cat), (oldBytes), (newBytes))
+#define INSTR_HIGH_WATER(i, value) InstrHighWater((i), (value))
+#else
+#define INSTR_MEM_ALLOC(cat, bytes) ((void)0)
+#define INSTR_MEM_FREE(cat, bytes) ((void)0)
+#define INSTR_MEM_REALLOC(cat, oldBytes, newBytes) ((void)0)
+#define INSTR_HIGH_WATER(i, value) ((void)0)
 #endif
 
+/// Timing regions
+///
+/// Named regions split a run into phases, and may be nested:
+///
+/// InstrTraceEnable(1);
+/// InstrRegionBegin("load");
+/// ...
+/// InstrRegionEnd();
+/// InstrRegionBegin("fill");
+///   InstrRegionBegin("scan");  // a sub-phase of "fill"
+///   ...
+///   InstrRegionEnd();
+/// InstrRegionEnd();
+/// InstrTracePrint();  // calls and total time per region
+/// InstrTraceSave("trace.json");  // open in chrome://tracing or Perfetto
+///
+/// Each finished region records its wall time and the counter increments
+/// of the calling thread in a ring buffer that keeps the most recent
+/// INSTR_TRACE_CAPACITY regions.  Every thread has its own nesting.
+/// While recording is off (the default), Begin and End return at once.
+
+/// Capacity of the ring buffer of regions
+#define INSTR_TRACE_CAPACITY 4096
+
+/// Deepest nesting recorded (deeper regions are ignored)
+#define INSTR_MAX_DEPTH 32
+
+/// Turn recording of regions on (nonzero) or off.
+/// Only switch while no region is open.
+void InstrTraceEnable(int on) ;
+
+/// Discard all recorded regions; times are then relative to now.
+void InstrTraceClear(void) ;
+
+/// Open a region.  name is kept by reference: use a string literal.
+void InstrRegionBegin(const char* name) ;
+
+/// Close the innermost open region of the calling thread.
+void InstrRegionEnd(void) ;
+
+/// Print, per region, the number of calls and the total time.
+void InstrTracePrint(void) ;
+
+/// Save the recorded regions as Chrome trace-event JSON.
+/// Threads appear under their InstrThreadRegister names.
+/// Returns nonzero on success.
+int InstrTraceSave(const char* filename) ;
+
+#endif
@@ -1,6 +1,6 @@
 // testOptimized.c - Testes específicos para as 8 funções otimizadas
 //
-// Compila com: gcc -Wall -Wextra -O2 -g -o testOptimized testOptimized.c imageRGB.c instrumentation.c error.c PixelCoords.c PixelCoordsQueue.c PixelCoordsStack.c
+// Compila com: gcc -Wall -Wextra -O2 -g -pthread -o testOptimized testOptimized.c imageRGB.c imageBatch.c instrumentation.c error.c PixelCoords.c PixelCoordsQueue.c PixelCoordsStack.c
 // Executa: ./testOptimized
 // OU
 // ./testOptimized --perf (para teste de performance)
@@ -30,11 +30,14 @@
 
 
 #include <assert.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
+#include "PixelCoords.h"
 #include "error.h"
+#include "imageBatch.h"
 #include "imageRGB.h"
 #include "instrumentation.h"
 
@@ -296,11 +299,1374 @@ void test_ImageSegmentation() {
     ImageDestroy(&white);
 }
 
+// ============================================================================
+// TESTE 9: Transformações diedrais
+// ============================================================================
+void test_ImageTransforms() {
+    printf("\n=== TESTE 9: Transformações diedrais ===\n");
+    
+    // Imagem não quadrada e sem simetrias (paleta)
+    Image original = ImageCreatePalete(150, 70, 10);
+    
+    // 270° = 3x90°
+    Image r90 = ImageRotate90CW(original);
+    Image r180 = ImageRotate90CW(r90);
+    Image r270 = ImageRotate90CW(r180);
+    Image direct270 = ImageRotate270CW(original);
+    test("Rotação 270° = 3x90°", ImageIsEqual(r270, direct270));
+    
+    // Espelhos são involuções e FlipH + FlipV = 180°
+    Image fh = ImageFlipHorizontal(original);
+    Image fh2 = ImageFlipHorizontal(fh);
+    Image fhv = ImageFlipVertical(fh);
+    test("FlipH 2x = original", ImageIsEqual(original, fh2));
+    test("FlipH + FlipV = 180°", ImageIsEqual(fhv, r180));
+    
+    // Transposta troca dimensões e é involução
+    Image t = ImageTranspose(original);
+    Image t2 = ImageTranspose(t);
+    test("Transposta troca dimensões",
+         ImageWidth(t) == 70 && ImageHeight(t) == 150);
+    test("Transposta 2x = original", ImageIsEqual(original, t2));
+    
+    // Composição: 90° seguido de FlipH numa só passagem
+    ImageTransform c = ImageTransformCompose(IMAGE_ROTATE_90CW, IMAGE_FLIP_H);
+    Image chained = ImageFlipHorizontal(r90);
+    Image single = ImageApplyTransform(original, c);
+    test("90° + FlipH = Transposta", c == IMAGE_TRANSPOSE);
+    test("Composição numa passagem = cadeia", ImageIsEqual(chained, single));
+    
+    // Todas as 64 composições coincidem com a aplicação em cadeia
+    int allOk = 1;
+    for (int a = 0; a <= IMAGE_TRANSVERSE; a++) {
+        Image ia = ImageApplyTransform(original, (ImageTransform)a);
+        for (int b = 0; b <= IMAGE_TRANSVERSE; b++) {
+            Image iab = ImageApplyTransform(ia, (ImageTransform)b);
+            Image one = ImageApplyTransform(
+                original, ImageTransformCompose((ImageTransform)a, (ImageTransform)b));
+            allOk = allOk && ImageIsEqual(iab, one);
+            ImageDestroy(&iab);
+            ImageDestroy(&one);
+        }
+        Image back = ImageApplyTransform(ia, ImageTransformInverse((ImageTransform)a));
+        allOk = allOk && ImageIsEqual(back, original);
+        ImageDestroy(&back);
+        ImageDestroy(&ia);
+    }
+    test("8x8 composições e inversas consistentes", allOk);
+    
+    ImageDestroy(&original);
+    ImageDestroy(&r90);
+    ImageDestroy(&r180);
+    ImageDestroy(&r270);
+    ImageDestroy(&direct270);
+    ImageDestroy(&fh);
+    ImageDestroy(&fh2);
+    ImageDestroy(&fhv);
+    ImageDestroy(&t);
+    ImageDestroy(&t2);
+    ImageDestroy(&chained);
+    ImageDestroy(&single);
+}
+
+// ============================================================================
+// TESTE 10: ImageView (vistas preguiçosas)
+// ============================================================================
+void test_ImageView() {
+    printf("\n=== TESTE 10: ImageView ===\n");
+    
+    Image original = ImageCreatePalete(90, 50, 10);
+    
+    // Vista rodada = rotação materializada
+    ImageView view = ImageViewCreate(original, IMAGE_ROTATE_90CW);
+    Image r90 = ImageRotate90CW(original);
+    test("Vista 90° troca dimensões",
+         ImageViewWidth(view) == 50 && ImageViewHeight(view) == 90);
+    test("Vista 90° = ImageRotate90CW", ImageViewIsEqual(view, r90));
+    
+    // Gravar a vista = gravar a rotação materializada
+    ImageViewSavePPM(view, "test_view90.ppm");
+    Image loaded = ImageLoadPPM("test_view90.ppm");
+    Image r90load = ImageCopy(r90);
+    ImageSavePPM(r90load, "test_rotate90.ppm");
+    ImageDestroy(&r90load);
+    r90load = ImageLoadPPM("test_rotate90.ppm");
+    test("ImageViewSavePPM = ImageSavePPM da rotação", ImageIsEqual(loaded, r90load));
+    ImageDestroy(&loaded);
+    ImageDestroy(&r90load);
+    
+    // Transformar a vista compõe as orientações
+    ImageViewTransform(view, IMAGE_FLIP_H);
+    Image t = ImageTranspose(original);
+    test("Vista 90° + FlipH = Transposta", ImageViewIsEqual(view, t));
+    
+    // Recorte sobre vista rodada
+    ImageViewCrop(view, 5, 10, 20, 30);
+    Image mat = ImageViewMaterialize(view);
+    ImageView tv = ImageViewCreate(t, IMAGE_IDENTITY);
+    int cropOk = ImageWidth(mat) == 20 && ImageHeight(mat) == 30;
+    for (int y = 0; y < 30 && cropOk; y++)
+        for (int x = 0; x < 20 && cropOk; x++)
+            cropOk = ImageViewGetPixel(view, x, y) ==
+                     ImageViewGetPixel(tv, x + 5, y + 10);
+    test("Recorte lê os píxeis certos", cropOk);
+    test("Recorte materializado = vista", ImageViewIsEqual(view, mat));
+    ImageViewDestroy(&tv);
+    ImageViewDestroy(&view);
+    test("ImageViewDestroy anula ponteiro", view == NULL);
+    
+    // Segmentação através da vista = segmentar a imagem materializada
+    Image chess = ImageCreateChess(60, 40, 10, 0x000000);
+    Image chess2 = ImageCopy(chess);
+    ImageView cv = ImageViewCreate(chess, IMAGE_ROTATE_270CW);
+    Image expected = ImageViewMaterialize(cv);
+    int r1 = ImageSegmentation(expected, ImageRegionFillingWithQUEUE);
+    int r2 = ImageViewSegmentation(cv, ImageRegionFillingWithQUEUE);
+    test("Segmentação pela vista = mesma nº regiões", r1 == r2);
+    test("Segmentação pela vista = mesmos labels", ImageViewIsEqual(cv, expected));
+    ImageViewDestroy(&cv);
+    
+    // Com recorte, o preenchimento fica confinado ao retângulo
+    ImageView crop = ImageViewCreate(chess2, IMAGE_IDENTITY);
+    ImageViewCrop(crop, 5, 5, 10, 10);
+    int r3 = ImageViewSegmentation(crop, ImageRegionFillingWithSTACK);
+    ImageView full = ImageViewCreate(chess2, IMAGE_IDENTITY);
+    test("Recorte 10x10 sobre chess 10 = 4 regiões", r3 == 4);
+    test("Píxel fora do recorte intacto", ImageViewGetPixel(full, 0, 0) == BLACK);
+    test("Píxel dentro do recorte rotulado", ImageViewGetPixel(full, 5, 5) >= 2);
+    ImageViewDestroy(&full);
+    ImageViewDestroy(&crop);
+    
+    ImageDestroy(&original);
+    ImageDestroy(&r90);
+    ImageDestroy(&t);
+    ImageDestroy(&mat);
+    ImageDestroy(&chess);
+    ImageDestroy(&chess2);
+    ImageDestroy(&expected);
+}
+
+// ============================================================================
+// TESTE 11: ImageSubView / ImageCrop (regiões de interesse)
+// ============================================================================
+struct roiJob {
+    Image roi;
+    int regions;
+};
+
+static void* roiWorker(void* arg) {
+    struct roiJob* job = arg;
+    job->regions = ImageSegmentation(job->roi, ImageRegionFillingWithSTACK);
+    return NULL;
+}
+
+void test_ImageSubView() {
+    printf("\n=== TESTE 11: ImageSubView / ImageCrop ===\n");
+    
+    // Quadrante superior esquerdo (40x40) é preto
+    Image page = ImageCreateChess(80, 80, 40, 0x000000);
+    Image before = ImageCopy(page);
+    Image roi = ImageSubView(page, 10, 10, 20, 20);
+    
+    test("Sub-imagem tem as dimensões do ROI",
+         ImageWidth(roi) == 20 && ImageHeight(roi) == 20);
+    
+    // Preenchimento confinado ao ROI (não ao quadrante inteiro)
+    int count = ImageRegionFillingWithQUEUE(roi, 0, 0, 2);
+    test("Fill confinado ao ROI = 400 píxeis", count == 400);
+    
+    // A escrita vê-se na imagem mãe, e só dentro do retângulo
+    Image crop = ImageCrop(page, 10, 10, 20, 20);
+    test("ImageCrop = conteúdo da sub-imagem", ImageIsEqual(crop, roi));
+    Image outside = ImageCrop(page, 0, 0, 10, 80);
+    Image outside0 = ImageCrop(before, 0, 0, 10, 80);
+    test("Fora do ROI nada muda", ImageIsEqual(outside, outside0));
+    ImageDestroy(&roi);
+    test("Mãe intacta após destruir sub-imagem", ImageWidth(page) == 80);
+    
+    // Segmentação por ladrilhos: 4 sub-imagens 40x40 da mesma página
+    Image tiled = ImageCreateChess(80, 80, 20, 0x000000);
+    int total = 0;
+    for (uint32 ty = 0; ty < 80; ty += 40) {
+        for (uint32 tx = 0; tx < 80; tx += 40) {
+            Image tile = ImageSubView(tiled, tx, ty, 40, 40);
+            total += ImageSegmentation(tile, ImageRegionFillingWithSTACK);
+            test("LUT partilhada com a mãe", ImageColors(tile) == ImageColors(tiled));
+            ImageDestroy(&tile);
+        }
+    }
+    test("4 ladrilhos x 4 quadrados = 16 regiões", total == 16);
+    test("LUT da mãe = 2 + 16 cores", ImageColors(tiled) == 18);
+    
+    // Duas threads a segmentar metades disjuntas da mesma imagem
+    Image noise = ImageCreateNoise(80, 40, 0.45, 11);
+    struct roiJob jobs[2] = {{ImageSubView(noise, 0, 0, 40, 40), 0},
+                             {ImageSubView(noise, 40, 0, 40, 40), 0}};
+    Image left = ImageCrop(noise, 0, 0, 40, 40);
+    Image right = ImageCrop(noise, 40, 0, 40, 40);
+    pthread_t roiThreads[2];
+    for (int t = 0; t < 2; t++)
+        pthread_create(&roiThreads[t], NULL, roiWorker, &jobs[t]);
+    for (int t = 0; t < 2; t++)
+        pthread_join(roiThreads[t], NULL);
+    test("ROIs em paralelo: mesmas regiões que em sequência",
+         jobs[0].regions == ImageSegmentation(left, ImageRegionFillingWithSTACK) &&
+         jobs[1].regions == ImageSegmentation(right, ImageRegionFillingWithSTACK));
+    int n = ImageColors(noise);
+    test("ROIs em paralelo: um label por região",
+         n == 2 + jobs[0].regions + jobs[1].regions);
+    size_t countsL[1000] = {0}, countsR[1000] = {0};
+    ImageHistogram(jobs[0].roi, countsL);
+    ImageHistogram(jobs[1].roi, countsR);
+    int distinct = 1;
+    for (int k = 2; k < n; k++)
+        distinct &= (countsL[k] > 0) != (countsR[k] > 0);
+    test("ROIs em paralelo: labels usados e só num ROI", distinct);
+    ImageDestroy(&jobs[0].roi);
+    ImageDestroy(&jobs[1].roi);
+    ImageDestroy(&left);
+    ImageDestroy(&right);
+    ImageDestroy(&noise);
+    
+    ImageDestroy(&page);
+    ImageDestroy(&before);
+    ImageDestroy(&crop);
+    ImageDestroy(&outside);
+    ImageDestroy(&outside0);
+    ImageDestroy(&tiled);
+}
+
+// ============================================================================
+// TESTE 12: Contadores de instrumentação por thread
+// ============================================================================
+#define NTHREADS 4
+
+static void* copyWorker(void* arg) {
+    Image img = (Image)arg;
+    InstrThreadRegister("copy");
+    for (int k = 0; k < 10; k++) {
+        Image copy = ImageCopy(img);  // PIXMEM += 100x100
+        ImageDestroy(&copy);
+    }
+    InstrThreadUnregister();
+    return NULL;
+}
+
+void test_InstrThreads() {
+    printf("\n=== TESTE 12: Instrumentação por thread ===\n");
+    
+    Image img = ImageCreate(100, 100);
+    pthread_t threads[NTHREADS];
+    InstrSnap before, after, diff, mine;
+    
+    InstrReset();
+    InstrSnapshot(&before);
+    for (int t = 0; t < NTHREADS; t++)
+        pthread_create(&threads[t], NULL, copyWorker, img);
+    for (int t = 0; t < NTHREADS; t++)
+        pthread_join(threads[t], NULL);
+    InstrSnapshot(&after);
+    InstrSnapDiff(&before, &after, &diff);
+    InstrSnapshotThread(&mine);
+    
+    test("Soma das threads = 4 x 10 x 10000 pixmem",
+         diff.count[0] == NTHREADS * 10 * 10000ul);
+    test("Contador da thread principal não é afetado", mine.count[0] == 0);
+    
+    ImageDestroy(&img);
+}
+
+// ============================================================================
+// TESTE 13: Calibração rápida com cache
+// ============================================================================
+void test_InstrCalibrate() {
+    printf("\n=== TESTE 13: Calibração (InstrCalibrate) ===\n");
+    
+    double t0 = cpu_time();
+    InstrCalibrate();
+    double elapsed = cpu_time() - t0;
+    test("Calibração demora menos de 0.2 s", elapsed < 0.2);
+    test("CTU positivo", InstrCTU > 0.0);
+    
+    // A primeira chamada mede e grava; a segunda reutiliza
+    remove("test_ctu.cache");
+    int hit1 = InstrCalibrateCached("test_ctu.cache");
+    double ctu1 = InstrCTU;
+    int hit2 = InstrCalibrateCached("test_ctu.cache");
+    test("Cache vazia -> mede", hit1 == 0);
+    test("Segunda chamada usa a cache", hit2 == 1);
+    test("CTU da cache = CTU medido",
+         ctu1 > 0.0 && (InstrCTU - ctu1) / ctu1 < 1e-6 &&
+         (ctu1 - InstrCTU) / ctu1 < 1e-6);
+    remove("test_ctu.cache");
+}
+
+// ============================================================================
+// TESTE 14: Regiões de tempo e trace
+// ============================================================================
+void test_InstrTrace() {
+    printf("\n=== TESTE 14: Regiões de tempo (InstrRegion) ===\n");
+    
+    Image img = ImageCreateChess(64, 64, 8, 0x000000);
+    
+    InstrTraceClear();
+    InstrTraceEnable(1);
+    InstrRegionBegin("pipeline");
+    ImageSavePBM(img, "test_trace.pbm");
+    Image loaded = ImageLoadPBM("test_trace.pbm");
+    ImageSegmentation(loaded, ImageRegionFillingWithQUEUE);
+    InstrRegionEnd();
+    InstrTraceEnable(0);
+    
+    int ok = InstrTraceSave("test_trace.json");
+    test("InstrTraceSave escreve o ficheiro", ok);
+    
+    // Cada fase deve aparecer no JSON
+    char text[16384];
+    FILE* f = fopen("test_trace.json", "r");
+    size_t n = f ? fread(text, 1, sizeof(text) - 1, f) : 0;
+    text[n] = '\0';
+    if (f) fclose(f);
+    test("JSON no formato trace-event", strstr(text, "\"traceEvents\"") != NULL);
+    const char* phases[] = {"\"pipeline\"", "\"ImageSavePBM\"",
+                            "\"ImageLoadPBM\"", "\"header\"", "\"pixels\"",
+                            "\"segmentation\"", "\"normalize\"", "\"label\""};
+    int found = 1;
+    for (size_t i = 0; i < sizeof(phases) / sizeof(phases[0]); i++)
+        found = found && strstr(text, phases[i]) != NULL;
+    test("Fases de load, save e segmentação registadas", found);
+    
+    // Com o registo desligado nada é acrescentado
+    InstrTraceClear();
+    ImageSegmentation(loaded, ImageRegionFillingWithQUEUE);
+    InstrTraceSave("test_trace.json");
+    f = fopen("test_trace.json", "r");
+    n = f ? fread(text, 1, sizeof(text) - 1, f) : 0;
+    text[n] = '\0';
+    if (f) fclose(f);
+    test("Registo desligado -> sem regiões", strstr(text, "\"ph\": \"X\"") == NULL);
+    
+    remove("test_trace.pbm");
+    remove("test_trace.json");
+    ImageDestroy(&loaded);
+    ImageDestroy(&img);
+}
+
+// ============================================================================
+// TESTE 15: Contabilização de memória e fronteira dos preenchimentos
+// ============================================================================
+void test_InstrMemory() {
+    printf("\n=== TESTE 15: Memória (InstrMem) ===\n");
+    
+    InstrReset();
+    long long base = InstrMemCurrentTotal();
+    
+    Image img = ImageCreate(200, 100);
+    long long used = InstrMemCurrentTotal() - base;
+    test("Imagem 200x100 conta pelo menos os píxeis (40000 B)", used >= 40000);
+    
+    // Uma região sólida obriga a STACK a crescer
+    ImageRegionFillingWithSTACK(img, 0, 0, 2);
+    InstrMemStat coords;
+    InstrMemRead(PIXELCOORDS_MEM, &coords);
+    test("STACK cresceu (reallocs > 0)", coords.reallocs > 0);
+    test("Buffers de coordenadas libertados", coords.current == 0);
+    test("Pico inclui os buffers de coordenadas",
+         InstrMemPeakTotal() - base > used);
+    test("Fronteira máxima registada", InstrHighRead(0) > 1);
+
+    // Buffers reutilizados: a fronteira de cada preenchimento recomeça
+    ImageScratchEnable();
+    ImageRegionFillingWithSTACK(img, 0, 0, 3);
+    ImageRegionFillingWithQUEUE(img, 0, 0, 2);
+    InstrMemResetPeaks();
+    Image tiny = ImageCreate(3, 3);
+    ImageRegionFillingWithSTACK(tiny, 0, 0, 2);
+    ImageRegionFillingWithQUEUE(tiny, 0, 0, 3);
+    ImageScratchRelease();
+    test("Scratch: fronteira máxima só do último preenchimento",
+         InstrHighRead(0) > 0 && InstrHighRead(0) <= 9);
+    ImageDestroy(&tiny);
+
+    ImageDestroy(&img);
+    test("Memória volta ao valor inicial", InstrMemCurrentTotal() == base);
+}
+
+// ============================================================================
+// TESTE 16: Geradores de imagens sintéticas
+// ============================================================================
+static int countBlack(Image img) {
+    ImageView view = ImageViewCreate(img, IMAGE_IDENTITY);
+    int n = 0;
+    for (uint32 v = 0; v < ImageHeight(img); v++)
+        for (uint32 u = 0; u < ImageWidth(img); u++)
+            n += ImageViewGetPixel(view, u, v) == BLACK;
+    ImageViewDestroy(&view);
+    return n;
+}
+
+void test_Generators() {
+    printf("\n=== TESTE 16: Geradores sintéticos ===\n");
+    
+    // Labirinto: 1 corredor + uma parede por cada linha ímpar
+    Image maze = ImageCreateMaze(31, 20);
+    Image copy = ImageCopy(maze);
+    int filled = ImageRegionFillingWithQUEUE(copy, 0, 0, 2);
+    test("Labirinto: corredor único", filled == 31 * 20 - countBlack(maze));
+    test("Labirinto: 1 + 10 regiões",
+         ImageSegmentation(maze, ImageRegionFillingWithSTACK) == 11);
+    ImageDestroy(&copy);
+    ImageDestroy(&maze);
+    
+    // Espiral: exatamente uma região branca e uma preta, para vários tamanhos
+    int spiralOk = 1;
+    for (uint32 w = 3; w <= 24; w++) {
+        for (uint32 h = 3; h <= 24; h += 7) {
+            Image spiral = ImageCreateSpiral(w, h);
+            spiralOk = spiralOk &&
+                ImageSegmentation(spiral, ImageRegionFillingWithQUEUE) == 2;
+            ImageDestroy(&spiral);
+        }
+    }
+    test("Espiral: 2 regiões em todos os tamanhos", spiralOk);
+    
+    // Anéis: distância à borda 0..19 com espessura 4 -> 5 anéis
+    Image rings = ImageCreateRings(40, 40, 4);
+    test("Anéis: 5 regiões",
+         ImageSegmentation(rings, ImageRegionFillingWithQUEUE) == 5);
+    ImageDestroy(&rings);
+    
+    // Ruído: densidade respeitada e determinístico para a mesma semente
+    Image n1 = ImageCreateNoise(200, 200, 0.3, 42);
+    Image n2 = ImageCreateNoise(200, 200, 0.3, 42);
+    Image n3 = ImageCreateNoise(200, 200, 0.3, 43);
+    int black = countBlack(n1);
+    test("Ruído: densidade ~0.3", black > 11400 && black < 12600);
+    test("Ruído: mesma semente -> mesma imagem", ImageIsEqual(n1, n2));
+    test("Ruído: outra semente -> outra imagem", !ImageIsEqual(n1, n3));
+    Image empty = ImageCreateNoise(50, 50, 0.0, 1);
+    Image full = ImageCreateNoise(50, 50, 1.0, 1);
+    test("Ruído: densidades 0 e 1",
+         countBlack(empty) == 0 && countBlack(full) == 2500);
+    ImageDestroy(&n1);
+    ImageDestroy(&n2);
+    ImageDestroy(&n3);
+    ImageDestroy(&empty);
+    ImageDestroy(&full);
+    
+    // Campo sólido de uma cor
+    Image solid = ImageCreateSolid(64, 32, RED);
+    test("Sólido: uma única região",
+         ImageRegionFillingWithSTACK(solid, 10, 10, 0) == 64 * 32);
+    ImageDestroy(&solid);
+}
+
+// ============================================================================
+// TESTE 17: Processamento em lote com várias threads
+// ============================================================================
+#define BATCH_N 12
+
+void test_Batch() {
+    printf("\n=== TESTE 17: Processamento em lote ===\n");
+    
+    // Buffers reutilizáveis: mesma segmentação que sem eles
+    Image a = ImageCreateNoise(120, 90, 0.45, 7);
+    Image b = ImageCopy(a);
+    int ra = ImageSegmentation(a, ImageRegionFillingWithSTACK);
+    ImageScratchEnable();
+    int rb = ImageSegmentation(b, ImageRegionFillingWithSTACK);
+    Image c = ImageCreateNoise(120, 90, 0.45, 7);
+    int rc = ImageSegmentation(c, ImageRegionFillingWithQUEUE);
+    ImageScratchRelease();
+    test("Scratch: mesmas regiões (STACK)", ra == rb && ImageIsEqual(a, b));
+    test("Scratch: mesmas regiões (QUEUE)", ra == rc && ImageIsEqual(a, c));
+    ImageDestroy(&a);
+    ImageDestroy(&b);
+    ImageDestroy(&c);
+    
+    // Ficheiros de entrada de tamanhos diferentes
+    char inNames[BATCH_N][32], outNames[BATCH_N][32];
+    const char* inputs[BATCH_N];
+    const char* outputs[BATCH_N];
+    for (int i = 0; i < BATCH_N; i++) {
+        snprintf(inNames[i], sizeof(inNames[i]), "test_batch_%d.pbm", i);
+        snprintf(outNames[i], sizeof(outNames[i]), "test_batch_%d.ppm", i);
+        inputs[i] = inNames[i];
+        outputs[i] = outNames[i];
+        Image img = ImageCreateNoise(20 + 15 * i, 30 + 7 * i, 0.4, i + 1);
+        ImageSavePBM(img, inNames[i]);
+        ImageDestroy(&img);
+    }
+    
+    // Referência sequencial: rodar 90 e segmentar
+    int expected[BATCH_N];
+    long long total = 0;
+    for (int i = 0; i < BATCH_N; i++) {
+        Image img = ImageLoadPBM(inputs[i]);
+        Image rot = ImageRotate90CW(img);
+        expected[i] = ImageSegmentation(rot, ImageRegionFillingWithQUEUE);
+        total += expected[i];
+        ImageDestroy(&img);
+        ImageDestroy(&rot);
+    }
+    
+    BatchOperation op = {IMAGE_ROTATE_90CW, ImageRegionFillingWithQUEUE};
+    int regions1[BATCH_N], regions4[BATCH_N];
+    BatchStats s1, s4;
+    ImageBatchProcess(inputs, NULL, BATCH_N, op, 1, regions1, &s1);
+    ImageBatchProcess(inputs, outputs, BATCH_N, op, 4, regions4, &s4);
+    
+    int same = 1;
+    for (int i = 0; i < BATCH_N; i++)
+        same = same && regions1[i] == expected[i] && regions4[i] == expected[i];
+    test("Lote: regiões iguais às da versão sequencial", same);
+    test("Lote: totais", s4.images == BATCH_N && s4.regions == total &&
+         s4.threads == 4 && s1.threads == 1 && s1.pixels == s4.pixels);
+    
+    // Os ficheiros gravados coincidem com o resultado sequencial
+    int saved = 1;
+    for (int i = 0; i < BATCH_N; i++) {
+        Image img = ImageLoadPBM(inputs[i]);
+        Image rot = ImageRotate90CW(img);
+        ImageSegmentation(rot, ImageRegionFillingWithQUEUE);
+        Image out = ImageLoadPPM(outputs[i]);
+        saved = saved && ImageIsEqual(rot, out);
+        ImageDestroy(&img);
+        ImageDestroy(&rot);
+        ImageDestroy(&out);
+    }
+    test("Lote: ficheiros gravados corretos", saved);
+    
+    // Mais threads do que imagens: usa só as necessárias
+    BatchStats s2;
+    ImageBatchProcess(inputs, NULL, 2, op, 8, NULL, &s2);
+    test("Lote: threads limitadas ao número de imagens", s2.threads == 2);
+    
+    // Mais threads do que lugares no registo da instrumentação
+    enum { MANY = INSTR_MAX_THREADS + 8 };
+    const char* manyInputs[MANY];
+    int manyRegions[MANY];
+    long long manyExpected = 0;
+    for (int i = 0; i < MANY; i++) {
+        manyInputs[i] = inputs[i % BATCH_N];
+        manyExpected += expected[i % BATCH_N];
+    }
+    BatchStats sMany;
+    ImageBatchProcess(manyInputs, NULL, MANY, op, MANY, manyRegions, &sMany);
+    test("Lote com INSTR_MAX_THREADS + 8 threads",
+         sMany.threads == MANY && sMany.regions == manyExpected);
+    
+    ImageBatchPrintStats(&s4);
+    for (int i = 0; i < BATCH_N; i++) {
+        remove(inNames[i]);
+        remove(outNames[i]);
+    }
+}
+
+// ============================================================================
+// TESTE 18: Preenchimento paralelo (BFS por níveis)
+// ============================================================================
+void test_RegionFillingParallel() {
+    printf("\n=== TESTE 18: Preenchimento paralelo ===\n");
+    
+    // Região grande e irregular: fronteiras acima do limiar paralelo
+    Image ref = ImageCreateNoise(2200, 2200, 0.1, 5);
+    Image base = ImageCopy(ref);
+    int expected = ImageRegionFillingWithQUEUE(ref, 1100, 1100, 2);
+    int sameAll = 1;
+    for (int threads = 1; threads <= 4; threads *= 2) {
+        Image img = ImageCopy(base);
+        int count = ImageRegionFillingParallelN(img, 1100, 1100, 2, threads);
+        sameAll = sameAll && count == expected && ImageIsEqual(img, ref);
+        ImageDestroy(&img);
+    }
+    test("Paralelo = QUEUE (1, 2 e 4 threads)", sameAll);
+    // Mais threads do que lugares no registo da instrumentação
+    Image many = ImageCopy(base);
+    test("Paralelo com INSTR_MAX_THREADS + 8 threads",
+         ImageRegionFillingParallelN(many, 1100, 1100, 2,
+                                     INSTR_MAX_THREADS + 8) == expected &&
+         ImageIsEqual(many, ref));
+    ImageDestroy(&many);
+    ImageDestroy(&ref);
+    ImageDestroy(&base);
+    
+    // Labirinto: fronteira sempre pequena, expandida só pela thread que chama
+    Image maze = ImageCreateMaze(301, 200);
+    Image maze2 = ImageCopy(maze);
+    test("Paralelo = QUEUE no labirinto",
+         ImageRegionFillingParallelN(maze, 0, 0, 2, 4) ==
+             ImageRegionFillingWithQUEUE(maze2, 0, 0, 2) &&
+         ImageIsEqual(maze, maze2));
+    ImageDestroy(&maze);
+    ImageDestroy(&maze2);
+    
+    // Pode ser usado como FillingFunction na segmentação
+    Image n1 = ImageCreateNoise(150, 100, 0.4, 9);
+    Image n2 = ImageCopy(n1);
+    int r1 = ImageSegmentation(n1, ImageRegionFillingParallel);
+    int r2 = ImageSegmentation(n2, ImageRegionFillingWithQUEUE);
+    test("Segmentação com o preenchimento paralelo",
+         r1 == r2 && ImageIsEqual(n1, n2));
+    ImageDestroy(&n1);
+    ImageDestroy(&n2);
+    
+    // Semente inválida e semente já com o label
+    Image small = ImageCreate(10, 10);
+    test("Paralelo: semente inválida", ImageRegionFillingParallel(small, -1, 3, 2) == 0);
+    test("Paralelo: label igual ao fundo cria um novo label",
+         ImageRegionFillingParallel(small, 3, 3, WHITE) == 100);
+    ImageDestroy(&small);
+}
+
+// ============================================================================
+// TESTE 19: Mapa de distâncias geodésicas
+// ============================================================================
+// Verifica que dist é um mapa de distâncias de BFS válido: as sementes têm 0
+// e cada outro pixel alcançado tem d-1 num vizinho e nenhum vizinho < d-1
+static int distancesConsistent(const uint32* dist, int W, int H) {
+    for (int v = 0; v < H; v++) {
+        for (int u = 0; u < W; u++) {
+            uint32 d = dist[v * W + u];
+            if (d == IMAGE_DIST_UNREACHED || d == 0) continue;
+            int hasPrev = 0;
+            const int du[4] = {1, -1, 0, 0}, dv[4] = {0, 0, 1, -1};
+            for (int k = 0; k < 4; k++) {
+                int x = u + du[k], y = v + dv[k];
+                if (x < 0 || x >= W || y < 0 || y >= H) continue;
+                uint32 dn = dist[y * W + x];
+                if (dn == IMAGE_DIST_UNREACHED) continue;
+                if (dn + 1 < d) return 0;
+                if (dn + 1 == d) hasPrev = 1;
+            }
+            if (!hasPrev) return 0;
+        }
+    }
+    return 1;
+}
+
+void test_RegionFillingDistances() {
+    printf("\n=== TESTE 19: Distâncias geodésicas ===\n");
+    
+    // Imagem vazia: distância de Manhattan à semente
+    Image img = ImageCreate(30, 20);
+    uint32 dist[30 * 20];
+    int us[2] = {0, 29}, vs[2] = {0, 19};
+    int count = ImageRegionFillingWithDistances(img, 1, us, vs, 2, dist);
+    int manhattan = 1;
+    for (int v = 0; v < 20; v++)
+        for (int u = 0; u < 30; u++)
+            manhattan = manhattan && dist[v * 30 + u] == (uint32)(u + v);
+    test("Uma semente: distância de Manhattan", count == 600 && manhattan);
+    ImageDestroy(&img);
+    
+    // Duas sementes em cantos opostos: distância à mais próxima
+    img = ImageCreate(30, 20);
+    ImageRegionFillingWithDistances(img, 2, us, vs, 2, dist);
+    int nearest = 1;
+    for (int v = 0; v < 20; v++)
+        for (int u = 0; u < 30; u++) {
+            uint32 a = u + v, b = (29 - u) + (19 - v);
+            nearest = nearest && dist[v * 30 + u] == (a < b ? a : b);
+        }
+    test("Duas sementes: distância à mais próxima", nearest);
+    ImageDestroy(&img);
+    
+    // Labirinto: mesmos píxeis que a QUEUE, mapa consistente, paredes fora
+    Image maze = ImageCreateMaze(41, 30);
+    Image maze2 = ImageCopy(maze);
+    uint32* mdist = malloc(41 * 30 * sizeof(uint32));
+    int seedU = 0, seedV = 0;
+    int filled = ImageRegionFillingWithDistances(maze, 1, &seedU, &seedV, 2, mdist);
+    test("Labirinto: mesmos píxeis que a QUEUE",
+         filled == ImageRegionFillingWithQUEUE(maze2, 0, 0, 2) &&
+         ImageIsEqual(maze, maze2));
+    ImageView mview = ImageViewCreate(maze, IMAGE_IDENTITY);
+    int reached = 1;
+    for (int v = 0; v < 30; v++)
+        for (int u = 0; u < 41; u++)
+            reached = reached && ((mdist[v * 41 + u] != IMAGE_DIST_UNREACHED) ==
+                                  (ImageViewGetPixel(mview, u, v) == 2));
+    ImageViewDestroy(&mview);
+    test("Labirinto: distância só nos píxeis preenchidos", reached);
+    test("Labirinto: mapa de distâncias consistente",
+         distancesConsistent(mdist, 41, 30));
+    free(mdist);
+    ImageDestroy(&maze);
+    ImageDestroy(&maze2);
+    
+    // Sementes inválidas ou de outra cor são ignoradas; regiões separadas
+    Image chess = ImageCreateChess(20, 20, 10, BLACK);
+    int cu[4] = {-5, 0, 5, 15}, cv[4] = {0, 15, 5, 5};
+    int n = ImageRegionFillingWithDistances(chess, 4, cu, cv, 3, NULL);
+    test("Sementes: inválidas ignoradas, regiões separadas preenchidas",
+         n == 200);
+    ImageDestroy(&chess);
+}
+
+// ============================================================================
+// TESTE 20: Imagens RLE e segmentação por runs
+// ============================================================================
+// Segmenta img em RLE e em denso e compara labels, LUT e número de regiões
+static int rleSegmentsLikeDense(Image img) {
+    ImageRLE rle = ImageRLEFromImage(img);
+    Image dense = ImageCopy(img);
+    int r1 = ImageRLESegmentation(rle);
+    int r2 = ImageSegmentation(dense, ImageRegionFillingWithQUEUE);
+    Image decoded = ImageRLEToImage(rle);
+    int same = r1 == r2 && ImageIsEqual(decoded, dense);
+    ImageDestroy(&decoded);
+    ImageDestroy(&dense);
+    ImageRLEDestroy(&rle);
+    return same;
+}
+
+void test_ImageRLE() {
+    printf("\n=== TESTE 20: Imagens RLE ===\n");
+    
+    // Conversão nos dois sentidos
+    Image chess = ImageCreateChess(90, 60, 7, RED);
+    ImageRLE rle = ImageRLEFromImage(chess);
+    Image back = ImageRLEToImage(rle);
+    test("RLE: ida e volta sem perdas", ImageIsEqual(chess, back));
+    test("RLE: dimensões", ImageRLEWidth(rle) == 90 && ImageRLEHeight(rle) == 60);
+    test("RLE: 13 runs por linha no xadrez", ImageRLERuns(rle) == 13 * 60);
+    ImageDestroy(&back);
+    ImageRLEDestroy(&rle);
+    test("RLE: destroy põe o ponteiro a NULL", rle == NULL);
+    ImageDestroy(&chess);
+    
+    // Segmentação por runs = segmentação densa
+    Image imgs[5] = {
+        ImageCreateMaze(61, 40), ImageCreateSpiral(33, 21),
+        ImageCreateRings(50, 30, 3), ImageCreateNoise(80, 60, 0.45, 3),
+        ImageLoadPBM("img/feep.pbm"),
+    };
+    int same = 1;
+    for (int i = 0; i < 5; i++) {
+        same = same && rleSegmentsLikeDense(imgs[i]);
+        ImageDestroy(&imgs[i]);
+    }
+    test("RLE: mesmos labels e LUT que ImageSegmentation", same);
+    
+    // Mais regiões do que labels disponíveis: o mesmo corte que em denso
+    Image noisy = ImageCreateNoise(300, 300, 0.5, 11);
+    test("RLE: limite de labels da LUT igual ao denso", rleSegmentsLikeDense(noisy));
+    ImageDestroy(&noisy);
+    
+    // Página "de texto": poucas runs, muito menos memória
+    Image page = ImageCreate(2000, 1000);
+    for (int v = 100; v < 900; v += 20)
+        for (int u = 100; u < 1900; u += 9)
+            for (int k = 0; k < 5; k++) ImageSetPixel(page, u + k, v, BLACK);
+    rle = ImageRLEFromImage(page);
+    test("RLE: memória < 1/10 da forma densa",
+         ImageRLEBytes(rle) * 10 < (size_t)2000 * 1000 * sizeof(uint16));
+    ImageRLEDestroy(&rle);
+    test("RLE: página segmentada como em denso", rleSegmentsLikeDense(page));
+    ImageDestroy(&page);
+}
+
+// ============================================================================
+// TESTE 21: Formato nativo LBL
+// ============================================================================
+static long fileSize(const char* filename) {
+    FILE* f = fopen(filename, "rb");
+    if (f == NULL) return -1;
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    fclose(f);
+    return size;
+}
+
+void test_FormatLBL() {
+    printf("\n=== TESTE 21: Formato LBL ===\n");
+    
+    // Imagem segmentada: labels e LUT preservados, com e sem compressão
+    Image img = ImageCreateRings(300, 200, 5);
+    int regions = ImageSegmentation(img, ImageRegionFillingWithQUEUE);
+    int saved = ImageSaveLBL(img, "test_lbl_raw.lbl", 0);
+    saved = saved && ImageSaveLBL(img, "test_lbl_rle.lbl", 1);
+    saved = saved && ImageSavePPM(img, "test_lbl.ppm");
+    Image bw = ImageCreateChess(30, 20, 5, 0x000000);
+    saved = saved && ImageSavePBM(bw, "test_lbl.pbm");
+    ImageDestroy(&bw);
+    test("Gravação bem sucedida devolve não-zero (LBL, PPM, PBM)", saved);
+    Image raw = ImageLoadLBL("test_lbl_raw.lbl");
+    Image rle = ImageLoadLBL("test_lbl_rle.lbl");
+    test("LBL: sem compressão igual ao original", ImageIsEqual(img, raw));
+    test("LBL: com runs igual ao original", ImageIsEqual(img, rle));
+    test("LBL: LUT preservada",
+         ImageColors(rle) == (uint16)(2 + regions));
+    test("LBL: tamanho sem compressão = 32 + LUT + píxeis",
+         fileSize("test_lbl_raw.lbl") ==
+             32 + 4L * ImageColors(img) + 2L * 300 * 200);
+    test("LBL: runs muito menores em anéis",
+         fileSize("test_lbl_rle.lbl") * 3 < fileSize("test_lbl_raw.lbl"));
+    
+    // A imagem carregada (bloco contíguo) funciona como qualquer outra
+    Image rings = ImageCreateRings(300, 200, 5);
+    ImageSaveLBL(rings, "test_lbl_raw.lbl", 0);
+    Image loaded = ImageLoadLBL("test_lbl_raw.lbl");
+    Image copy = ImageCopy(loaded);
+    test("LBL: imagem carregada pode ser copiada e segmentada",
+         ImageIsEqual(copy, rings) &&
+         ImageSegmentation(loaded, ImageRegionFillingWithSTACK) == regions &&
+         ImageIsEqual(loaded, img));
+    ImageDestroy(&copy);
+    ImageDestroy(&loaded);
+    ImageDestroy(&rings);
+    ImageDestroy(&raw);
+    ImageDestroy(&rle);
+    ImageDestroy(&img);
+    
+    // Runs maiores do que 65535 píxeis e ruído (runs curtas)
+    Image big = ImageCreate(700, 300);
+    ImageSetPixel(big, 699, 299, BLACK);
+    ImageSaveLBL(big, "test_lbl_rle.lbl", 1);
+    Image bigBack = ImageLoadLBL("test_lbl_rle.lbl");
+    test("LBL: runs longas divididas", ImageIsEqual(big, bigBack));
+    ImageDestroy(&big);
+    ImageDestroy(&bigBack);
+    Image noise = ImageCreateNoise(123, 77, 0.5, 4);
+    ImageSaveLBL(noise, "test_lbl_rle.lbl", 1);
+    Image noiseBack = ImageLoadLBL("test_lbl_rle.lbl");
+    test("LBL: ruído com runs", ImageIsEqual(noise, noiseBack));
+    ImageDestroy(&noiseBack);
+    
+    // Sub-imagens gravam só o recorte
+    Image sub = ImageSubView(noise, 10, 20, 50, 30);
+    Image crop = ImageCrop(noise, 10, 20, 50, 30);
+    ImageSaveLBL(sub, "test_lbl_raw.lbl", 0);
+    Image subBack = ImageLoadLBL("test_lbl_raw.lbl");
+    test("LBL: sub-imagem", ImageIsEqual(subBack, crop));
+    ImageDestroy(&subBack);
+    ImageDestroy(&crop);
+    ImageDestroy(&sub);
+    ImageDestroy(&noise);
+    
+    remove("test_lbl_raw.lbl");
+    remove("test_lbl_rle.lbl");
+    remove("test_lbl.ppm");
+    remove("test_lbl.pbm");
+}
+
+// ============================================================================
+// TESTE 22: Pipeline leitura / processamento / escrita
+// ============================================================================
+void test_BatchPipeline() {
+    printf("\n=== TESTE 22: Pipeline em lote ===\n");
+    
+    char inNames[BATCH_N][32], outNames[BATCH_N][32];
+    const char* inputs[BATCH_N];
+    const char* outputs[BATCH_N];
+    for (int i = 0; i < BATCH_N; i++) {
+        snprintf(inNames[i], sizeof(inNames[i]), "test_pipe_%d.pbm", i);
+        snprintf(outNames[i], sizeof(outNames[i]), "test_pipe_%d.lbl", i);
+        inputs[i] = inNames[i];
+        outputs[i] = outNames[i];
+        Image img = ImageCreateNoise(40 + 9 * i, 25 + 11 * i, 0.35, 100 + i);
+        ImageSavePBM(img, inNames[i]);
+        ImageDestroy(&img);
+    }
+    
+    BatchOperation op = {IMAGE_FLIP_H, ImageRegionFillingWithSTACK};
+    int expected[BATCH_N], got[BATCH_N], tight[BATCH_N];
+    BatchStats ref, s, s1;
+    ImageBatchProcess(inputs, NULL, BATCH_N, op, 2, expected, &ref);
+    ImageBatchPipeline(inputs, outputs, BATCH_N, op, 3, 0, got, &s);
+    // Filas de 1 imagem: cada etapa espera pela seguinte
+    ImageBatchPipeline(inputs, NULL, BATCH_N, op, 2, 1, tight, &s1);
+    
+    int same = 1;
+    for (int i = 0; i < BATCH_N; i++)
+        same = same && got[i] == expected[i] && tight[i] == expected[i];
+    test("Pipeline: mesmas regiões que ImageBatchProcess", same);
+    test("Pipeline: totais",
+         s.images == BATCH_N && s.regions == ref.regions &&
+         s.pixels == ref.pixels && s1.regions == ref.regions);
+    test("Pipeline: tempo de cada etapa medido",
+         s.readSeconds > 0.0 && s.computeSeconds > 0.0 && s.writeSeconds > 0.0);
+    
+    // Os resultados gravados em LBL coincidem com o processamento direto
+    int saved = 1;
+    for (int i = 0; i < BATCH_N; i++) {
+        Image img = ImageLoadPBM(inputs[i]);
+        Image flip = ImageFlipHorizontal(img);
+        ImageSegmentation(flip, ImageRegionFillingWithSTACK);
+        Image out = ImageLoadLBL(outputs[i]);
+        saved = saved && ImageIsEqual(flip, out);
+        ImageDestroy(&img);
+        ImageDestroy(&flip);
+        ImageDestroy(&out);
+    }
+    test("Pipeline: ficheiros LBL gravados corretos", saved);
+    
+    for (int i = 0; i < BATCH_N; i++) {
+        remove(inNames[i]);
+        remove(outNames[i]);
+    }
+}
+
+// ============================================================================
+// TESTE 23: Variantes ...Into (sem alocação em regime)
+// ============================================================================
+// Número de (re)alocações registadas desde o último InstrMemResetPeaks
+static unsigned long allocations() {
+    unsigned long n = 0;
+    for (int i = 0; i < INSTR_NUMMEM; i++) {
+        InstrMemStat stat;
+        InstrMemRead(i, &stat);
+        n += stat.allocs + stat.reallocs;
+    }
+    return n;
+}
+
+void test_DestinationPassing() {
+    printf("\n=== TESTE 23: Variantes Into ===\n");
+    
+    Image src = ImageCreateChess(120, 70, 9, BLUE);
+    Image ref90 = ImageRotate90CW(src);
+    Image ref180 = ImageRotate180CW(src);
+    
+    // Destino com outras dimensões: é redimensionado
+    Image dst = ImageCreate(5, 5);
+    ImageRotate90CWInto(dst, src);
+    test("Rotate90Into = Rotate90CW", ImageIsEqual(dst, ref90));
+    ImageRotate180CWInto(dst, src);
+    test("Rotate180Into = Rotate180CW", ImageIsEqual(dst, ref180));
+    ImageCopyInto(dst, ref90);
+    test("CopyInto = cópia", ImageIsEqual(dst, ref90));
+    
+    // Em regime (mesmas dimensões) não há alocações
+    Image out90 = ImageCreate(70, 120);
+    Image copy = ImageCreate(120, 70);
+    InstrMemResetPeaks();
+    long long before = InstrMemCurrentTotal();
+    for (int i = 0; i < 10; i++) {
+        ImageRotate90CWInto(out90, src);
+        ImageRotate180CWInto(copy, src);
+        ImageCopyInto(copy, src);
+    }
+    test("Em regime: nenhuma alocação", allocations() == 0 &&
+         InstrMemCurrentTotal() == before);
+    test("Em regime: resultados corretos",
+         ImageIsEqual(out90, ref90) && ImageIsEqual(copy, src));
+    
+    // Destino carregado de LBL (bloco contíguo) com o mesmo nº de píxeis
+    ImageSaveLBL(src, "test_into.lbl", 0);
+    Image loaded = ImageLoadLBL("test_into.lbl");
+    InstrMemResetPeaks();
+    ImageRotate90CWInto(loaded, src);
+    test("Bloco contíguo reaproveitado na transposição",
+         allocations() == 1 && ImageIsEqual(loaded, ref90));  // array de linhas
+    remove("test_into.lbl");
+    
+    ImageDestroy(&loaded);
+    ImageDestroy(&out90);
+    ImageDestroy(&copy);
+    ImageDestroy(&dst);
+    ImageDestroy(&ref90);
+    ImageDestroy(&ref180);
+    ImageDestroy(&src);
+}
+
+// ============================================================================
+// TESTE 24: Pool de imagens
+// ============================================================================
+void test_ImagePool() {
+    printf("\n=== TESTE 24: Pool de imagens ===\n");
+    
+    long long baseline = InstrMemCurrentTotal();
+    ImagePoolEnable(1 << 20);
+    ImagePoolResetStats();
+    
+    // Uma imagem destruída fica no pool e é reutilizada, já limpa
+    Image img = ImageCreateChess(64, 48, 5, RED);
+    Image recycled = img;
+    ImageDestroy(&img);
+    ImagePoolStats stats;
+    ImagePoolGetStats(&stats);
+    test("Imagem guardada no pool", stats.returns == 1 && stats.images == 1);
+    
+    ImagePoolResetStats();
+    img = ImageCreate(64, 48);
+    Image white = ImageCreate(64, 48);  // o pool já está vazio
+    test("Reutilizada sem alocar", img == recycled);
+    test("Reutilizada está toda BRANCA e com LUT inicial",
+         ImageIsEqual(img, white) && ImageColors(img) == 2);
+    ImagePoolGetStats(&stats);
+    test("1 acerto, 1 falha", stats.hits == 1 && stats.misses == 1 &&
+         stats.hitRate == 0.5);
+    
+    // Em regime (criar/destruir com as mesmas dimensões) não há alocações
+    ImageDestroy(&img);
+    Image src = ImageCreateChess(64, 48, 7, GREEN);
+    for (int i = 0; i < 10; i++) {
+        if (i == 1) InstrMemResetPeaks();  // a 1ª iteração enche o pool
+        Image copy = ImageCopy(src);
+        Image rotated = ImageRotate180CW(copy);
+        ImageDestroy(&copy);
+        ImageDestroy(&rotated);
+    }
+    test("Em regime: nenhuma alocação de píxeis", allocations() == 0);
+    
+    // Sub-imagens não entram no pool
+    ImagePoolGetStats(&stats);
+    size_t pooled = stats.images;
+    Image sub = ImageSubView(src, 2, 2, 10, 10);
+    ImageDestroy(&sub);
+    ImagePoolGetStats(&stats);
+    test("Sub-imagem não entra no pool", stats.images == pooled);
+    
+    // Capacidade: imagens que não cabem são libertadas
+    Image big = ImageCreate(1024, 1024);
+    ImageDestroy(&big);
+    ImagePoolGetStats(&stats);
+    test("Imagem acima da capacidade rejeitada", stats.rejected == 1);
+    
+    // Trim e desativação devolvem toda a memória
+    ImageDestroy(&white);
+    ImageDestroy(&src);
+    ImagePoolGetStats(&stats);
+    size_t held = stats.bytes;
+    ImagePoolTrim(held / 2);
+    ImagePoolGetStats(&stats);
+    test("Trim reduz o pool", stats.bytes <= held / 2 && stats.trimmed > 0);
+    ImagePoolEnable(0);
+    ImagePoolGetStats(&stats);
+    test("Desativado: pool vazio", stats.images == 0 && stats.bytes == 0);
+    test("Memória volta ao valor inicial", InstrMemCurrentTotal() == baseline);
+}
+
+// ============================================================================
+// TESTE 25: Compactação da LUT
+// ============================================================================
+// Imagem com as mesmas cores RGB que img (passando por um ficheiro PPM)
+static Image rgbOf(const Image img) {
+    ImageSavePPM(img, "test_compact.ppm");
+    Image rgb = ImageLoadPPM("test_compact.ppm");
+    remove("test_compact.ppm");
+    return rgb;
+}
+
+void test_CompactLUT() {
+    printf("\n=== TESTE 25: Compactação da LUT ===\n");
+    
+    Image img = ImageCreateChess(60, 40, 10, BLACK);
+    int regions = ImageSegmentation(img, ImageRegionFillingWithSTACK);
+    
+    // Sem nada para recolher, nada muda
+    Image copy = ImageCopy(img);
+    test("Sem labels a recolher: nada muda",
+         ImageCompactLUT(img) == regions + 2 && ImageIsEqual(img, copy));
+    
+    // Pintar a mesma região de BRANCO: quando já é BRANCA, o preenchimento
+    // acrescenta um label novo (e o anterior fica sem píxeis)
+    for (int i = 0; i < 51; i++)
+        ImageRegionFillingWithSTACK(img, 0, 0, WHITE);
+    test("Preenchimentos repetidos fazem crescer a LUT",
+         ImageColors(img) == regions + 2 + 25);
+    
+    Image before = rgbOf(img);
+    uint16 colors = ImageCompactLUT(img);
+    Image after = rgbOf(img);
+    // A região (0, 0) é agora BRANCA: o seu label original também sai
+    test("Labels sem píxeis e cores repetidas recolhidos",
+         colors == regions + 1 && ImageColors(img) == colors);
+    test("Imagem com o mesmo aspeto", ImageIsEqual(before, after));
+    
+    // Sem compactar, a LUT esgota-se e o preenchimento deixa de funcionar
+    int filled = 1;
+    for (int i = 0; i < 2000 && filled > 0; i++)
+        filled = ImageRegionFillingWithSTACK(img, 0, 0, WHITE);
+    test("LUT esgotada: preenchimento falha",
+         filled == 0 && ImageColors(img) == 1000);  // FIXED_LUT_SIZE
+    ImageCompactLUT(img);
+    test("Depois de compactar volta a haver espaço",
+         ImageColors(img) == regions + 1 &&
+         ImageRegionFillingWithSTACK(img, 0, 0, WHITE) == 100);
+    
+    // Outra região repintada da mesma forma fica com outro label, mas com a
+    // mesma cor: os dois labels são juntos. Através de uma sub-imagem
+    // compacta-se a imagem dona inteira
+    ImageRegionFillingWithSTACK(img, 59, 39, WHITE);
+    ImageRegionFillingWithSTACK(img, 59, 39, WHITE);
+    Image sub = ImageSubView(img, 0, 0, 10, 10);
+    Image rgb = rgbOf(img);
+    colors = ImageCompactLUT(sub);
+    Image rgb2 = rgbOf(img);
+    test("Labels com a mesma cor juntos", colors == regions + 1);
+    test("Sub-imagem: compacta a dona", colors == ImageColors(img) &&
+         ImageColors(sub) == colors && ImageIsEqual(rgb, rgb2));
+    
+    ImageDestroy(&sub);
+    ImageDestroy(&rgb);
+    ImageDestroy(&rgb2);
+    ImageDestroy(&before);
+    ImageDestroy(&after);
+    ImageDestroy(&copy);
+    ImageDestroy(&img);
+}
+
+// ============================================================================
+// TESTE 26: Histogramas
+// ============================================================================
+void test_Histogram() {
+    printf("\n=== TESTE 26: Histogramas ===\n");
+    
+    size_t counts[1000];  // FIXED_LUT_SIZE
+    rgb_t colors[1000];
+    
+    // Xadrez 60x40 segmentado: 24 regiões de 10x10
+    Image img = ImageCreateChess(60, 40, 10, BLACK);
+    int regions = ImageSegmentation(img, ImageRegionFillingWithSTACK);
+    ImageHistogram(img, counts);
+    int all100 = 1;
+    for (int l = 2; l < regions + 2; l++) all100 &= (counts[l] == 100);
+    test("Uma contagem por label", counts[WHITE] == 0 && counts[BLACK] == 0 &&
+         all100);
+    
+    // Labels diferentes com a mesma cor: contados juntos por cor
+    for (int i = 0; i < 2; i++) {
+        ImageRegionFillingWithSTACK(img, 0, 0, WHITE);
+        ImageRegionFillingWithSTACK(img, 59, 39, WHITE);
+    }
+    uint16 n = ImageColorHistogram(img, colors, counts);
+    size_t total = 0;
+    int merged = 0;
+    for (uint16 k = 0; k < n; k++) {
+        total += counts[k];
+        if (counts[k] == 200) merged++;
+    }
+    test("Histograma por cor junta labels com a mesma cor",
+         n == regions - 1 && merged == 1 && total == 60 * 40);
+    
+    // Sub-imagem: só os seus píxeis
+    Image sub = ImageSubView(img, 5, 5, 10, 10);
+    ImageHistogram(sub, counts);
+    total = 0;
+    for (uint16 l = 0; l < ImageColors(sub); l++) total += counts[l];
+    test("Sub-imagem: só conta os seus píxeis", total == 100);
+    
+    // Várias threads: o mesmo resultado (largura não múltipla dos bancos)
+    Image noise = ImageCreateNoise(1027, 601, 0.3, 7);
+    size_t single[2], parallel[2];
+    ImageHistogram(noise, single);
+    ImageHistogramN(noise, parallel, 4);
+    test("Várias threads = uma thread", single[WHITE] == parallel[WHITE] &&
+         single[BLACK] == parallel[BLACK] &&
+         single[WHITE] + single[BLACK] == 1027 * 601);
+    
+    // Mais threads do que lugares no registo da instrumentação
+    Image big = ImageCreateNoise(2200, 2200, 0.3, 7);
+    ImageHistogram(big, single);
+    ImageHistogramN(big, parallel, INSTR_MAX_THREADS + 8);
+    test("Histograma com INSTR_MAX_THREADS + 8 threads",
+         single[WHITE] == parallel[WHITE] && single[BLACK] == parallel[BLACK]);
+    ImageDestroy(&big);
+    
+    ImageDestroy(&noise);
+    ImageDestroy(&sub);
+    ImageDestroy(&img);
+}
+
+// ============================================================================
+// TESTE 27: Leitura de PPM com quantização da paleta
+// ============================================================================
+// Gradiente W x H com muitas cores (mais do que cabem na LUT)
+static void writeGradientPPM(const char* filename, int W, int H) {
+    FILE* f = fopen(filename, "w");
+    fprintf(f, "P3\n%d %d\n255\n", W, H);
+    for (int y = 0; y < H; y++) {
+        for (int x = 0; x < W; x++)
+            fprintf(f, "%d %d %d ", x & 255, y & 255, (x * y) & 255);
+        fprintf(f, "\n");
+    }
+    fclose(f);
+}
+
+void test_QuantizedLoad() {
+    printf("\n=== TESTE 27: Leitura de PPM com quantização ===\n");
+    
+    // Poucas cores: o mesmo que ImageLoadPPM
+    Image img = ImageCreateChess(60, 40, 10, BLUE);
+    ImageSegmentation(img, ImageRegionFillingWithQUEUE);
+    ImageSavePPM(img, "test_quant.ppm");
+    Image exact = ImageLoadPPM("test_quant.ppm");
+    Image loaded = ImageLoadPPMQuantized("test_quant.ppm");
+    test("Cores que cabem na LUT: igual a ImageLoadPPM",
+         ImageIsEqual(exact, loaded));
+    ImageDestroy(&loaded);
+    ImageDestroy(&exact);
+    ImageDestroy(&img);
+    
+    // Dezenas de milhares de cores: reduzidas ao tamanho da LUT
+    const int W = 200, H = 150;
+    writeGradientPPM("test_quant.ppm", W, H);
+    loaded = ImageLoadPPMQuantized("test_quant.ppm");
+    test("Muitas cores: carregada sem estourar a LUT",
+         ImageWidth(loaded) == (uint32)W && ImageHeight(loaded) == (uint32)H &&
+         ImageColors(loaded) <= 1000 && ImageColors(loaded) > 500);
+    
+    // Erro de cada canal em relação ao original
+    ImageSavePPM(loaded, "test_quant2.ppm");
+    FILE* f = fopen("test_quant2.ppm", "r");
+    int w, h, levels;
+    int ok = fscanf(f, "P3 %d %d %d", &w, &h, &levels) == 3;
+    long sumError = 0;
+    int maxError = 0;
+    for (int y = 0; y < H && ok; y++) {
+        for (int x = 0; x < W && ok; x++) {
+            int rgb[3], orig[3] = {x & 255, y & 255, (x * y) & 255};
+            ok = fscanf(f, "%d %d %d", &rgb[0], &rgb[1], &rgb[2]) == 3;
+            for (int c = 0; c < 3; c++) {
+                int e = abs(rgb[c] - orig[c]);
+                sumError += e;
+                if (e > maxError) maxError = e;
+            }
+        }
+    }
+    fclose(f);
+    double meanError = (double)sumError / (3.0 * W * H);
+    printf("  erro médio por canal: %.2f, máximo: %d\n", meanError, maxError);
+    test("Cores próximas das originais", ok && meanError < 8 && maxError < 64);
+    
+    remove("test_quant.ppm");
+    remove("test_quant2.ppm");
+    ImageDestroy(&loaded);
+}
+
+// ============================================================================
+// TESTE 28: Conversão para buffers RGB24 / RGBA32
+// ============================================================================
+void test_RGBBuffers() {
+    printf("\n=== TESTE 28: Buffers RGB24 / RGBA32 ===\n");
+    
+    // Largura que não é múltipla de 8 (píxeis finais sem SIMD)
+    const uint32 W = 61, H = 23;
+    const size_t stride = 3 * W + 5;  // com padding no fim de cada linha
+    Image img = ImageCreateChess(W, H, 4, BLUE);
+    ImageSegmentation(img, ImageRegionFillingWithSTACK);
+    
+    uint8* rgb = malloc(stride * H);
+    uint8* rgba = malloc(4 * W * H);
+    memset(rgb, 0xAB, stride * H);
+    ImageToRGB24(img, rgb, stride);
+    ImageToRGBA32(img, rgba, 0);
+    
+    // A cor de cada pixel, via PPM
+    ImageSavePPM(img, "test_rgb.ppm");
+    FILE* f = fopen("test_rgb.ppm", "r");
+    int w, h, levels;
+    int ok = fscanf(f, "P3 %d %d %d", &w, &h, &levels) == 3;
+    int same24 = 1, same32 = 1, padding = 1;
+    for (uint32 y = 0; y < H && ok; y++) {
+        for (uint32 x = 0; x < W && ok; x++) {
+            int c[3];
+            ok = fscanf(f, "%d %d %d", &c[0], &c[1], &c[2]) == 3;
+            const uint8* p24 = rgb + y * stride + 3 * x;
+            const uint8* p32 = rgba + (y * W + x) * 4;
+            for (int k = 0; k < 3; k++) {
+                same24 &= (p24[k] == c[k]);
+                same32 &= (p32[k] == c[k]);
+            }
+            same32 &= (p32[3] == 255);
+        }
+        for (size_t k = 3 * W; k < stride; k++)
+            padding &= (rgb[y * stride + k] == 0xAB);
+    }
+    fclose(f);
+    remove("test_rgb.ppm");
+    test("RGB24 com as cores da LUT", ok && same24);
+    test("RGB24 não toca no padding", padding);
+    test("RGBA32 com as cores da LUT e alfa 255", ok && same32);
+    
+    // Volta: labels pela ordem em que as cores aparecem
+    Image back = ImageFromRGB24(rgb, W, H, stride);
+    test("FromRGB24(ToRGB24(img)) = img", ImageIsEqual(back, img));
+    ImageDestroy(&back);
+    
+    // Mais cores do que a LUT: quantizadas em vez de abortar
+    const uint32 GW = 256, GH = 64;
+    uint8* grad = malloc(3 * GW * GH);
+    for (uint32 y = 0; y < GH; y++)
+        for (uint32 x = 0; x < GW; x++) {
+            grad[3 * (y * GW + x)] = (uint8)x;
+            grad[3 * (y * GW + x) + 1] = (uint8)(4 * y);
+            grad[3 * (y * GW + x) + 2] = 128;
+        }
+    back = ImageFromRGB24(grad, GW, GH, 0);
+    test("FromRGB24 com muitas cores: quantizada",
+         ImageWidth(back) == GW && ImageColors(back) <= 1000);
+    
+    ImageDestroy(&back);
+    free(grad);
+    free(rgba);
+    free(rgb);
+    ImageDestroy(&img);
+}
+
+// ============================================================================
+// TESTE 29: Imagens em ladrilhos
+// ============================================================================
+void test_Tiled() {
+    printf("\n=== TESTE 29: Imagens em ladrilhos ===\n");
+    
+    // Dimensões que não são múltiplas de 8 (ladrilhos com padding)
+    Image img = ImageCreateMaze(101, 77);
+    ImageTiled t = ImageTiledFromImage(img);
+    Image back = ImageTiledToImage(t);
+    test("Conversão ida e volta", ImageIsEqual(img, back) &&
+         ImageTiledWidth(t) == 101 && ImageTiledHeight(t) == 77);
+    ImageDestroy(&back);
+    
+    // Preenchimento: o mesmo que com STACK
+    Image ref = ImageCopy(img);
+    int n1 = ImageRegionFillingWithSTACK(ref, 1, 1, 1);
+    int n2 = ImageTiledRegionFilling(t, 1, 1, 1);
+    back = ImageTiledToImage(t);
+    test("Preenchimento = STACK", n1 == n2 && n1 > 1 &&
+         ImageIsEqual(ref, back));
+    ImageDestroy(&back);
+    ImageDestroy(&ref);
+    ImageTiledDestroy(&t);
+    
+    // Segmentação: os mesmos labels e LUT
+    Image noise = ImageCreateNoise(203, 61, 0.45, 11);
+    t = ImageTiledFromImage(noise);
+    int r1 = ImageSegmentation(noise, ImageRegionFillingWithSTACK);
+    int r2 = ImageTiledSegmentation(t);
+    back = ImageTiledToImage(t);
+    test("Segmentação = ImageSegmentation", r1 == r2 &&
+         ImageIsEqual(noise, back));
+    ImageDestroy(&back);
+    
+    // Rotação por ladrilhos
+    Image rot = ImageRotate90CW(noise);
+    ImageTiled trot = ImageTiledRotate90CW(t);
+    back = ImageTiledToImage(trot);
+    test("Rotate90CW por ladrilhos = ImageRotate90CW",
+         ImageIsEqual(rot, back) && ImageTiledGetPixel(trot, 0, 0) ==
+         ImageTiledGetPixel(t, 0, 60));
+    
+    ImageDestroy(&back);
+    ImageDestroy(&rot);
+    ImageTiledDestroy(&trot);
+    ImageTiledDestroy(&t);
+    ImageDestroy(&noise);
+    ImageDestroy(&img);
+}
+
 // ============================================================================
 // TESTE DE PERFORMANCE
 // ============================================================================
 void test_Performance() {
     printf("\n=== TESTE DE PERFORMANCE ===\n");
+    
+    // Contadores de hardware (perf_event_open), se o sistema permitir
+    int nperf = InstrPerfOpen();
+    printf("Contadores de hardware disponíveis: %d / %d\n", nperf, INSTR_NUMPERF);
     printf("Comparando Region Filling 150150 (22500 pixels)\n\n");
     
     // Recursive
@@ -343,6 +1709,8 @@ void test_Performance() {
     InstrPrint();
     ImageDestroy(&rot180);
     ImageDestroy(&large);
+    
+    InstrPerfClose();
 }
 
 // ============================================================================
@@ -366,6 +1734,27 @@ int main(int argc, char* argv[]) {
     test_RegionFillingWithSTACK();
     test_RegionFillingWithQUEUE();
     test_ImageSegmentation();
+    test_ImageTransforms();
+    test_ImageView();
+    test_ImageSubView();
+    test_InstrThreads();
+    test_InstrCalibrate();
+    test_InstrTrace();
+    test_InstrMemory();
+    test_Generators();
+    test_Batch();
+    test_RegionFillingParallel();
+    test_RegionFillingDistances();
+    test_ImageRLE();
+    test_FormatLBL();
+    test_BatchPipeline();
+    test_DestinationPassing();
+    test_ImagePool();
+    test_CompactLUT();
+    test_Histogram();
+    test_QuantizedLoad();
+    test_RGBBuffers();
+    test_Tiled();
     
     // Testes de performance (opcional)
     if (argc > 1 && strcmp(argv[1], "--perf") == 0) {
@@ -388,6 +1777,7 @@ int main(int argc, char* argv[]) {
     printf("|  Ficheiros gerados:                                      |\n");
     printf("|    • test_rotate90.ppm                                   |\n");
     printf("|    • test_rotate180.ppm                                  |\n");
+    printf("|    • test_view90.ppm                                     |\n");
     printf("|    • test_segmentation_chess.ppm                         |\n");
     printf("|    • test_segmentation_feep.ppm                          |\n");
     printf("+----------------------------------------------------------+\n");